@@ -0,0 +1,705 @@
+/**
+ * Batch processing of observer records
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <libnova/libnova.h>
+
+#include "batch.h"
+#include "objects.h"
+#include "formatter.h"
+#include "stats.h"
+
+#define BATCH_MAX_FIELDS 4
+
+struct record {
+	struct ln_lnlat_posn obs;
+	const char *tzid;
+	struct tm tm;
+};
+
+/** Reorder buffer shared between the main thread and the workers */
+struct pool {
+	const struct batch_config *cfg;
+
+	struct batch_job *slots;
+	bool *done;
+	size_t size;
+
+	size_t produced;	/**< Number of jobs handed to the workers */
+	size_t claimed;		/**< Number of jobs taken by a worker */
+	bool eof;
+
+	pthread_mutex_t lock;
+	pthread_cond_t queued;	/**< Signals workers about new jobs */
+	pthread_cond_t finished;/**< Signals the main thread about completed jobs */
+};
+
+struct batch_ctx {
+	const struct batch_config *cfg;
+
+	FILE *in;
+	char *line;
+	size_t linelen;
+
+	int ret;
+};
+
+/** Timezones of the calling thread while it converts and renders jobs */
+struct zones {
+	char current[64];	/**< Currently active timezone */
+	char initial[64];	/**< Of the process, for jobs without a timezone */
+};
+
+/** A range of jobs in a ring of slots */
+struct range {
+	struct batch_job *slots;
+	bool *seen;		/**< Scratch space of one flag per slot */
+	size_t size;
+	size_t first, last;
+};
+
+struct series_ctx {
+	const struct batch_config *cfg;
+
+	struct ln_lnlat_posn obs;
+	struct tm tm;
+	time_t t, end;
+	int step_secs, step_days;
+
+	int ret;
+};
+
+/** Split a line into fields separated by commas or whitespace */
+static int split_fields(char *line, char *fields[], int max)
+{
+	int n = 0;
+	char *tok, *end, *saveptr;
+
+	if (strchr(line, ',')) {
+		/* CSV: keep empty fields to preserve positions */
+		for (tok = line; tok && n < max; n++) {
+			char *sep = strchr(tok, ',');
+			if (sep)
+				*sep++ = '\0';
+
+			while (isspace(*tok))
+				tok++;
+			for (end = tok + strlen(tok); end > tok && isspace(end[-1]); end--)
+				end[-1] = '\0';
+
+			fields[n] = tok;
+			tok = sep;
+		}
+	}
+	else {
+		for (tok = strtok_r(line, " \t\r\n", &saveptr); tok && n < max; tok = strtok_r(NULL, " \t\r\n", &saveptr))
+			fields[n++] = tok;
+	}
+
+	return n;
+}
+
+int batch_parse_date(const char *str, struct tm *tm)
+{
+	const char *end;
+
+	tm->tm_isdst = -1; /* update dst */
+
+	if (strchr(str, '_'))
+		end = strptime(str, "%Y-%m-%d_%H:%M:%S", tm);
+	else if (strchr(str, 'T'))
+		end = strptime(str, "%Y-%m-%dT%H:%M:%S", tm);
+	else
+		end = strptime(str, "%Y-%m-%d", tm);
+
+	return end && *end == '\0' ? 0 : -1;
+}
+
+static int parse_record(char *line, const struct batch_config *cfg, struct record *rec)
+{
+	char *fields[BATCH_MAX_FIELDS] = { NULL }, *endptr;
+	int n, i;
+
+	n = split_fields(line, fields, BATCH_MAX_FIELDS);
+	if (n < 2)
+		return -1;
+
+	rec->obs.lat = strtod(fields[0], &endptr);
+	if (endptr == fields[0] || fabs(rec->obs.lat) > 90)
+		return -1;
+
+	rec->obs.lng = strtod(fields[1], &endptr);
+	if (endptr == fields[1] || fabs(rec->obs.lng) > 180)
+		return -1;
+
+	rec->tzid = cfg->tzid;
+	rec->tm = cfg->tm;
+
+	/* the timezone is optional: a date starts with a digit */
+	for (i = 2; i < n; i++) {
+		if (fields[i][0] == '\0')
+			continue;
+		else if (isdigit(fields[i][0])) {
+			if (batch_parse_date(fields[i], &rec->tm))
+				return -1;
+		}
+		else
+			rec->tzid = fields[i];
+	}
+
+	rec->tzid = batch_resolve_tz(cfg, rec->tzid, rec->obs);
+
+	return 0;
+}
+
+const char * batch_resolve_tz(const struct batch_config *cfg, const char *tzid, struct ln_lnlat_posn obs)
+{
+	uint64_t start;
+
+	if (!tzid || strcmp(tzid, "auto"))
+		return tzid;
+
+	start = stats_begin();
+	tzid = cfg->tzindex ? tzindex_lookup(cfg->tzindex, obs.lat, obs.lng) : NULL;
+	stats_end(STATS_TZ, start);
+
+	return tzid;
+}
+
+void batch_switch_tz(const char *tzid, char *current, size_t len)
+{
+	uint64_t start;
+
+	if (!tzid)
+		tzid = "";
+
+	if (!strcmp(tzid, current))
+		return;
+
+	start = stats_begin();
+	snprintf(current, len, "%s", tzid);
+
+	if (strlen(current) > 0)
+		setenv("TZ", current, 1);
+	else
+		unsetenv("TZ"); /* fallback to /etc/localtime */
+	tzset();
+
+	stats_end(STATS_TZ, start);
+}
+
+static void calc(const struct batch_config *cfg, struct batch_job *job)
+{
+	if (job->ret == 0)
+		job->ret = object_calc(cfg->obj, job->jd, cfg->moment, cfg->next, cfg->horizon, &job->result);
+}
+
+static void zones_init(struct zones *z)
+{
+	const char *env = getenv("TZ");
+
+	snprintf(z->initial, sizeof(z->initial), "%s", env ? env : "");
+	snprintf(z->current, sizeof(z->current), "%s", z->initial);
+}
+
+static const char * zone(const struct zones *z, const struct batch_job *job)
+{
+	return job->tzid[0] ? job->tzid : z->initial;
+}
+
+static bool unconverted(const struct batch_job *job)
+{
+	return job->ret == 0 && isnan(job->jd);
+}
+
+static bool calculated(const struct batch_job *job)
+{
+	return job->ret == 0;
+}
+
+/** Convert the local time of a job which was not given as julian date */
+static void localize(void *ctx, struct batch_job *job)
+{
+	time_t t = mktime(&job->tm);
+
+	job->jd = ln_get_julian_from_timet(&t);
+}
+
+/** Call fn for the remaining jobs of a range in the active timezone */
+static void visit_zone(struct range *r, const struct zones *z, void (*fn)(void *ctx, struct batch_job *job), void *ctx)
+{
+	struct batch_job *job;
+	size_t i;
+
+	for (i = r->first; i < r->last; i++) {
+		job = &r->slots[i % r->size];
+
+		if (!r->seen[i % r->size] && !strcmp(zone(z, job), z->current)) {
+			fn(ctx, job);
+			r->seen[i % r->size] = true;
+		}
+	}
+}
+
+/** Call fn for the jobs of a range which need it, grouped by timezone.
+ *
+ * Every timezone is switched to only once, the active one goes first.
+ */
+static void for_each_zone(struct range *r, struct zones *z,
+	bool (*need)(const struct batch_job *job), void (*fn)(void *ctx, struct batch_job *job), void *ctx)
+{
+	size_t i;
+
+	for (i = r->first; i < r->last; i++)
+		r->seen[i % r->size] = !need(&r->slots[i % r->size]);
+
+	visit_zone(r, z, fn, ctx);
+
+	for (i = r->first; i < r->last; i++) {
+		if (r->seen[i % r->size])
+			continue;
+
+		batch_switch_tz(zone(z, &r->slots[i % r->size]), z->current, sizeof(z->current));
+		visit_zone(r, z, fn, ctx);
+	}
+}
+
+static void * worker(void *arg)
+{
+	struct pool *p = arg;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+
+		while (p->claimed == p->produced && !p->eof)
+			pthread_cond_wait(&p->queued, &p->lock);
+
+		if (p->claimed == p->produced) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+
+		/* idle workers always take the oldest pending job */
+		i = p->claimed++ % p->size;
+		pthread_mutex_unlock(&p->lock);
+
+		calc(p->cfg, &p->slots[i]);
+
+		pthread_mutex_lock(&p->lock);
+		p->done[i] = true;
+		pthread_cond_signal(&p->finished);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	return NULL;
+}
+
+static void job_init(struct batch_job *job, size_t seq)
+{
+	job->seq = seq;
+	job->ret = 0;
+	job->jd = NAN;
+	job->tzid[0] = '\0';
+}
+
+static int run_serial(const struct batch_config *cfg,
+	int (*produce)(void *ctx, struct batch_job *job),
+	void (*render)(void *ctx, struct batch_job *job),
+	void (*emit)(void *ctx, struct batch_job *job), void *ctx)
+{
+	struct batch_job job = { 0 };
+	struct zones z;
+	bool seen;
+	struct range r = {
+		.slots = &job,
+		.seen = &seen,
+		.size = 1,
+		.last = 1
+	};
+
+	zones_init(&z);
+
+	for (job_init(&job, 0); !produce(ctx, &job); job_init(&job, job.seq + 1)) {
+		for_each_zone(&r, &z, unconverted, localize, NULL);
+		calc(cfg, &job);
+		for_each_zone(&r, &z, calculated, render, ctx);
+		emit(ctx, &job);
+	}
+
+	format_buffer_free(&job.out);
+
+	return 0;
+}
+
+int batch_run(const struct batch_config *cfg,
+	int (*produce)(void *ctx, struct batch_job *job),
+	void (*render)(void *ctx, struct batch_job *job),
+	void (*emit)(void *ctx, struct batch_job *job), void *ctx)
+{
+	int started = 0, ret = 0;
+	size_t i, n, round, emitted = 0;
+	bool eof = false;
+	pthread_t *threads;
+	struct zones z;
+	struct range r;
+	struct pool p = {
+		.cfg = cfg,
+		.size = BATCH_WINDOW * cfg->jobs,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.queued = PTHREAD_COND_INITIALIZER,
+		.finished = PTHREAD_COND_INITIALIZER
+	};
+
+	if (cfg->jobs <= 1)
+		return run_serial(cfg, produce, render, emit, ctx);
+
+	zones_init(&z);
+
+	p.slots = calloc(p.size, sizeof(struct batch_job));
+	p.done = calloc(p.size, sizeof(bool));
+	r.seen = malloc(p.size * sizeof(bool));
+	threads = malloc(cfg->jobs * sizeof(pthread_t));
+	if (!p.slots || !p.done || !r.seen || !threads) {
+		ret = -1;
+		goto out;
+	}
+
+	r.slots = p.slots;
+	r.size = p.size;
+
+	for (started = 0; started < cfg->jobs; started++) {
+		if (pthread_create(&threads[started], NULL, worker, &p)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	/* the window holds two rounds: the workers calculate one while the
+	 * other is produced and emitted by the calling thread */
+	while (!ret) {
+		round = p.produced;
+
+		for (n = 0; n < p.size / 2; n++) {
+			struct batch_job *job = &p.slots[(round + n) % p.size];
+
+			job_init(job, round + n);
+			if (produce(ctx, job)) {
+				eof = true;
+				break;
+			}
+
+			p.done[(round + n) % p.size] = false;
+		}
+
+		r.first = round;
+		r.last = round + n;
+		for_each_zone(&r, &z, unconverted, localize, NULL);
+
+		pthread_mutex_lock(&p.lock);
+		p.produced += n;
+		p.eof = eof;
+		pthread_cond_broadcast(&p.queued);
+		pthread_mutex_unlock(&p.lock);
+
+		/* the previous round, or all remaining jobs at the end of the input */
+		r.first = emitted;
+		r.last = eof ? p.produced : round;
+
+		pthread_mutex_lock(&p.lock);
+		for (i = r.first; i < r.last; i++) {
+			while (!p.done[i % p.size])
+				pthread_cond_wait(&p.finished, &p.lock);
+		}
+		pthread_mutex_unlock(&p.lock);
+
+		for_each_zone(&r, &z, calculated, render, ctx);
+
+		for (; emitted < r.last; emitted++)
+			emit(ctx, &p.slots[emitted % p.size]);
+
+		if (eof)
+			break;
+	}
+
+	pthread_mutex_lock(&p.lock);
+	p.eof = true;
+	pthread_cond_broadcast(&p.queued);
+	pthread_mutex_unlock(&p.lock);
+
+	while (started--)
+		pthread_join(threads[started], NULL);
+
+out:	for (i = 0; p.slots && i < p.size; i++)
+		format_buffer_free(&p.slots[i].out);
+
+	free(threads);
+	free(r.seen);
+	free(p.done);
+	free(p.slots);
+
+	return ret;
+}
+
+static int batch_produce(void *ctx, struct batch_job *job)
+{
+	struct batch_ctx *b = ctx;
+	struct record rec;
+
+	if (getline(&b->line, &b->linelen, b->in) < 0)
+		return 1;
+
+	if (parse_record(b->line, b->cfg, &rec)) {
+		job->ret = BATCH_INVALID;
+		return 0;
+	}
+
+	/* converted by batch_run() together with the other records of the timezone */
+	snprintf(job->tzid, sizeof(job->tzid), "%s", rec.tzid ? rec.tzid : "");
+	job->tm = rec.tm;
+	job->result.obs = rec.obs;
+	job->result.twilights = b->cfg->twilights;
+
+	return 0;
+}
+
+static void batch_render(void *ctx, struct batch_job *job)
+{
+	struct batch_ctx *b = ctx;
+
+	object_localtime(&job->result);
+	if (!format_render(b->cfg->format, &job->result, &job->out))
+		job->ret = BATCH_ENOMEM;
+}
+
+static void batch_emit(void *ctx, struct batch_job *job)
+{
+	struct batch_ctx *b = ctx;
+
+	switch (job->ret) {
+		case 0:
+			fwrite(job->out.ptr, 1, job->out.len, stdout);
+			break;
+
+		case BATCH_INVALID:
+			fprintf(stderr, "Error: invalid record in line %zu\n", job->seq + 1);
+			b->ret = -1;
+			break;
+
+		case BATCH_ENOMEM:
+			fprintf(stderr, "Error: failed to format result in line %zu\n", job->seq + 1);
+			b->ret = -1;
+			break;
+
+		default:
+			fprintf(stderr, "object is circumpolar in line %zu\n", job->seq + 1);
+			if (!b->ret)
+				b->ret = EXIT_CIRCUMPOLAR;
+			break;
+	}
+
+	printf("\n");
+}
+
+int batch_process(FILE *in, const struct batch_config *cfg)
+{
+	struct batch_config c = *cfg;
+	struct batch_ctx b = {
+		.cfg = &c,
+		.in = in
+	};
+
+	/* records without a timezone fall back to the one we started with */
+	if (!c.tzid || strlen(c.tzid) == 0)
+		c.tzid = getenv("TZ");
+
+	if (batch_run(&c, batch_produce, batch_render, batch_emit, &b))
+		b.ret = -1;
+
+	free(b.line);
+
+	return b.ret;
+}
+
+int batch_read_sites(FILE *in, const struct batch_config *cfg, struct batch_site **sites)
+{
+	char *fields[BATCH_MAX_FIELDS], *line = NULL, *endptr;
+	const char *tzid, *resolved;
+	struct batch_site *site, *tmp;
+	size_t linelen = 0, size = 0, lineno = 0;
+	double value;
+	int n = 0, i, nf;
+
+	*sites = NULL;
+
+	/* records without a timezone fall back to the one we started with */
+	tzid = cfg->tzid && strlen(cfg->tzid) > 0 ? cfg->tzid : getenv("TZ");
+
+	while (getline(&line, &linelen, in) >= 0) {
+		lineno++;
+
+		nf = split_fields(line, fields, BATCH_MAX_FIELDS);
+		if (nf == 0)
+			continue;
+
+		if ((size_t) n == size) {
+			size = size ? 2 * size : 64;
+			tmp = realloc(*sites, size * sizeof(**sites));
+			if (!tmp) {
+				fprintf(stderr, "Error: out of memory\n");
+				goto error;
+			}
+			*sites = tmp;
+		}
+
+		site = &(*sites)[n];
+		site->value = NAN;
+		snprintf(site->tzid, sizeof(site->tzid), "%s", tzid ? tzid : "");
+
+		if (nf < 2)
+			goto invalid;
+
+		site->obs.lat = strtod(fields[0], &endptr);
+		if (endptr == fields[0] || fabs(site->obs.lat) > 90)
+			goto invalid;
+
+		site->obs.lng = strtod(fields[1], &endptr);
+		if (endptr == fields[1] || fabs(site->obs.lng) > 180)
+			goto invalid;
+
+		/* the value is optional: a timezone does not start with a number */
+		for (i = 2; i < nf; i++) {
+			if (fields[i][0] == '\0')
+				continue;
+
+			value = strtod(fields[i], &endptr);
+			if (endptr == fields[i])
+				snprintf(site->tzid, sizeof(site->tzid), "%s", fields[i]);
+			else if (*endptr == '\0')
+				site->value = value;
+			else
+				goto invalid;
+		}
+
+		resolved = batch_resolve_tz(cfg, site->tzid, site->obs);
+		if (resolved != site->tzid)
+			snprintf(site->tzid, sizeof(site->tzid), "%s", resolved ? resolved : "");
+
+		n++;
+		continue;
+
+invalid:	fprintf(stderr, "Error: invalid record in line %zu\n", lineno);
+		goto error;
+	}
+
+	free(line);
+
+	return n;
+
+error:	free(line);
+	free(*sites);
+	*sites = NULL;
+
+	return -1;
+}
+
+static int series_produce(void *ctx, struct batch_job *job)
+{
+	struct series_ctx *s = ctx;
+
+	if (s->t > s->end)
+		return 1;
+
+	job->jd = ln_get_julian_from_timet(&s->t);
+	job->result.obs = s->obs;
+	job->result.twilights = s->cfg->twilights;
+
+	/* calendar days keep the wall clock time across DST changes */
+	if (s->step_days) {
+		s->tm.tm_mday += s->step_days;
+		s->tm.tm_isdst = -1;
+		s->t = mktime(&s->tm);
+	}
+	else
+		s->t += s->step_secs;
+
+	return 0;
+}
+
+static void series_render(void *ctx, struct batch_job *job)
+{
+	struct series_ctx *s = ctx;
+
+	object_localtime(&job->result);
+	if (!format_render(s->cfg->format, &job->result, &job->out))
+		job->ret = BATCH_ENOMEM;
+}
+
+static void series_emit(void *ctx, struct batch_job *job)
+{
+	struct series_ctx *s = ctx;
+
+	if (job->ret == BATCH_ENOMEM) {
+		fprintf(stderr, "Error: failed to format result\n");
+		return;
+	}
+
+	if (job->ret) {
+		fprintf(stderr, "object is circumpolar at %.3f\n", job->jd);
+		s->ret = EXIT_CIRCUMPOLAR;
+		return;
+	}
+
+	fwrite(job->out.ptr, 1, job->out.len, stdout);
+	putchar('\n');
+}
+
+int batch_series(const struct batch_config *cfg, struct ln_lnlat_posn obs,
+	struct tm start, struct tm end, int step_secs, int step_days)
+{
+	struct series_ctx s = {
+		.cfg = cfg,
+		.obs = obs,
+		.tm = start,
+		.step_secs = step_secs,
+		.step_days = step_days
+	};
+
+	s.t = mktime(&s.tm);
+	s.end = mktime(&end);
+
+	if (batch_run(cfg, series_produce, series_render, series_emit, &s))
+		return -1;
+
+	return s.ret;
+}
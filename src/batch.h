@@ -0,0 +1,151 @@
+/**
+ * Batch processing of observer records
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "objects.h"
+#include "formatter.h"
+#include "tzindex.h"
+
+#define BATCH_WINDOW 64		/**< Number of queued records per worker thread */
+
+#define BATCH_INVALID	-2	/**< Result of a job for an invalid record */
+#define BATCH_ENOMEM	-3	/**< Result of a job which could not be rendered */
+
+struct batch_config {
+	const struct object *obj;
+	enum object_moment moment;
+	bool next;
+	double horizon;
+	unsigned twilights;		/**< Bitmask of enum object_twilight */
+	bool horizon_set;		/**< The horizon was given explicitly, it only applies to the sun */
+
+	struct format *format;
+	const char *tzid;		/**< Default timezone for records without one */
+	const struct tzindex *tzindex;	/**< Resolves the timezone "auto" from the coordinates */
+	struct tm tm;			/**< Default time for records without one */
+
+	int jobs;			/**< Number of worker threads (0 or 1 for none) */
+};
+
+/** A single unit of work passed through the worker threads */
+struct batch_job {
+	size_t seq;			/**< Position in the input */
+	double jd;			/**< Julian date of the query, NaN to convert tm */
+	struct tm tm;			/**< Local time of the query in tzid */
+	int ret;			/**< Result of object_calc(), BATCH_INVALID or BATCH_ENOMEM */
+	char tzid[64];			/**< Timezone of tm and the result, empty for the one of the process */
+
+	struct object_details result;
+	struct format_buffer out;	/**< Rendered result, reused by later jobs of the slot */
+};
+
+/** An observer read by batch_read_sites() */
+struct batch_site {
+	struct ln_lnlat_posn obs;
+	double value;			/**< Optional number after the coordinates, NaN if missing */
+	char tzid[64];			/**< Timezone for formatting, empty for the one of the process */
+};
+
+/** Parse a date of the form YYYY-MM-DD[_HH:MM:SS] or YYYY-MM-DDTHH:MM:SS
+ *
+ * @retval 0 on success
+ * @retval -1 on a malformed date
+ */
+int batch_parse_date(const char *str, struct tm *tm);
+
+/** Only touch the TZ environment if the timezone actually changed.
+ *
+ * @param current Buffer holding the currently active timezone
+ */
+void batch_switch_tz(const char *tzid, char *current, size_t len);
+
+/** Resolve the timezone "auto" for an observer.
+ *
+ * @return The timezone of the observer, tzid if it is not "auto" or NULL without an index
+ */
+const char * batch_resolve_tz(const struct batch_config *cfg, const char *tzid, struct ln_lnlat_posn obs);
+
+/** Run object_calc() for a stream of jobs.
+ *
+ * The calling thread produces and emits the jobs in rounds of half the
+ * window while the workers calculate the previous round:
+ *
+ * - produce() fills the next job and returns non-zero at the end of the input.
+ *   If it leaves job->jd NaN, job->tm is converted in the timezone job->tzid.
+ * - render() is called for every calculated job with the timezone of the
+ *   process switched to job->tzid.
+ * - emit() is called once for every job in the order they have been produced.
+ *
+ * Local times are converted and results rendered grouped by timezone. So the
+ * timezone is switched once per zone and round instead of once per record.
+ * All callbacks are invoked from the calling thread only.
+ *
+ * @retval 0 on success
+ * @retval -1 if the worker threads could not be started
+ */
+int batch_run(const struct batch_config *cfg,
+	int (*produce)(void *ctx, struct batch_job *job),
+	void (*render)(void *ctx, struct batch_job *job),
+	void (*emit)(void *ctx, struct batch_job *job), void *ctx);
+
+/** Process newline-delimited observer records.
+ *
+ * Each line has the fields: LAT LON [TZ] [YYYY-MM-DD[_HH:MM:SS]]
+ * separated either by commas or by whitespace.
+ * Exactly one line is written for every line read.
+ *
+ * @retval 0 on success
+ * @retval EXIT_CIRCUMPOLAR if the object was circumpolar for at least one record
+ * @retval -1 if at least one record was invalid
+ */
+int batch_process(FILE *in, const struct batch_config *cfg);
+
+/** Read all observer records of a file for searches which share their positions.
+ *
+ * Each line has the fields: LAT LON [VALUE] [TZ]
+ * separated either by commas or by whitespace. Empty lines are skipped.
+ *
+ * @param sites Receives an array to be freed by the caller
+ * @return The number of records or -1 on an invalid record with a message printed to stderr
+ */
+int batch_read_sites(FILE *in, const struct batch_config *cfg, struct batch_site **sites);
+
+/** Process a series of instants for a single observer.
+ *
+ * @param step_secs Step width in seconds
+ * @param step_days Step width in calendar days (takes precedence)
+ * @retval 0 on success
+ * @retval EXIT_CIRCUMPOLAR if the object was circumpolar for at least one instant
+ */
+int batch_series(const struct batch_config *cfg, struct ln_lnlat_posn obs,
+	struct tm start, struct tm end, int step_secs, int step_days);
+
+#endif /* _BATCH_H_ */
@@ -0,0 +1,520 @@
+/**
+ * Micro and macro benchmarks of the hot paths
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <libnova/libnova.h>
+
+#include "../config.h"
+#include "objects.h"
+#include "formatter.h"
+#include "horizontal.h"
+#ifdef GEONAMES_SUPPORT
+  #include "cache.h"
+#endif
+
+#define BENCH_MIN_TIME	200000000	/**< Minimum duration of a measurement in ns */
+#define BENCH_JD	2457755.0	/**< 2017-01-01 00:00 UTC */
+#define BENCH_OBSERVERS	1024		/**< Observers of horizontal_batch() */
+#define BENCH_TOLERANCE	0.1		/**< Of object_interpolate() in arc seconds */
+#define BENCH_SAMPLES	64		/**< Dates per object compared with the series */
+
+extern char **environ;
+
+typedef void (*bench_fn)(void *ctx, unsigned long i);
+
+static FILE *out;
+static const char *filter;
+static int first = 1;
+
+static uint64_t allocs;
+
+#ifdef __GLIBC__
+/* Count allocations by interposing the allocator of the C library */
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t nmemb, size_t size);
+extern void * __libc_realloc(void *ptr, size_t size);
+
+void * malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void * calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void * realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+  #define HAVE_ALLOC_COUNT 1
+#endif
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Run fn often enough to take at least BENCH_MIN_TIME and print one JSON record.
+ *
+ * @param count_allocs Allocations are only counted in this process, not in children
+ */
+static void measure(const char *name, bench_fn fn, void *ctx, int count_allocs)
+{
+	unsigned long i, n;
+	uint64_t start, elapsed, a;
+	double ns;
+
+	if (filter && !strstr(name, filter))
+		return;
+
+	for (n = 1; ; n *= 2) {
+		a = allocs;
+		start = now_ns();
+		for (i = 0; i < n; i++)
+			fn(ctx, i);
+		elapsed = now_ns() - start;
+		a = allocs - a;
+
+		if (elapsed >= BENCH_MIN_TIME)
+			break;
+	}
+
+	ns = (double) elapsed / n;
+
+	fprintf(out, "%s\t{ \"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.1f, \"ops_per_s\": %.1f, \"allocs_per_op\": ",
+		first ? "[\n" : ",\n", name, n, ns, 1e9 / ns);
+#ifdef HAVE_ALLOC_COUNT
+	if (count_allocs)
+		fprintf(out, "%.2f }", (double) a / n);
+	else
+#endif
+		fprintf(out, "null }");
+	fflush(out);
+
+	first = 0;
+}
+
+struct pos_ctx {
+	const struct object *obj;
+	struct object_details details;
+};
+
+static void bench_pos(void *ctx, unsigned long i)
+{
+	struct pos_ctx *c = ctx;
+
+	object_pos(c->obj, BENCH_JD + i * 0.01, &c->details);
+}
+
+struct rst_ctx {
+	const struct object *obj;
+	double horizon;
+	struct ln_lnlat_posn obs;
+	struct ln_rst_time rst;
+};
+
+/* Consecutive days, like --start/--end, wrapping after ten years */
+static void bench_rst(void *ctx, unsigned long i)
+{
+	struct rst_ctx *c = ctx;
+
+	object_rst(c->obj, BENCH_JD + i % 3650, c->horizon, &c->obs, &c->rst);
+}
+
+struct format_ctx {
+	struct format *fmt;
+	struct object_details details;
+};
+
+static void bench_format(void *ctx, unsigned long i)
+{
+	struct format_ctx *c = ctx;
+
+	format_result(c->fmt, &c->details);
+}
+
+struct horizontal_ctx {
+	struct horizontal_observers obs;
+	double az[BENCH_OBSERVERS], alt[BENCH_OBSERVERS];
+};
+
+static void bench_horizontal(void *ctx, unsigned long i)
+{
+	struct horizontal_ctx *c = ctx;
+	struct ln_equ_posn equ = { .ra = i % 360, .dec = 23.4 };
+
+	horizontal_batch(&c->obs, &equ, BENCH_JD + i * 0.01, c->az, c->alt, NULL);
+}
+
+/** Compare horizontal_batch() with ln_get_hrz_from_equ() for all observers and a few positions
+ *
+ * @return The largest deviation in degrees
+ */
+static double verify_horizontal(struct horizontal_ctx *c, const double *lat, const double *lng)
+{
+	struct ln_lnlat_posn obs;
+	struct ln_equ_posn equ;
+	struct ln_hrz_posn hrz;
+	double jd, d, max = 0;
+	int k;
+	size_t i;
+
+	for (k = 0; k < 64; k++) {
+		equ.ra = fmod(k * 37.3, 360);
+		equ.dec = -85 + (k * 23.7) - 170 * floor((k * 23.7) / 170);
+		jd = BENCH_JD + k * 0.37;
+
+		horizontal_batch(&c->obs, &equ, jd, c->az, c->alt, NULL);
+
+		for (i = 0; i < BENCH_OBSERVERS; i++) {
+			obs.lat = lat[i];
+			obs.lng = lng[i];
+			ln_get_hrz_from_equ(&equ, &obs, jd, &hrz);
+
+			max = fmax(max, fabs(c->alt[i] - hrz.alt));
+
+			/* the azimuth is undefined at the zenith and nadir */
+			if (fabs(hrz.alt) < 90 - 1e-6) {
+				d = fabs(c->az[i] - hrz.az);
+				max = fmax(max, fmin(d, 360 - d));
+			}
+		}
+	}
+
+	return max;
+}
+
+/** Dates spread over 20 years, off the boundaries of the interpolation windows */
+static double sample_jd(unsigned c, int k)
+{
+	return BENCH_JD + k * 7305.0 / BENCH_SAMPLES + c * 0.37 + 0.123;
+}
+
+/** Compare the positions of object_interpolate() with the series evaluated before
+ *
+ * @return The largest deviation in arc seconds
+ */
+static double verify_interpolation(const char **objs, unsigned n, struct object_details ref[][BENCH_SAMPLES])
+{
+	struct object_details pos;
+	double d, max = 0;
+	unsigned c;
+	int k;
+
+	for (c = 0; c < n; c++) {
+		for (k = 0; k < BENCH_SAMPLES; k++) {
+			const struct object_details *r = &ref[c][k];
+
+			object_pos(object_lookup(objs[c]), sample_jd(c, k), &pos);
+
+			d = fabs(ln_range_degrees(pos.equ.ra - r->equ.ra + 180) - 180) * 3600 * cos(ln_deg_to_rad(r->equ.dec));
+			max = fmax(max, d);
+			max = fmax(max, fabs(pos.equ.dec - r->equ.dec) * 3600);
+			max = fmax(max, fabs(pos.diameter - r->diameter));
+		}
+	}
+
+	return max;
+}
+
+static void bench_strrepl(void *ctx, unsigned long i)
+{
+	free(strrepl("rise: §r set: §s transit: §t", "§s", "17:32:01"));
+}
+
+#ifdef GEONAMES_SUPPORT
+struct cache_ctx {
+	struct cache *cache;
+	const char *key;
+};
+
+static void bench_cache(void *ctx, unsigned long i)
+{
+	struct cache_ctx *c = ctx;
+	char *data;
+	size_t len;
+
+	if (cache_lookup(c->cache, c->key, &data, &len) == 0)
+		free(data);
+}
+
+static void remove_dir(const char *path)
+{
+	char file[1024];
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(path);
+	if (d) {
+		while ((de = readdir(d))) {
+			if (de->d_name[0] == '.')
+				continue;
+
+			snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+			unlink(file);
+		}
+		closedir(d);
+	}
+
+	rmdir(path);
+}
+#endif
+
+static void bench_process(void *ctx, unsigned long i)
+{
+	char **argv = ctx;
+	posix_spawn_file_actions_t fa;
+	int status;
+	pid_t pid;
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+	if (posix_spawn(&pid, argv[0], &fa, NULL, argv, environ) == 0)
+		waitpid(pid, &status, 0);
+
+	posix_spawn_file_actions_destroy(&fa);
+}
+
+static const char *names[] = { "sun", "moon", "mars", "neptune", "jupiter", "mercury", "uranus", "saturn", "venus", "pluto" };
+
+static const struct {
+	const char *name;
+	double horizon;
+} horizons[] = {
+	{ "standard",     LN_STAR_STANDART_HORIZON },
+	{ "civil",        LN_SOLAR_CIVIL_HORIZON },
+	{ "astronomical", LN_SOLAR_ASTRONOMICAL_HORIZON }
+};
+
+static const struct {
+	const char *name;
+	struct ln_lnlat_posn obs;
+} observers[] = {
+	{ "aachen",    { .lat = 50.77, .lng = 6.08 } },
+	{ "svalbard",  { .lat = 78.22, .lng = 15.65 } }	/* polar day and night */
+};
+
+int main(int argc, char *argv[])
+{
+	char name[128];
+	int fd;
+	unsigned c, h, o;
+
+	/* benchmarks print to stdout, the results go to the original one */
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	fd = open("/dev/null", O_WRONLY);
+	if (!out || fd < 0) {
+		fprintf(stderr, "Error: failed to redirect stdout\n");
+		return EXIT_FAILURE;
+	}
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	if (argc > 2)
+		filter = argv[2];
+
+	for (c = 0; c < sizeof(names) / sizeof(names[0]); c++) {
+		struct pos_ctx ctx = { .obj = object_lookup(names[c]) };
+
+		snprintf(name, sizeof(name), "object_pos/%s", names[c]);
+		measure(name, bench_pos, &ctx, 1);
+	}
+
+	for (c = 0; c < sizeof(names) / sizeof(names[0]); c++) {
+		for (h = 0; h < sizeof(horizons) / sizeof(horizons[0]); h++) {
+			for (o = 0; o < sizeof(observers) / sizeof(observers[0]); o++) {
+				struct rst_ctx ctx = {
+					.obj = object_lookup(names[c]),
+					.horizon = horizons[h].horizon,
+					.obs = observers[o].obs
+				};
+
+				snprintf(name, sizeof(name), "object_rst/%s/%s/%s", names[c], horizons[h].name, observers[o].name);
+				measure(name, bench_rst, &ctx, 1);
+			}
+		}
+	}
+
+	/* the closed form for the sun */
+	object_set_precision(PRECISION_FAST);
+	{
+		struct pos_ctx ctx = { .obj = object_lookup("sun") };
+		struct rst_ctx rctx = {
+			.obj = object_lookup("sun"),
+			.horizon = horizons[0].horizon,
+			.obs = observers[0].obs
+		};
+
+		measure("object_pos/sun/fast", bench_pos, &ctx, 1);
+		measure("object_rst/sun/standard/aachen/fast", bench_rst, &rctx, 1);
+	}
+	object_set_precision(PRECISION_STANDARD);
+
+	{
+		static const struct {
+			const char *name;
+			const char *format;
+		} formats[] = {
+			{ "short", "%H:%M" },
+			{ "long",  "%Y-%m-%d %H:%M:%S %Z az: §a (§s) alt: §h ra: §r dec: §d dist: §e lat: §A lng: §O jd: §J" }
+		};
+		struct format_ctx ctx = { .details.obs = observers[0].obs };
+
+		object_calc(object_lookup("sun"), BENCH_JD, MOMENT_RISE, false, LN_SOLAR_STANDART_HORIZON, &ctx.details);
+		object_localtime(&ctx.details);
+
+		for (c = 0; c < sizeof(formats) / sizeof(formats[0]); c++) {
+			ctx.fmt = format_compile(formats[c].format);
+			if (!ctx.fmt) {
+				fprintf(stderr, "Error: failed to compile format\n");
+				return EXIT_FAILURE;
+			}
+
+			snprintf(name, sizeof(name), "format_result/%s", formats[c].name);
+			measure(name, bench_format, &ctx, 1);
+
+			format_free(ctx.fmt);
+		}
+	}
+
+	{
+		static struct horizontal_ctx ctx;
+		double lat[BENCH_OBSERVERS], lng[BENCH_OBSERVERS], max;
+
+		/* a raster of 32 x 32 observers including the poles */
+		for (c = 0; c < BENCH_OBSERVERS; c++) {
+			lat[c] = -90 + (c / 32) * 180.0 / 31;
+			lng[c] = -180 + (c % 32) * 360.0 / 32;
+		}
+
+		if (horizontal_observers_init(&ctx.obs, lat, lng, BENCH_OBSERVERS)) {
+			fprintf(stderr, "Error: out of memory\n");
+			return EXIT_FAILURE;
+		}
+
+		max = verify_horizontal(&ctx, lat, lng);
+		if (max > HORIZONTAL_TOLERANCE) {
+			fprintf(stderr, "Error: horizontal_batch() deviates from ln_get_hrz_from_equ() by %g°\n", max);
+			return EXIT_FAILURE;
+		}
+
+		measure("horizontal_batch/1024", bench_horizontal, &ctx, 1);
+		horizontal_observers_free(&ctx.obs);
+	}
+
+	measure("strrepl", bench_strrepl, NULL, 1);
+
+#ifdef GEONAMES_SUPPORT
+	{
+		char home[] = "/tmp/calcelestial-bench.XXXXXX";
+		const char *json = "{\"geonames\":[{\"lat\":\"50.77664\",\"lng\":\"6.08342\",\"name\":\"Aachen\"}]}";
+		struct cache_ctx ctx;
+
+		if (!mkdtemp(home)) {
+			fprintf(stderr, "Error: failed to create temporary directory\n");
+			return EXIT_FAILURE;
+		}
+
+		ctx.cache = cache_open(home, "cache.db", 0, 0);
+		if (ctx.cache) {
+			cache_store(ctx.cache, "hit", json, strlen(json));
+
+			ctx.key = "hit";
+			measure("cache/hit", bench_cache, &ctx, 1);
+
+			ctx.key = "miss";
+			measure("cache/miss", bench_cache, &ctx, 1);
+
+			cache_close(ctx.cache);
+		}
+
+		remove_dir(home);
+	}
+#endif
+
+	/* interpolation can not be turned off again, so it goes last */
+	{
+		static struct object_details ref[sizeof(names) / sizeof(names[0])][BENCH_SAMPLES];
+		struct pos_ctx ctx;
+		double max;
+		int k;
+
+		for (c = 0; c < sizeof(names) / sizeof(names[0]); c++) {
+			for (k = 0; k < BENCH_SAMPLES; k++)
+				object_pos(object_lookup(names[c]), sample_jd(c, k), &ref[c][k]);
+		}
+
+		if (object_interpolate(BENCH_TOLERANCE)) {
+			fprintf(stderr, "Error: out of memory\n");
+			return EXIT_FAILURE;
+		}
+
+		max = verify_interpolation(names, sizeof(names) / sizeof(names[0]), ref);
+		if (max > BENCH_TOLERANCE) {
+			fprintf(stderr, "Error: object_interpolate() deviates from the series by %g arc seconds\n", max);
+			return EXIT_FAILURE;
+		}
+
+		for (c = 0; c < sizeof(names) / sizeof(names[0]); c++) {
+			ctx.obj = object_lookup(names[c]);
+
+			snprintf(name, sizeof(name), "object_pos/%s/interpolated", names[c]);
+			measure(name, bench_pos, &ctx, 1);
+		}
+	}
+
+	if (argc > 1) {
+		char *args[] = { argv[1], "-p", "sun", "-m", "rise", "-a", "50.77", "-o", "6.08", "-t", "2017-01-01", NULL };
+
+		measure("process/rise", bench_process, args, 0);
+	}
+
+	fprintf(out, "%s]\n", first ? "[\n" : "\n");
+	fclose(out);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,503 @@
+/**
+ * Persistent cache for web service responses
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <db.h>
+
+#include "cache.h"
+#include "stats.h"
+
+/** Layout of the values on disk: the header is followed by the data */
+struct cache_record {
+	int64_t stored;
+};
+
+/** An entry of the in-memory LRU */
+struct cache_entry {
+	char *key;
+	char *data;
+	size_t len;
+	time_t stored;
+	uint32_t hash;
+
+	struct cache_entry *newer, *older;
+	struct cache_entry *next;	/**< Next entry in the same bucket */
+};
+
+struct cache {
+	DB_ENV *env;
+	DB *dbp;
+	char *filename;
+
+	time_t ttl;
+	size_t max_size;
+
+	pthread_mutex_t mutex;
+	struct cache_entry *buckets[CACHE_BUCKETS];
+	struct cache_entry *newest, *oldest;
+	size_t nentries;
+};
+
+static uint32_t hash(const char *key)
+{
+	uint32_t h = 2166136261u; /* FNV-1a */
+
+	for (; *key; key++)
+		h = (h ^ (unsigned char) *key) * 16777619u;
+
+	return h;
+}
+
+static int expired(const struct cache *c, time_t stored, time_t now)
+{
+	return c->ttl > 0 && now - stored > c->ttl;
+}
+
+static void lru_unlink(struct cache *c, struct cache_entry *e)
+{
+	if (e->newer)
+		e->newer->older = e->older;
+	else
+		c->newest = e->older;
+
+	if (e->older)
+		e->older->newer = e->newer;
+	else
+		c->oldest = e->newer;
+}
+
+static void lru_push(struct cache *c, struct cache_entry *e)
+{
+	e->newer = NULL;
+	e->older = c->newest;
+
+	if (c->newest)
+		c->newest->newer = e;
+	else
+		c->oldest = e;
+
+	c->newest = e;
+}
+
+static struct cache_entry * lru_find(struct cache *c, const char *key, uint32_t h)
+{
+	struct cache_entry *e;
+
+	for (e = c->buckets[h % CACHE_BUCKETS]; e; e = e->next) {
+		if (e->hash == h && !strcmp(e->key, key))
+			return e;
+	}
+
+	return NULL;
+}
+
+static void lru_remove(struct cache *c, struct cache_entry *e)
+{
+	struct cache_entry **p;
+
+	for (p = &c->buckets[e->hash % CACHE_BUCKETS]; *p != e; p = &(*p)->next);
+	*p = e->next;
+
+	lru_unlink(c, e);
+	c->nentries--;
+
+	free(e->key);
+	free(e->data);
+	free(e);
+}
+
+static void lru_insert(struct cache *c, const char *key, const char *data, size_t len, time_t stored)
+{
+	uint32_t h = hash(key);
+	struct cache_entry *e;
+
+	e = lru_find(c, key, h);
+	if (e)
+		lru_remove(c, e);
+
+	e = malloc(sizeof(struct cache_entry));
+	if (!e)
+		return;
+
+	e->key = strdup(key);
+	e->data = malloc(len + 1);
+	if (!e->key || !e->data) {
+		free(e->key);
+		free(e->data);
+		free(e);
+		return;
+	}
+
+	memcpy(e->data, data, len);
+	e->data[len] = '\0';
+	e->len = len;
+	e->stored = stored;
+	e->hash = h;
+
+	e->next = c->buckets[h % CACHE_BUCKETS];
+	c->buckets[h % CACHE_BUCKETS] = e;
+	lru_push(c, e);
+
+	if (++c->nentries > CACHE_LRU_SIZE)
+		lru_remove(c, c->oldest);
+}
+
+static int copy(const char *data, size_t len, char **out, size_t *outlen)
+{
+	*out = malloc(len + 1);
+	if (!*out)
+		return -1;
+
+	memcpy(*out, data, len);
+	(*out)[len] = '\0';
+
+	if (outlen)
+		*outlen = len;
+
+	return 0;
+}
+
+struct cache * cache_open(const char *home, const char *file, time_t ttl, size_t max_size)
+{
+	struct cache *c;
+	size_t len;
+	int ret;
+
+	if (mkdir(home, 0700) && errno != EEXIST)
+		return NULL;
+
+	c = calloc(1, sizeof(struct cache));
+	if (!c)
+		return NULL;
+
+	c->ttl = ttl;
+	c->max_size = max_size;
+	pthread_mutex_init(&c->mutex, NULL);
+
+	len = strlen(home) + strlen(file) + 2;
+	c->filename = malloc(len);
+	if (!c->filename)
+		goto err;
+	snprintf(c->filename, len, "%s/%s", home, file);
+
+	/* the environment serializes writers across processes */
+	ret = db_env_create(&c->env, 0);
+	if (ret)
+		goto err;
+
+	ret = c->env->open(c->env, home, DB_CREATE | DB_INIT_CDB | DB_INIT_MPOOL | DB_THREAD, 0600);
+	if (ret)
+		goto err;
+
+	ret = db_create(&c->dbp, c->env, 0);
+	if (ret)
+		goto err;
+
+	ret = c->dbp->open(c->dbp, NULL, file, NULL, DB_BTREE, DB_CREATE | DB_THREAD, 0600);
+	if (ret)
+		goto err;
+
+	return c;
+
+err:	cache_close(c);
+
+	return NULL;
+}
+
+void cache_close(struct cache *c)
+{
+	while (c->oldest)
+		lru_remove(c, c->oldest);
+
+	if (c->dbp)
+		c->dbp->close(c->dbp, 0);
+	if (c->env)
+		c->env->close(c->env, 0);
+
+	pthread_mutex_destroy(&c->mutex);
+	free(c->filename);
+	free(c);
+}
+
+int cache_lookup(struct cache *c, const char *key, char **data, size_t *len)
+{
+	struct cache_entry *e;
+	struct cache_record rec;
+	DBT k, v;
+	time_t now = time(NULL);
+	int ret = -1;
+
+	pthread_mutex_lock(&c->mutex);
+
+	e = lru_find(c, key, hash(key));
+	if (e && !expired(c, e->stored, now)) {
+		/* most recently used */
+		lru_unlink(c, e);
+		lru_push(c, e);
+
+		ret = copy(e->data, e->len, data, len);
+		goto out;
+	}
+	else if (e)
+		lru_remove(c, e);
+
+	memset(&k, 0, sizeof(k));
+	memset(&v, 0, sizeof(v));
+
+	k.data = (void *) key;
+	k.size = strlen(key) + 1;
+	v.flags = DB_DBT_MALLOC;
+
+	if (c->dbp->get(c->dbp, NULL, &k, &v, 0))
+		goto out;
+
+	if (v.size < sizeof(rec)) { /* e.g. written by an older version */
+		c->dbp->del(c->dbp, NULL, &k, 0);
+		goto done;
+	}
+
+	memcpy(&rec, v.data, sizeof(rec));
+	if (expired(c, rec.stored, now)) {
+		c->dbp->del(c->dbp, NULL, &k, 0);
+		goto done;
+	}
+
+#ifdef DEBUG
+	printf("Debug: cache key retrieved: %s\n", key);
+#endif /* DEBUG */
+	lru_insert(c, key, (char *) v.data + sizeof(rec), v.size - sizeof(rec), rec.stored);
+	ret = copy((char *) v.data + sizeof(rec), v.size - sizeof(rec), data, len);
+
+done:	free(v.data);
+out:	pthread_mutex_unlock(&c->mutex);
+
+	stats_count(ret ? STATS_CACHE_MISSES : STATS_CACHE_HITS, 1);
+
+	return ret;
+}
+
+int cache_store(struct cache *c, const char *key, const char *data, size_t len)
+{
+	struct cache_record rec = { .stored = time(NULL) };
+	struct stat st;
+	DBT k, v;
+	char *buf;
+	int ret;
+
+	buf = malloc(sizeof(rec) + len);
+	if (!buf)
+		return -1;
+
+	memcpy(buf, &rec, sizeof(rec));
+	memcpy(buf + sizeof(rec), data, len);
+
+	memset(&k, 0, sizeof(k));
+	memset(&v, 0, sizeof(v));
+
+	k.data = (void *) key;
+	k.size = strlen(key) + 1;
+	v.data = buf;
+	v.size = sizeof(rec) + len;
+
+	pthread_mutex_lock(&c->mutex);
+
+	ret = c->dbp->put(c->dbp, NULL, &k, &v, 0);
+	if (!ret)
+		lru_insert(c, key, data, len, rec.stored);
+
+	pthread_mutex_unlock(&c->mutex);
+
+	free(buf);
+
+#ifdef DEBUG
+	printf("Debug: cache key stored: %s\n", key);
+#endif /* DEBUG */
+
+	/* only pages which have been written back count */
+	if (!ret && c->max_size && !stat(c->filename, &st) && (size_t) st.st_size > c->max_size)
+		cache_expire(c);
+
+	return ret ? -1 : 0;
+}
+
+int cache_delete(struct cache *c, const char *key)
+{
+	struct cache_entry *e;
+	DBT k;
+	int ret;
+
+	memset(&k, 0, sizeof(k));
+	k.data = (void *) key;
+	k.size = strlen(key) + 1;
+
+	pthread_mutex_lock(&c->mutex);
+
+	e = lru_find(c, key, hash(key));
+	if (e)
+		lru_remove(c, e);
+
+	ret = c->dbp->del(c->dbp, NULL, &k, 0);
+
+	pthread_mutex_unlock(&c->mutex);
+
+	return ret && ret != DB_NOTFOUND ? -1 : 0;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+	int64_t ta = *(const int64_t *) a, tb = *(const int64_t *) b;
+
+	return ta < tb ? -1 : ta > tb;
+}
+
+/** Iterate over all records; remove() decides which ones are deleted */
+static int sweep(struct cache *c, int (*remove)(void *ctx, int64_t stored), void *ctx, u_int32_t flags)
+{
+	struct cache_record rec;
+	DBC *cursor;
+	DBT k, v;
+	int ret, removed = 0;
+
+	ret = c->dbp->cursor(c->dbp, NULL, &cursor, flags);
+	if (ret)
+		return -1;
+
+	memset(&k, 0, sizeof(k));
+	memset(&v, 0, sizeof(v));
+	k.flags = v.flags = DB_DBT_MALLOC;
+
+	while (!(ret = cursor->get(cursor, &k, &v, DB_NEXT))) {
+		rec.stored = 0;
+		if (v.size >= sizeof(rec))
+			memcpy(&rec, v.data, sizeof(rec));
+
+		if (remove(ctx, rec.stored) && !cursor->del(cursor, 0))
+			removed++;
+
+		free(k.data);
+		free(v.data);
+	}
+
+	cursor->close(cursor);
+
+	return ret == DB_NOTFOUND ? removed : -1;
+}
+
+struct expire_ctx {
+	int64_t *times;
+	size_t len, size;
+
+	int64_t expired;		/**< Entries stored before are expired */
+	int64_t oldest;			/**< Entries stored before are evicted ... */
+	size_t ties;			/**< ... and this many stored exactly at that time */
+};
+
+static int collect(void *ctx, int64_t stored)
+{
+	struct expire_ctx *x = ctx;
+	int64_t *p;
+
+	if (x->len == x->size) {
+		p = realloc(x->times, (x->size ? 2 * x->size : 1024) * sizeof(int64_t));
+		if (!p)
+			return 0;
+
+		x->times = p;
+		x->size = x->size ? 2 * x->size : 1024;
+	}
+
+	x->times[x->len++] = stored;
+
+	return 0;
+}
+
+static int older(void *ctx, int64_t stored)
+{
+	struct expire_ctx *x = ctx;
+
+	if (stored < x->expired || stored < x->oldest)
+		return 1;
+	else if (stored == x->oldest && x->ties > 0) {
+		x->ties--;
+		return 1;
+	}
+
+	return 0;
+}
+
+int cache_expire(struct cache *c)
+{
+	struct expire_ctx x = {
+		.expired = c->ttl > 0 ? time(NULL) - c->ttl : INT64_MIN,
+		.oldest = INT64_MIN
+	};
+	struct stat st;
+	DB_COMPACT compact;
+	size_t evict, i;
+	int removed;
+
+	pthread_mutex_lock(&c->mutex);
+
+	/* the in-memory entries might be evicted as well */
+	while (c->oldest)
+		lru_remove(c, c->oldest);
+
+	/* above the size limit: drop the oldest part as well */
+	if (c->max_size && !stat(c->filename, &st) && (size_t) st.st_size > c->max_size) {
+		removed = sweep(c, collect, &x, 0);
+		if (removed >= 0 && x.len > 0) {
+			qsort(x.times, x.len, sizeof(int64_t), compare_times);
+
+			evict = x.len * CACHE_EVICT_SLACK / 100 + 1;
+			x.oldest = x.times[evict - 1];
+
+			for (i = evict; i > 0 && x.times[i - 1] == x.oldest; i--)
+				x.ties++;
+		}
+	}
+
+	removed = sweep(c, older, &x, DB_WRITECURSOR);
+
+	/* return the pages to the filesystem, a failure only leaves the file larger */
+	if (removed > 0) {
+		memset(&compact, 0, sizeof(compact));
+		c->dbp->compact(c->dbp, NULL, NULL, NULL, &compact, DB_FREE_SPACE, NULL);
+	}
+
+	pthread_mutex_unlock(&c->mutex);
+
+	free(x.times);
+
+	return removed;
+}
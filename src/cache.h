@@ -0,0 +1,84 @@
+/**
+ * Persistent cache for web service responses
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#define CACHE_LRU_SIZE		128	/**< Entries kept in memory in front of the database */
+#define CACHE_BUCKETS		256	/**< Hash buckets of the in-memory entries */
+#define CACHE_EVICT_SLACK	10	/**< Percentage of the entries evicted at once when the file is too large */
+
+/** A Berkeley DB in a Concurrent Data Store environment.
+ *
+ * Any number of processes can read the database while one is writing.
+ * Each entry carries the time it was stored at, entries older than ttl are misses.
+ */
+struct cache;
+
+/** Open or create the cache.
+ *
+ * @param home Directory of the environment, created if it does not exist
+ * @param ttl Lifetime of entries in seconds or 0 for unlimited
+ * @param max_size Size of the database file in bytes before the oldest entries are evicted or 0 for unlimited
+ * @return NULL on error
+ */
+struct cache * cache_open(const char *home, const char *file, time_t ttl, size_t max_size);
+
+void cache_close(struct cache *c);
+
+/** Look up an entry.
+ *
+ * @param data A copy of the data with a terminating null byte, to be freed by the caller
+ * @retval 0 on a hit
+ * @retval -1 if there is no entry or it is expired
+ */
+int cache_lookup(struct cache *c, const char *key, char **data, size_t *len);
+
+/** Store or replace an entry.
+ *
+ * Evicts the oldest entries when the file grew larger than max_size.
+ *
+ * @retval 0 on success
+ * @retval -1 on error
+ */
+int cache_store(struct cache *c, const char *key, const char *data, size_t len);
+
+/** Remove an entry, e.g. if it turned out to be invalid.
+ *
+ * @retval 0 on success or if there was no entry
+ * @retval -1 on error
+ */
+int cache_delete(struct cache *c, const char *key);
+
+/** Remove expired entries, the oldest ones if the file is larger than max_size and return the free pages to the filesystem.
+ *
+ * @return The number of removed entries or -1 on error
+ */
+int cache_expire(struct cache *c);
+
+#endif /* _CACHE_H_ */
@@ -28,12 +28,11 @@
 #define _XOPEN_SOURCE 700
 #define _BSD_SOURCE 1 /* for tm_gmtoff field in struct tm */
 
-#define EXIT_CIRCUMPOLAR 2
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include <limits.h>
 #include <getopt.h>
 #include <float.h>
@@ -46,6 +45,18 @@
 #include "objects.h"
 #include "formatter.h"
 #include "geonames.h"
+#include "gazetteer.h"
+#include "batch.h"
+#include "server.h"
+#include "scheduler.h"
+#include "grid.h"
+#include "tzindex.h"
+#include "stats.h"
+#include "calcelestial.h"
+#include "solar.h"
+#include "track.h"
+#include "publish.h"
+#include "search.h"
 
 static struct option long_options[] = {
 	{"object",	required_argument, 0, 'p'},
@@ -53,35 +64,85 @@ static struct option long_options[] = {
 	{"time",	required_argument, 0, 't'},
 	{"moment",	required_argument, 0, 'm'},
 	{"next",	no_argument,	   0, 'n'},
+	{"start",	required_argument, 0, 's'},
+	{"end",		required_argument, 0, 'e'},
+	{"step",	required_argument, 0, 'i'},
+	{"batch",	required_argument, 0, 'b'},
+#ifdef HAVE_SYS_EPOLL_H
+	{"serve",	required_argument, 0, 'S'},
+#endif
+	{"grid",	required_argument, 0, 'g'},
+	{"exec",	required_argument, 0, 'x'},
+	{"watch",	required_argument, 0, 'w'},
+	{"track",	required_argument, 0, 'r'},
+	{"publish",	required_argument, 0, 'U'},
+	{"altitude",	required_argument, 0, 'A'},
+	{"azimuth",	required_argument, 0, 'y'},
+	{"jobs",	required_argument, 0, 'j'},
+	{"interpolate",	optional_argument, 0, 'I'},
+	{"ephemeris",	required_argument, 0, 'E'},
+	{"precision",	required_argument, 0, 'P'},
+	{"build-ephemeris", required_argument, 0, 'B'},
+	{"from",	required_argument, 0, 'F'},
+	{"to",		required_argument, 0, 'T'},
 	{"format",	required_argument, 0, 'f'},
 	{"lat",		required_argument, 0, 'a'},
 	{"lon",		required_argument, 0, 'o'},
 #ifdef GEONAMES_SUPPORT
 	{"query",	required_argument, 0, 'q'},
 	{"local",	no_argument,	   0, 'l'},
+	{"build-gazetteer", required_argument, 0, 'G'},
 #endif
 	{"timezone",	required_argument, 0, 'z'},
+	{"tzindex",	required_argument, 0, 'Z'},
+	{"build-tzindex", required_argument, 0, 'Y'},
 	{"universal",	no_argument,	   0, 'u'},
+	{"stats",	optional_argument, 0, 'k'},
 	{"help",	no_argument,	   0, 'h'},
 	{"version",	no_argument,	   0, 'v'},
 	{0}
 };
 
 static const char *long_options_descs[] = {
-	"calc for celestial object: sun, moon, mars, neptune,\n\t\t\t jupiter, mercury, uranus, saturn, venus or pluto",
-	"calc rise/set time with twilight: nautic, civil or astronomical",
+	"calc for celestial object: sun, moon, mars, neptune,\n\t\t\t jupiter, mercury, uranus, saturn, venus or pluto,\n\t\t\t a comma separated list of them or all",
+	"calc rise/set time with twilight: nautic, civil or astronomical,\n\t\t\t a list of them or all for the §c, §n, §x tokens",
 	"calc at given time: YYYY-MM-DD[_HH:MM:SS]",
 	"calc position at moment of: rise, set, transit",
 	"use rise, set, transit time of tomorrow",
+	"calc a series starting at: YYYY-MM-DD[_HH:MM:SS]",
+	"calc a series ending at: YYYY-MM-DD[_HH:MM:SS]",
+	"step width of series: NUM[s|m|h|d] (default: 1d)",
+	"read records of LAT LON [TZ] [DATE] from file or - for stdin",
+#ifdef HAVE_SYS_EPOLL_H
+	"answer requests on a unix socket: KEY=VALUE lines or JSON",
+#endif
+	"write a raster of rise/set/transit and position for\n\t\t\t LAT0:LAT1:DLAT,LON0:LON1:DLON to stdout",
+	"run a command at every occurrence of --moment",
+	"run commands according to a file of rules:\n\t\t\t OBJECT MOMENT HORIZON OFFSET COMMAND",
+	"write the position HZ times per second (default format: §t §a §h)",
+	"keep the state of the objects in shared memory NAME up to date",
+	"list the times the object crosses an altitude in degrees\n\t\t\t on the day of --time or between --start and --end",
+	"list the days the object rises or sets (--moment) at an azimuth:\n\t\t\t DEG[:TOLERANCE] (default: 1°) within a year of --time",
+	"number of worker threads for --batch and series",
+	"interpolate positions with a max. error in arc seconds (default: 0.1)",
+	"serve positions from a precomputed ephemeris file",
+	"algorithm for the sun: standard or fast, compare\n\t\t\t reports the deviation of fast between --from and --to",
+	"precompute an ephemeris file for all objects",
+	"first year of --build-ephemeris (default: 1900)",
+	"last year of --build-ephemeris (default: 2100)",
 	"output format: see strftime (3) and calcelestial (1) for more details",
 	"geographical latitude of observer: -90° to 90°",
 	"geographical longitude of oberserver: -180° to 180°",
 #ifdef GEONAMES_SUPPORT
 	"query coordinates using the geonames.org geolocation service",
 	"query local timezone using the geonames.org geolocation service",
+	"build an offline index for --query from geonames.org\n\t\t\t dumps on stdin (countryInfo.txt, cities*.txt)",
 #endif
-	"override system timezone (TZ environment variable)",
+	"override system timezone (TZ environment variable)\n\t\t\t or auto to resolve it from the coordinates with --tzindex",
+	"resolve timezones offline from an index file",
+	"build an index file for --tzindex from timezone\n\t\t\t boundaries as GeoJSON on stdin",
 	"use universial time for parsing and formatting",
+	"print timings and counters to stderr or as JSON to a file",
 	"show usage help",
 	"show version"
 };
@@ -106,7 +167,7 @@ void print_usage()
 	}
 	printf("\n");
 	
-	printf("Note: A combination of --lat & --lon or --query is required.\n\n");
+	printf("Note: A combination of --lat & --lon or --query is required unless --batch, --serve or --grid is used.\n\n");
 	
 	print_format_tokens();
 
@@ -121,46 +182,157 @@ void usage_error(const char *err)
 	exit(-1);
 }
 
+/** Report a file which could not be loaded, errno is EINVAL if it has the wrong content */
+void load_error(const char *filename, const char *kind)
+{
+	if (errno == EINVAL)
+		fprintf(stderr, "Error: %s is not a valid %s\n", filename, kind);
+	else
+		fprintf(stderr, "Error: failed to open %s: %s\n", filename, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+void parse_time(const char *str, struct tm *tm)
+{
+	tm->tm_isdst = -1; /* update dst */
+	if (strchr(str, '_')) {
+		if (!strptime(str, "%Y-%m-%d_%H:%M:%S", tm))
+			usage_error("invalid time/date parameter");
+	}
+	else {
+		if (!strptime(str, "%Y-%m-%d", tm))
+			usage_error("invalid time/date parameter");
+	}
+}
+
+/** Parse step width of a series into seconds or calendar days */
+void parse_step(const char *str, int *secs, int *days)
+{
+	char *endptr;
+	double step = strtod(str, &endptr), unit = 1;
+
+	*secs = 0;
+	*days = 0;
+
+	if (endptr == str)
+		usage_error("invalid step width");
+
+	switch (*endptr) {
+		case 'd': unit = 86400; endptr++; break;
+		case 'h': unit = 3600; endptr++; break;
+		case 'm': unit = 60; endptr++; break;
+		case 's': endptr++; break;
+	}
+
+	if (*endptr != '\0' || !(step > 0) || step * unit > INT_MAX)
+		usage_error("invalid step width");
+
+	/* whole days follow the calendar across DST changes, fractions are rounded to seconds */
+	if (unit == 86400 && step == floor(step))
+		*days = step;
+	else
+		*secs = lround(step * unit);
+
+	if (*secs <= 0 && *days <= 0)
+		usage_error("invalid step width");
+}
+
+/** Format a result and print it as a line to stdout */
+static int print_result(struct calcelestial *ctx, const struct calcelestial_result *result)
+{
+	char line[1024], *buf;
+	int ret;
+
+	ret = calcelestial_format(ctx, result, line, sizeof(line));
+	if (ret < 0) {
+		fprintf(stderr, "Error: failed to format result\n");
+		return -1;
+	}
+
+	/* long formats are rendered again into a buffer of their size */
+	if ((size_t) ret >= sizeof(line)) {
+		buf = malloc(ret + 1);
+
+		if (!buf || calcelestial_format(ctx, result, buf, ret + 1) < 0) {
+			fprintf(stderr, "Error: failed to format result\n");
+			free(buf);
+			return -1;
+		}
+
+		puts(buf);
+		free(buf);
+	}
+	else
+		puts(line);
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int ret;
+	uint64_t start = stats_now();
 	time_t t;
-	double jd;
-	struct tm tm;
-	const struct object *obj;
+	struct tm tm, tm_start, tm_end;
 
 	/* Default options */
-	double horizon = LN_SOLAR_STANDART_HORIZON; /* 50 Bogenminuten; no twilight, normal sunset/rise */
-	int tz = INT_MAX;
-
 	char *obj_str = basename(argv[0]);
-	char *format = "%H:%M %d.%m.%Y";
+	char *format = NULL;
 	//char *format = "time: %Y-%m-%d %H:%M:%S (%Z) az: §a (§s) alt: §h";
-	char tzid[32];
+	char *moment = "now";
+	char *horizon = NULL;
+	char *tzid = NULL;
 	char *query = NULL;
+	char *batch = NULL;
+	char *serve = NULL;
+	char *exec = NULL;
+	char *grid = NULL;
+	char *watch = NULL;
+	double track = 0;
+	char *publish = NULL;
+	char *altitude = NULL;
+	char *azimuth = NULL;
+	char *endptr;
+	double first = 0, last = 0, alt = 0, az = 0, az_tolerance = 1;
+	char *ephemeris = NULL;
+	char *precision = NULL;
+	char *build_ephemeris = NULL;
+#ifdef GEONAMES_SUPPORT
+	char *build_gazetteer = NULL;
+#endif
+	char *tzindex = NULL;
+	char *build_tzindex = NULL;
 
-	bool horizon_set = false;
 	bool next = false;
 	bool local_tz = false;
+	bool series = false;
+
+	int step_secs = 0, step_days = 1;
+	int jobs = 1;
+	double tolerance = 0; /* no interpolation */
+	int from = 1900, to = 2100;
 	
 	time(&t);
 	localtime_r(&t, &tm);
-
-	enum {
-		MOMENT_NOW,
-		MOMENT_RISE,
-		MOMENT_SET,
-		MOMENT_TRANSIT
-	} moment = MOMENT_NOW;
+	tm_start = tm_end = tm;
 
 	struct ln_lnlat_posn obs = { DBL_MAX, DBL_MAX };
-	struct object_details result;
+	struct calcelestial_result *results;
+	struct batch_config cfg;
+	struct calcelestial *ctx;
+	const struct object *objs[OBJECTS_MAX];
+	struct tzindex *index = NULL;
+	int i, nobjs;
+
+	ctx = calcelestial_new();
+	if (!ctx) {
+		fprintf(stderr, "Error: out of memory\n");
+		return EXIT_FAILURE;
+	}
 
-	/* set tzid as empty (without repointing the buffer) */
-	strcpy(tzid, "");
 	/* parse command line arguments */
 	while (1) {
-		int c = getopt_long(argc, argv, "+hvnult:d:f:a:o:q:z:p:m:H:", long_options, NULL);
+		int c = getopt_long(argc, argv, "+hvnult:d:f:a:o:q:z:p:m:H:s:e:i:b:S:g:x:w:j:r:U:A:y:I::E:P:B:F:T:G:Z:Y:k::", long_options, NULL);
 
 		/* detect the end of the options. */
 		if (c == -1)
@@ -168,44 +340,108 @@ int main(int argc, char *argv[])
 
 		switch (c) {
 			case 'H':
-				if      (strcmp(optarg, "civil") == 0)
-					horizon = LN_SOLAR_CIVIL_HORIZON;
-				else if (strcmp(optarg, "nautic") == 0)
-					horizon = LN_SOLAR_NAUTIC_HORIZON;
-				else if (strcmp(optarg, "astronomical") == 0)
-					horizon = LN_SOLAR_ASTRONOMICAL_HORIZON;
-				else {
-					char *endptr;
-					horizon = strtod(optarg, &endptr);
-
-					if (endptr == optarg)
-						usage_error("invalid horizon / twilight parameter");
-				}
-				
-				horizon_set = true;
+				horizon = optarg;
 				break;
 
 			case 't':
-				tm.tm_isdst = -1; /* update dst */
-				if (strchr(optarg, '_')) {
-					if (!strptime(optarg, "%Y-%m-%d_%H:%M:%S", &tm))
-						usage_error("invalid time/date parameter");
-				}
-				else {
-					if (!strptime(optarg, "%Y-%m-%d", &tm))
-						usage_error("invalid time/date parameter");
-				}
+				parse_time(optarg, &tm);
+				break;
+
+			case 's':
+				parse_time(optarg, &tm_start);
+				series = true;
+				break;
+
+			case 'e':
+				parse_time(optarg, &tm_end);
+				series = true;
+				break;
+
+			case 'i':
+				parse_step(optarg, &step_secs, &step_days);
+				break;
+
+			case 'b':
+				batch = optarg;
+				break;
+
+#ifdef HAVE_SYS_EPOLL_H
+			case 'S':
+				serve = optarg;
+				break;
+#endif
+			case 'g':
+				grid = optarg;
+				break;
+
+			case 'x':
+				exec = optarg;
+				break;
+
+			case 'w':
+				watch = optarg;
+				break;
+
+			case 'j':
+				jobs = atoi(optarg);
+				if (jobs < 1)
+					usage_error("invalid number of jobs");
+				break;
+
+			case 'I':
+				tolerance = optarg ? strtod(optarg, NULL) : 0.1;
+				if (tolerance <= 0)
+					usage_error("invalid interpolation tolerance");
+				break;
+
+			case 'E':
+				ephemeris = optarg;
+				break;
+
+			case 'B':
+				build_ephemeris = optarg;
+				break;
+
+			case 'P':
+				precision = optarg;
+				break;
+
+			case 'r':
+				track = strtod(optarg, NULL);
+				if (track <= 0 || track > TRACK_MAX_HZ)
+					usage_error("invalid rate for --track");
+				break;
+
+			case 'U':
+				publish = optarg;
+				break;
+
+			case 'A':
+				altitude = optarg;
+				alt = strtod(optarg, &endptr);
+				if (endptr == optarg || *endptr != '\0' || fabs(alt) > 90)
+					usage_error("invalid altitude");
+				break;
+
+			case 'y':
+				azimuth = optarg;
+				az = strtod(optarg, &endptr);
+				if (endptr != optarg && *endptr == ':')
+					az_tolerance = strtod(endptr + 1, &endptr);
+				if (endptr == optarg || *endptr != '\0' || az < 0 || az > 360 || az_tolerance < 0)
+					usage_error("invalid azimuth");
+				break;
+
+			case 'F':
+				from = atoi(optarg);
+				break;
+
+			case 'T':
+				to = atoi(optarg);
 				break;
 
 			case 'm':
-				if      (strcmp(optarg, "rise") == 0)
-					moment = MOMENT_RISE;
-				else if (strcmp(optarg, "set") == 0)
-					moment = MOMENT_SET;
-				else if (strcmp(optarg, "transit") == 0)
-					moment = MOMENT_TRANSIT;
-				else
-					usage_error("invalid moment");
+				moment = optarg;
 				break;
 
 			case 'n':
@@ -213,7 +449,7 @@ int main(int argc, char *argv[])
 				break;
 
 			case 'f':
-				format = strdup(optarg);
+				format = optarg;
 				break;
 
 			case 'a':
@@ -225,23 +461,39 @@ int main(int argc, char *argv[])
 				break;
 #ifdef GEONAMES_SUPPORT
 			case 'q':
-				query = strdup(optarg);
+				query = optarg;
 				break;
 
 			case 'l':
 				local_tz = true;
 				break;
+
+			case 'G':
+				build_gazetteer = optarg;
+				break;
 #endif
 			case 'p':
 				obj_str = optarg;
 				break;
 
 			case 'z':
-				strncpy(tzid, optarg, sizeof(tzid));
+				tzid = optarg;
 				break;
 
 			case 'u':
-				strncpy(tzid, "UTC", sizeof(tzid));
+				tzid = "UTC";
+				break;
+
+			case 'Z':
+				tzindex = optarg;
+				break;
+
+			case 'Y':
+				build_tzindex = optarg;
+				break;
+
+			case 'k':
+				stats_enable(optarg);
 				break;
 
 			case 'v':
@@ -258,83 +510,315 @@ int main(int argc, char *argv[])
 		}
 	}
 	
-	/* Parse planet/obj */
-	obj = object_lookup(obj_str);
-	if (!obj)
-		usage_error("invalid or missing object, use --object");
+	if (build_ephemeris) {
+		struct ln_date first = { .years = from, .months = 1, .days = 1 };
+		struct ln_date last  = { .years = to + 1, .months = 1, .days = 1 };
+		long failed;
+
+		if (from > to)
+			usage_error("invalid range for --build-ephemeris");
+
+		if (object_build_ephemeris(build_ephemeris, ln_get_julian_day(&first), ln_get_julian_day(&last),
+		    tolerance > 0 ? tolerance : 0.1, &failed)) {
+			fprintf(stderr, "Error: failed to write %s: %s\n", build_ephemeris, strerror(errno));
+			return EXIT_FAILURE;
+		}
 
-#ifdef GEONAMES_SUPPORT
-	/* Lookup place at http://geonames.org */
-	if (query) {
-		ret =  geonames_lookup_latlng(query, &obs, NULL, 0);
-		if (ret)
-			usage_error("failed to lookup location");
+		if (failed)
+			fprintf(stderr, "Warning: %ld windows exceed the tolerance and use the series\n", failed);
+
+		return 0;
 	}
-	
-	if (local_tz) {
-		int gmt_offset;
-		ret =  geonames_lookup_tz(obs, &gmt_offset, tzid, sizeof(tzid));
-		if (ret)
-			usage_error("failed to lookup location");
+
+	if (precision && !strcmp(precision, "compare")) {
+		struct ln_date first = { .years = from, .months = 1, .days = 1 };
+		struct ln_date last  = { .years = to + 1, .months = 1, .days = 1 };
+
+		if (from > to)
+			usage_error("invalid range for --precision compare");
+
+		/* rise and set are compared as well if the observer is given */
+		solar_compare(ln_get_julian_day(&first), ln_get_julian_day(&last), step_days + step_secs / 86400.0,
+			fabs(obs.lat) <= 90 && fabs(obs.lng) <= 180 ? &obs : NULL, stdout);
+
+		return 0;
+	}
+
+	if (build_tzindex) {
+		if (!tzindex_build(build_tzindex, stdin))
+			return 0;
+
+		if (errno == EINVAL)
+			fprintf(stderr, "Error: the boundaries are not a valid GeoJSON FeatureCollection\n");
+		else if (errno == ENOTSUP)
+			fprintf(stderr, "Error: building a timezone index requires json-c support\n");
+		else
+			fprintf(stderr, "Error: failed to write %s: %s\n", build_tzindex, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+#ifdef GEONAMES_SUPPORT
+	if (build_gazetteer) {
+		size_t line;
+
+		if (!gazetteer_build(build_gazetteer, stdin, &line))
+			return 0;
+
+		if (errno == EINVAL)
+			fprintf(stderr, "Error: invalid record in line %zu\n", line);
+		else
+			fprintf(stderr, "Error: failed to write %s: %s\n", build_gazetteer, strerror(errno));
+		return EXIT_FAILURE;
 	}
 #endif
 
-	if(strlen(tzid) > 0)	/* set TZ variable only when we have a value - otherwise rely on /etc/localtime or whatever other system fallbacks */
+	/* the context calculates single results, the modes below get their own configuration */
+	cfg = (struct batch_config) {
+		.next = next,
+		.horizon = LN_SOLAR_STANDART_HORIZON,
+		.horizon_set = horizon != NULL,
+		.tm = tm,
+		.jobs = jobs
+	};
+
+	/* Parse planet/obj */
+	if (calcelestial_set_object(ctx, obj_str) && (!watch || batch || serve)) /* rules name their own objects */
+		usage_error("invalid or missing object, use --object");
+
+	nobjs = calcelestial_objects(ctx);
+	for (i = 0; i < nobjs; i++)
+		objs[i] = object_lookup(calcelestial_object(ctx, i));
+	cfg.obj = nobjs ? objs[0] : NULL;
+
+	if (calcelestial_set_moment(ctx, moment, next) || object_parse_moment(moment, &cfg.moment))
+		usage_error("invalid moment");
+
+	if (horizon && object_parse_horizons(horizon, &cfg.horizon, &cfg.twilights))
+		usage_error("invalid horizon / twilight parameter");
+
+	if (horizon && calcelestial_set_horizon(ctx, horizon))
+		usage_error("the twilight parameter can only be used for the sun");
+
+	if (obs.lat != DBL_MAX || obs.lng != DBL_MAX)
+		calcelestial_set_observer(ctx, obs.lat, obs.lng); /* validated below unless it is not needed */
+
+	if (tzid && calcelestial_set_timezone(ctx, tzid))
+		usage_error("invalid timezone");
+
+	if (tzindex && (calcelestial_load_tzindex(ctx, tzindex) || !(index = tzindex_open(tzindex))))
+		load_error(tzindex, "timezone index");
+
+	cfg.tzindex = index;
+
+	stats_end(STATS_PARSE, start);
+
+	/* Lookup place at http://geonames.org */
+	if (query && calcelestial_lookup_place(ctx, query, NULL, 0))
+		usage_error("failed to lookup location");
+
+	if (local_tz && calcelestial_lookup_timezone(ctx))
+		usage_error("failed to lookup location");
+
+	if (tzid && !strcmp(tzid, "auto") && !tzindex)
+		usage_error("--timezone auto requires --tzindex");
+
+	start = stats_begin();
+
+	/* batch records and requests with auto are resolved one by one */
+	tzid = (char *) calcelestial_timezone(ctx);
+	if(strlen(tzid) > 0 && strcmp(tzid, "auto"))	/* set TZ variable only when we have a value - otherwise rely on /etc/localtime or whatever other system fallbacks */
 		setenv("TZ", tzid, 1);
 	tzset();
 
+	stats_end(STATS_TZ, start);
+	start = stats_begin();
+
+	if (nobjs > 1 && (serve || batch || grid || exec || watch || track || altitude || azimuth || series))
+		usage_error("a list of objects can only be calculated for a single time");
+
+	if (precision && calcelestial_precision(precision))
+		usage_error("invalid precision");
+
+	if (tolerance > 0 && calcelestial_interpolate(tolerance))
+		usage_error("failed to allocate interpolation cache");
+
+	if (ephemeris && calcelestial_map_ephemeris(ephemeris))
+		load_error(ephemeris, "ephemeris file");
+
+	if (track && !format)
+		format = "§t §a §h";
+
+	if (altitude && !format)
+		format = "%Y-%m-%d %H:%M:%S §E";
+
+	if (azimuth && !format)
+		format = "%Y-%m-%d %H:%M:%S §a";
+
+	if (azimuth && cfg.moment != MOMENT_RISE && cfg.moment != MOMENT_SET)
+		usage_error("--azimuth requires --moment rise or set");
+
+	if (!format)
+		format = CALCELESTIAL_DEFAULT_FORMAT;
+
+	cfg.format = format_compile(format);
+	if (!cfg.format || calcelestial_set_format(ctx, format))
+		usage_error("failed to parse format");
+
+	cfg.tzid = tzid;
+
+	stats_end(STATS_PARSE, start);
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (serve)
+		return server_run(serve, &cfg) ? EXIT_FAILURE : 0;
+#endif
+
+	/* a search covers the day or year of --time unless a series is given */
+	if ((altitude || azimuth) && series) {
+		t = mktime(&tm_start);
+		first = ln_get_julian_from_timet(&t);
+
+		t = mktime(&tm_end);
+		last = ln_get_julian_from_timet(&t);
+	}
+	else if (altitude || azimuth) {
+		tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+		first = ln_get_julian_from_timet(&t);
+
+		if (azimuth)
+			tm.tm_year++;
+		else
+			tm.tm_mday++;
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+		last = ln_get_julian_from_timet(&t);
+	}
+
+	if (batch) {
+		FILE *in = strcmp(batch, "-") ? fopen(batch, "r") : stdin;
+		if (!in)
+			usage_error("failed to open batch file");
+
+		if (altitude || azimuth) {
+			struct batch_site *sites;
+			int n = batch_read_sites(in, &cfg, &sites);
+
+			if (n < 0)
+				ret = -1;
+			else if (azimuth)
+				ret = search_azimuth(&cfg, sites, n, az, az_tolerance, first, last);
+			else
+				ret = search_altitude(&cfg, sites, n, alt, first, last);
+			free(sites);
+
+			return ret ? EXIT_FAILURE : 0;
+		}
+
+		return batch_process(in, &cfg);
+	}
+
+	if (grid) {
+		struct grid_spec spec;
+
+		if (grid_parse(grid, &spec))
+			usage_error("invalid grid");
+
+		t = mktime(&tm);
+		return grid_run(&spec, &cfg, ln_get_julian_from_timet(&t), stdout) ? EXIT_FAILURE : 0;
+	}
+
 	/* Validate observer coordinates */
-	if (fabs(obs.lat) > 90)
+	if (calcelestial_observer(ctx, &obs.lat, &obs.lng) && fabs(obs.lat) > 90)
 		usage_error("invalid latitude, use --lat");
-	if (fabs(obs.lng) > 180)
+	if (calcelestial_observer(ctx, &obs.lat, &obs.lng))
 		usage_error("invalid longitude, use --lon");
-	
-	if (horizon_set && strcmp(object_name(obj), "sun"))
-		usage_error("the twilight parameter can only be used for the sun");
 
-	/* Calculate julian date */
-	t = mktime(&tm);
-	jd = ln_get_julian_from_timet(&t);
+#ifdef DEBUG
+	printf("Debug: for position: N %f, E %f\n", obs.lat, obs.lng);
+	printf("Debug: for object: %s\n", cfg.obj ? object_name(cfg.obj) : "(rules)");
+	printf("Debug: with horizon: %f\n", cfg.horizon);
+	printf("Debug: with timezone: %s\n", tzid);
+#endif
 
-	result.obs = obs;
+	if (exec || watch) {
+		struct scheduler sched = { .obs = obs };
+
+		if (exec && cfg.moment == MOMENT_NOW)
+			usage_error("--exec requires a --moment");
+		if (exec && (!cfg.obj || scheduler_add(&sched, cfg.obj, cfg.moment, cfg.horizon, 0, exec)))
+			usage_error("invalid or missing object, use --object");
+		if (watch && scheduler_load(&sched, watch))
+			usage_error("failed to load rules");
+
+		ret = scheduler_run(&sched);
+		scheduler_free(&sched);
+
+		return ret;
+	}
+
+	if (altitude || azimuth) {
+		struct batch_site site = { .obs = obs, .value = NAN };
+
+		snprintf(site.tzid, sizeof(site.tzid), "%s", getenv("TZ") ? getenv("TZ") : "");
+
+		if (azimuth)
+			ret = search_azimuth(&cfg, &site, 1, az, az_tolerance, first, last);
+		else
+			ret = search_altitude(&cfg, &site, 1, alt, first, last);
+
+		return ret ? EXIT_FAILURE : 0;
+	}
+
+	if (publish)
+		return publish_run(publish, objs, nobjs, obs, cfg.horizon) ? EXIT_FAILURE : 0;
+
+	if (track)
+		return track_run(cfg.obj, obs, track, cfg.format, stdout) ? EXIT_FAILURE : 0;
+
+	if (series)
+		return batch_series(&cfg, obs, tm_start, tm_end, step_secs, step_days);
+
+	t = mktime(&tm);
 
 #ifdef DEBUG
-	printf("Debug: calculate for jd: %f\n", jd);
 	printf("Debug: calculate for ts: %ld\n", t);
-	printf("Debug: for position: N %f, E %f\n", obs.lat, obs.lng);
-	printf("Debug: for object: %s\n", object_name(obj));
-	printf("Debug: with horizon: %f\n", horizon);
-	printf("Debug: with timezone: %s\n", tzid);
 #endif
 
-	/* calc rst date */
-rst:	if (object_rst(obj, jd - .5, horizon, &result.obs, &result.rst) == 1)  {
-		if (moment != MOMENT_NOW) {
-			fprintf(stderr, "object is circumpolar\n");
-			return 2;
-		}
+	results = malloc(nobjs * sizeof(results[0]));
+	if (!results) {
+		fprintf(stderr, "Error: out of memory\n");
+		return EXIT_FAILURE;
 	}
-	else {
-		switch (moment) {
-			case MOMENT_NOW:	result.jd = jd; break;
-			case MOMENT_RISE:	result.jd = result.rst.rise; break;
-			case MOMENT_SET:	result.jd = result.rst.set; break;
-			case MOMENT_TRANSIT:	result.jd = result.rst.transit; break;
-		}
 
-		if (next && result.jd < jd) {
-			jd++;
-			next = false;
-			goto rst;
+	ret = calcelestial_calc_all(ctx, t, results);
+	if (ret && ret != CALCELESTIAL_ECIRCUMPOLAR)
+		usage_error(calcelestial_strerror(ret));
+
+	/* one line per object, in the order of --object */
+	for (i = 0; i < nobjs; i++) {
+		if (results[i].circumpolar && cfg.moment != MOMENT_NOW) {
+			if (nobjs > 1)
+				fprintf(stderr, "%s is circumpolar\n", results[i].object);
+			else
+				fprintf(stderr, "object is circumpolar\n");
+			continue;
 		}
+
+		if (print_result(ctx, &results[i]))
+			return EXIT_FAILURE;
 	}
-	
-	ln_get_timet_from_julian(result.jd, &t);
-	localtime_r(&t, &result.tm);
 
-	object_pos(obj, jd, &result);
+	free(results);
+
+	if (ret == CALCELESTIAL_ECIRCUMPOLAR)
+		return EXIT_CIRCUMPOLAR;
 
-	format_result(format, &result);
+	format_free(cfg.format);
+	if (index)
+		tzindex_close(index);
+	calcelestial_free(ctx);
 
 	return 0;
 }
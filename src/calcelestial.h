@@ -0,0 +1,209 @@
+/**
+ * Public interface of libcalcelestial
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CALCELESTIAL_H_
+#define _CALCELESTIAL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The format of new contexts, see calcelestial_set_format() */
+#define CALCELESTIAL_DEFAULT_FORMAT "%H:%M %d.%m.%Y"
+
+/** Return values of the library, all errors are negative */
+enum calcelestial_error {
+	CALCELESTIAL_OK		  =  0,
+	CALCELESTIAL_EINVAL	  = -1,	/**< Invalid argument or incomplete context */
+	CALCELESTIAL_ENOMEM	  = -2,
+	CALCELESTIAL_ENOTFOUND	  = -3,	/**< Place or timezone could not be resolved */
+	CALCELESTIAL_ECIRCUMPOLAR = -4,	/**< The object does not rise or set on that day */
+	CALCELESTIAL_EIO	  = -5,	/**< A file could not be loaded */
+	CALCELESTIAL_ENOTSUP	  = -6	/**< Built without geonames.org support */
+};
+
+/** The result of a calculation */
+struct calcelestial_result {
+	const char *object;		/**< Name of the object */
+
+	double jd;			/**< Julian date of the moment */
+	time_t time;			/**< The same as Unix timestamp */
+
+	double rise, set, transit;	/**< Julian dates, NaN if circumpolar */
+	int circumpolar;		/**< 1 if always above, -1 if always below the horizon */
+
+	double dawn[3], dusk[3];	/**< Civil, nautic and astronomical twilight in Julian dates,
+					     NaN if not reached or not requested by the horizon */
+
+	double ra, dec;			/**< Equatorial coordinates in degrees */
+	double az, alt;			/**< Horizontal coordinates in degrees, azimuth from north */
+	double diameter;		/**< In arc seconds */
+	double distance;		/**< In AU (astronomical unit) */
+
+	double lat, lng;		/**< Observer position */
+};
+
+/** A calculation context.
+ *
+ * It holds the object, observer, timezone and format of calculations and
+ * the handles of the geonames.org session and the timezone index.
+ * Different contexts can be used by different threads concurrently,
+ * a single one only by one thread at a time. Formatting in a timezone
+ * is the exception, see calcelestial_format().
+ */
+struct calcelestial;
+
+/** Create a context for the current position of an object.
+ *
+ * The object and the observer have to be set before calculating.
+ *
+ * @return NULL if out of memory
+ */
+struct calcelestial * calcelestial_new(void);
+
+void calcelestial_free(struct calcelestial *c);
+
+const char * calcelestial_strerror(int err);
+
+/** Set the object: sun, moon, mars, neptune, jupiter, mercury, uranus, saturn, venus or pluto
+ *
+ * A comma separated list or all selects several objects for calcelestial_calc_all().
+ */
+int calcelestial_set_object(struct calcelestial *c, const char *name);
+
+/** The number of objects set by calcelestial_set_object() */
+int calcelestial_objects(const struct calcelestial *c);
+
+/** The name of the i-th object set by calcelestial_set_object(), NULL if there is none */
+const char * calcelestial_object(const struct calcelestial *c, int i);
+
+/** Set the moment: now, rise, set or transit
+ *
+ * @param next Use the moment of the following day if it already passed
+ */
+int calcelestial_set_moment(struct calcelestial *c, const char *moment, bool next);
+
+/** Set the horizon in degrees or a twilight: civil, nautic or astronomical (sun only)
+ *
+ * The twilights of a comma separated list or all are calculated as well,
+ * the first horizon is the one of the moment.
+ *
+ * @retval CALCELESTIAL_EINVAL also if an object other than the sun is set,
+ *         calcelestial_set_object() refuses them afterwards as well
+ */
+int calcelestial_set_horizon(struct calcelestial *c, const char *horizon);
+
+int calcelestial_set_observer(struct calcelestial *c, double lat, double lng);
+
+/** Get the observer set by calcelestial_set_observer() or calcelestial_lookup_place()
+ *
+ * @retval CALCELESTIAL_EINVAL if there is none yet, lat and lng are left untouched
+ */
+int calcelestial_observer(const struct calcelestial *c, double *lat, double *lng);
+
+/** Set the observer to a place like "Aachen" or "Baden, CH".
+ *
+ * The offline gazetteer and the cache are tried before geonames.org.
+ *
+ * @param name Receives the name of the place found, may be NULL
+ */
+int calcelestial_lookup_place(struct calcelestial *c, const char *place, char *name, size_t len);
+
+/** Set the timezone of parsed and formatted times.
+ *
+ * @param tzid An IANA timezone, auto to resolve it with the timezone index
+ *             or NULL to use the one of the process
+ */
+int calcelestial_set_timezone(struct calcelestial *c, const char *tzid);
+
+/** Set the timezone to the one at the observer, from the timezone index or geonames.org */
+int calcelestial_lookup_timezone(struct calcelestial *c);
+
+/** The timezone in effect for the observer, an empty string for the one of the process */
+const char * calcelestial_timezone(struct calcelestial *c);
+
+/** Load a timezone index built by calcelestial --build-tzindex
+ *
+ * @retval CALCELESTIAL_EIO with errno set, EINVAL if it is not a timezone index
+ */
+int calcelestial_load_tzindex(struct calcelestial *c, const char *filename);
+
+/** Set the format, see strftime(3) and calcelestial(1) for the § tokens */
+int calcelestial_set_format(struct calcelestial *c, const char *format);
+
+/** Calculate the moment of the day of t and the position of the object at it */
+int calcelestial_calc(struct calcelestial *c, time_t t, struct calcelestial_result *r);
+
+/** Calculate the moment and position of all objects for the same instant.
+ *
+ * This is cheaper than calling calcelestial_calc() for each of them.
+ *
+ * @param r An array of calcelestial_objects() results in the order of the list
+ * @retval CALCELESTIAL_ECIRCUMPOLAR if an object does not reach the moment,
+ *         only object and circumpolar of its result are set
+ */
+int calcelestial_calc_all(struct calcelestial *c, time_t t, struct calcelestial_result *r);
+
+/** Render a result with the format of the context into buf.
+ *
+ * Like snprintf(3), the output is truncated to len - 1 characters.
+ *
+ * The C library only formats in the timezone of the process. If the context
+ * has a timezone, TZ is set in the environment of the process while
+ * rendering and restored afterwards. Other threads of the application must
+ * not call getenv(3), setenv(3), tzset(3) or localtime(3) meanwhile.
+ *
+ * @return The length of the complete output or an error
+ */
+int calcelestial_format(struct calcelestial *c, const struct calcelestial_result *r, char *buf, size_t len);
+
+/** Replace the series of all objects by Chebyshev interpolation (process wide).
+ *
+ * @param tolerance Maximum approximation error in arc seconds
+ */
+int calcelestial_interpolate(double tolerance);
+
+/** Select the algorithm for the sun (process wide): fast or standard
+ *
+ * The fast one is a closed form with an error below 0.01°.
+ * It has to be selected before calcelestial_interpolate() and any calculation.
+ */
+int calcelestial_precision(const char *precision);
+
+/** Serve positions from a file of calcelestial --build-ephemeris (process wide)
+ *
+ * @retval CALCELESTIAL_EIO with errno set, EINVAL if it is not an ephemeris file
+ */
+int calcelestial_map_ephemeris(const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CALCELESTIAL_H_ */
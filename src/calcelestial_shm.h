@@ -0,0 +1,159 @@
+/**
+ * Reader of the positions published by calcelestial --publish (header only)
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _CALCELESTIAL_SHM_H_
+#define _CALCELESTIAL_SHM_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CALCELESTIAL_SHM_MAGIC		0x4c414343	/**< "CCAL" */
+#define CALCELESTIAL_SHM_VERSION	1
+#define CALCELESTIAL_SHM_OBJECTS	16
+
+/** Published state of an object, all times are Julian dates */
+struct calcelestial_shm_object {
+	char name[16];
+
+	double jd;			/**< Time of the position */
+	double ra, dec;			/**< Equatorial coordinates in degrees */
+	double az, alt;			/**< Horizontal coordinates in degrees, azimuth from north */
+	char azidir[4];			/**< Direction of azimuth - like N,S,W,E,NW,.. */
+	int32_t circumpolar;		/**< 1 if always above, -1 if always below the horizon today */
+	double distance;		/**< In AU (astronomical unit) */
+	double diameter;		/**< In arc seconds */
+
+	double rise, set, transit;	/**< The next ones, NaN if there is none within two days */
+};
+
+/** The shared memory segment.
+ *
+ * seq is odd while the publisher writes. Readers take a snapshot by
+ * reading seq, the data and seq again and retry if it has changed.
+ */
+struct calcelestial_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+	uint32_t count;			/**< Number of objects */
+
+	double lat, lng;		/**< Observer position */
+
+	struct calcelestial_shm_object objects[CALCELESTIAL_SHM_OBJECTS];
+};
+
+/** Map a segment read-only, e.g. calcelestial_shm_open("/calcelestial")
+ *
+ * This and calcelestial_shm_close() are the only system calls of a reader.
+ *
+ * @return NULL if it does not exist or has an unknown version
+ */
+static inline const struct calcelestial_shm * calcelestial_shm_open(const char *name)
+{
+	struct calcelestial_shm *shm;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	shm = (struct calcelestial_shm *) mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return NULL;
+
+	if (shm->magic != CALCELESTIAL_SHM_MAGIC || shm->version != CALCELESTIAL_SHM_VERSION) {
+		munmap(shm, sizeof(*shm));
+		return NULL;
+	}
+
+	return shm;
+}
+
+static inline void calcelestial_shm_close(const struct calcelestial_shm *shm)
+{
+	munmap((void *) shm, sizeof(*shm));
+}
+
+/** Start reading in place: wait until the publisher is done */
+static inline uint32_t calcelestial_shm_begin(const struct calcelestial_shm *shm)
+{
+	uint32_t seq;
+
+	while ((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1)
+		; /* an update takes microseconds */
+
+	return seq;
+}
+
+/** Finish reading in place: values read since calcelestial_shm_begin()
+ * may only be used if this returns 0, otherwise read them again.
+ */
+static inline int calcelestial_shm_retry(const struct calcelestial_shm *shm, uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/** Copy the state of an object by name into obj.
+ *
+ * @retval 0 on success
+ * @retval -1 if the object is not published
+ */
+static inline int calcelestial_shm_get(const struct calcelestial_shm *shm, const char *name, struct calcelestial_shm_object *obj)
+{
+	uint32_t seq, i;
+	int ret;
+
+	do {
+		seq = calcelestial_shm_begin(shm);
+		ret = -1;
+
+		for (i = 0; i < shm->count && i < CALCELESTIAL_SHM_OBJECTS; i++) {
+			if (!strncmp(shm->objects[i].name, name, sizeof(obj->name))) {
+				memcpy(obj, &shm->objects[i], sizeof(*obj));
+				ret = 0;
+				break;
+			}
+		}
+	} while (calcelestial_shm_retry(shm, seq));
+
+	return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CALCELESTIAL_SHM_H_ */
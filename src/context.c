@@ -0,0 +1,515 @@
+/**
+ * Calculation contexts of libcalcelestial
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <libnova/libnova.h>
+
+#include "../config.h"
+#include "context.h"
+#include "stats.h"
+#ifdef GEONAMES_SUPPORT
+  #include "geonames.h"
+#endif
+
+/* The C library only knows the timezone of the process.
+ * Contexts with different timezones take turns to switch it. */
+static pthread_mutex_t tz_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char tz_current[64];
+static char *tz_initial;		/**< TZ of the process before the first switch */
+static bool tz_switched;
+
+static const char *errors[] = {
+	"success",
+	"invalid argument",
+	"out of memory",
+	"failed to lookup location",
+	"object is circumpolar",
+	"failed to load file",
+	"not supported"
+};
+
+/** Switch the timezone of the process, tz_mutex must be held */
+static void switch_tz(const char *tzid)
+{
+	const char *env;
+
+	if (!tz_switched) {
+		env = getenv("TZ");
+		tz_initial = env ? strdup(env) : NULL;
+		snprintf(tz_current, sizeof(tz_current), "%s", env ? env : "");
+		tz_switched = true;
+	}
+
+	if (strlen(tzid) == 0) /* back to the initial timezone */
+		tzid = tz_initial ? tz_initial : "";
+
+	if (!strcmp(tzid, tz_current))
+		return;
+
+	snprintf(tz_current, sizeof(tz_current), "%s", tzid);
+
+	if (strlen(tzid) > 0)
+		setenv("TZ", tzid, 1);
+	else
+		unsetenv("TZ"); /* fallback to /etc/localtime */
+	tzset();
+}
+
+/** Whether a horizon can be used for all of the objects, only the sun has twilights */
+static bool sun_only(const struct object **objs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (strcmp(object_name(objs[i]), "sun"))
+			return false;
+	}
+
+	return true;
+}
+
+/** Whether the observer has been set */
+static bool has_observer(const struct calcelestial *c)
+{
+	return fabs(c->obs.lat) <= 90 && fabs(c->obs.lng) <= 180;
+}
+
+struct calcelestial * calcelestial_new(void)
+{
+	struct calcelestial *c;
+
+	c = calloc(1, sizeof(struct calcelestial));
+	if (!c)
+		return NULL;
+
+	c->moment = MOMENT_NOW;
+	c->horizon = LN_SOLAR_STANDART_HORIZON;
+	c->obs.lat = DBL_MAX;
+	c->obs.lng = DBL_MAX;
+
+	c->format = format_compile(CALCELESTIAL_DEFAULT_FORMAT);
+	if (!c->format) {
+		free(c);
+		return NULL;
+	}
+
+	return c;
+}
+
+void calcelestial_free(struct calcelestial *c)
+{
+	if (!c)
+		return;
+
+	format_free(c->format);
+	format_buffer_free(&c->buf);
+
+	if (c->tzindex)
+		tzindex_close(c->tzindex);
+#ifdef GEONAMES_SUPPORT
+	geonames_close(c->geonames);
+#endif
+
+	free(c);
+}
+
+const char * calcelestial_strerror(int err)
+{
+	if (err > 0 || -err >= (int) (sizeof(errors) / sizeof(errors[0])))
+		return "unknown error";
+
+	return errors[-err];
+}
+
+int calcelestial_set_object(struct calcelestial *c, const char *name)
+{
+	const struct object *objs[OBJECTS_MAX];
+	int n = object_parse_list(name, objs, OBJECTS_MAX);
+
+	if (n <= 0 || (c->horizon_set && !sun_only(objs, n)))
+		return CALCELESTIAL_EINVAL;
+
+	memcpy(c->objs, objs, n * sizeof(objs[0]));
+	c->nobjs = n;
+	c->obj = objs[0];
+
+	return CALCELESTIAL_OK;
+}
+
+int calcelestial_objects(const struct calcelestial *c)
+{
+	return c->nobjs;
+}
+
+const char * calcelestial_object(const struct calcelestial *c, int i)
+{
+	if (i < 0 || i >= c->nobjs)
+		return NULL;
+
+	return object_name(c->objs[i]);
+}
+
+int calcelestial_set_moment(struct calcelestial *c, const char *moment, bool next)
+{
+	if (object_parse_moment(moment, &c->moment))
+		return CALCELESTIAL_EINVAL;
+
+	c->next = next;
+
+	return CALCELESTIAL_OK;
+}
+
+int calcelestial_set_horizon(struct calcelestial *c, const char *horizon)
+{
+	if (!sun_only(c->objs, c->nobjs))
+		return CALCELESTIAL_EINVAL;
+
+	if (object_parse_horizons(horizon, &c->horizon, &c->twilights))
+		return CALCELESTIAL_EINVAL;
+
+	c->horizon_set = true;
+
+	return CALCELESTIAL_OK;
+}
+
+int calcelestial_set_observer(struct calcelestial *c, double lat, double lng)
+{
+	if (fabs(lat) > 90 || fabs(lng) > 180)
+		return CALCELESTIAL_EINVAL;
+
+	c->obs.lat = lat;
+	c->obs.lng = lng;
+
+	return CALCELESTIAL_OK;
+}
+
+int calcelestial_observer(const struct calcelestial *c, double *lat, double *lng)
+{
+	if (!has_observer(c))
+		return CALCELESTIAL_EINVAL;
+
+	*lat = c->obs.lat;
+	*lng = c->obs.lng;
+
+	return CALCELESTIAL_OK;
+}
+
+#ifdef GEONAMES_SUPPORT
+static int session(struct calcelestial *c)
+{
+	if (!c->geonames)
+		c->geonames = geonames_open();
+
+	return c->geonames ? CALCELESTIAL_OK : CALCELESTIAL_ENOMEM;
+}
+#endif
+
+int calcelestial_lookup_place(struct calcelestial *c, const char *place, char *name, size_t len)
+{
+#ifdef GEONAMES_SUPPORT
+	struct ln_lnlat_posn obs;
+	uint64_t start = stats_begin();
+	int ret;
+
+	ret = session(c);
+	if (ret)
+		return ret;
+
+	ret = geonames_lookup_latlng(c->geonames, place, &obs, name, len) ? CALCELESTIAL_ENOTFOUND : CALCELESTIAL_OK;
+	if (!ret)
+		c->obs = obs;
+
+	stats_end(STATS_GEOCODE, start);
+
+	return ret;
+#else
+	return CALCELESTIAL_ENOTSUP;
+#endif
+}
+
+int calcelestial_set_timezone(struct calcelestial *c, const char *tzid)
+{
+	if (!tzid)
+		tzid = "";
+
+	if (strlen(tzid) >= sizeof(c->tzid))
+		return CALCELESTIAL_EINVAL;
+
+	strcpy(c->tzid, tzid);
+
+	return CALCELESTIAL_OK;
+}
+
+int calcelestial_lookup_timezone(struct calcelestial *c)
+{
+#ifdef GEONAMES_SUPPORT
+	uint64_t start;
+	char tzid[64];
+	int ret, gmt_offset;
+#endif
+
+	if (c->tzindex)
+		return calcelestial_set_timezone(c, "auto");
+
+	if (!has_observer(c))
+		return CALCELESTIAL_EINVAL;
+
+#ifdef GEONAMES_SUPPORT
+	start = stats_begin();
+
+	ret = session(c);
+	if (ret)
+		return ret;
+
+	ret = geonames_lookup_tz(c->geonames, c->obs, &gmt_offset, tzid, sizeof(tzid)) ? CALCELESTIAL_ENOTFOUND : CALCELESTIAL_OK;
+	if (!ret) {
+		tzid[sizeof(tzid) - 1] = '\0';
+		ret = calcelestial_set_timezone(c, tzid);
+	}
+
+	stats_end(STATS_GEOCODE, start);
+
+	return ret;
+#else
+	return CALCELESTIAL_ENOTSUP;
+#endif
+}
+
+const char * calcelestial_timezone(struct calcelestial *c)
+{
+	uint64_t start;
+
+	if (strcmp(c->tzid, "auto"))
+		return c->tzid;
+
+	/* records of a batch are resolved one by one */
+	if (!c->tzindex || !has_observer(c))
+		return c->tzid;
+
+	start = stats_begin();
+	snprintf(c->zone, sizeof(c->zone), "%s", tzindex_lookup(c->tzindex, c->obs.lat, c->obs.lng));
+	stats_end(STATS_TZ, start);
+
+	return c->zone;
+}
+
+int calcelestial_load_tzindex(struct calcelestial *c, const char *filename)
+{
+	struct tzindex *t = tzindex_open(filename);
+
+	if (!t)
+		return CALCELESTIAL_EIO;
+
+	if (c->tzindex)
+		tzindex_close(c->tzindex);
+	c->tzindex = t;
+
+	return CALCELESTIAL_OK;
+}
+
+int calcelestial_set_format(struct calcelestial *c, const char *format)
+{
+	struct format *fmt = format_compile(format);
+
+	if (!fmt)
+		return CALCELESTIAL_ENOMEM;
+
+	format_free(c->format);
+	c->format = fmt;
+
+	return CALCELESTIAL_OK;
+}
+
+/** Whether the context is complete for a calculation */
+static bool ready(const struct calcelestial *c)
+{
+	return c->obj && has_observer(c);
+}
+
+/** Fill a result from the details of object_calc() */
+static void result(struct object_details *details, int circumpolar, struct calcelestial_result *r)
+{
+	struct ln_hrz_posn hrz;
+	int i;
+
+	memset(r, 0, sizeof(*r));
+
+	r->object = details->object;
+	r->jd = details->jd;
+	ln_get_timet_from_julian(details->jd, &r->time);
+
+	r->circumpolar = circumpolar;
+	r->rise = details->rst.rise;
+	r->set = details->rst.set;
+	r->transit = details->rst.transit;
+
+	for (i = 0; i < TWILIGHTS; i++) {
+		r->dawn[i] = details->twilight[i].dawn;
+		r->dusk[i] = details->twilight[i].dusk;
+	}
+
+	ln_get_hrz_from_equ(&details->equ, &details->obs, details->jd, &hrz);
+
+	r->ra = details->equ.ra;
+	r->dec = details->equ.dec;
+	r->az = ln_range_degrees(hrz.az + 180);
+	r->alt = hrz.alt;
+	r->diameter = details->diameter;
+	r->distance = details->distance;
+	r->lat = details->obs.lat;
+	r->lng = details->obs.lng;
+}
+
+int calcelestial_calc(struct calcelestial *c, time_t t, struct calcelestial_result *r)
+{
+	struct object_details details;
+	int ret, circumpolar = 0;
+
+	if (!ready(c))
+		return CALCELESTIAL_EINVAL;
+
+	memset(&details, 0, sizeof(details));
+	details.obs = c->obs;
+	details.twilights = c->twilights;
+
+	ret = object_calc(c->obj, ln_get_julian_from_timet(&t), c->moment, c->next, c->horizon, &details);
+	if (ret)
+		return CALCELESTIAL_ECIRCUMPOLAR;
+
+	/* object_calc() fails for circumpolar objects unless we ask for now */
+	if (c->moment == MOMENT_NOW)
+		circumpolar = object_rst(c->obj, details.jd - .5, c->horizon, &details.obs, &details.rst);
+
+	result(&details, circumpolar, r);
+
+	return CALCELESTIAL_OK;
+}
+
+int calcelestial_calc_all(struct calcelestial *c, time_t t, struct calcelestial_result *r)
+{
+	struct object_details details[OBJECTS_MAX];
+	int rets[OBJECTS_MAX];
+	int i, ret = CALCELESTIAL_OK;
+
+	if (!ready(c))
+		return CALCELESTIAL_EINVAL;
+
+	memset(details, 0, c->nobjs * sizeof(details[0]));
+	for (i = 0; i < c->nobjs; i++) {
+		details[i].obs = c->obs;
+		details[i].twilights = c->twilights;
+	}
+
+	object_calc_many(c->objs, c->nobjs, ln_get_julian_from_timet(&t), c->moment, c->next, c->horizon, details, rets);
+
+	for (i = 0; i < c->nobjs; i++) {
+		if (rets[i] && c->moment != MOMENT_NOW) {
+			memset(&r[i], 0, sizeof(r[i]));
+			r[i].object = object_name(c->objs[i]);
+			r[i].rise = r[i].set = r[i].transit = NAN;
+			r[i].circumpolar = rets[i];
+			ret = CALCELESTIAL_ECIRCUMPOLAR;
+		}
+		else
+			result(&details[i], rets[i], &r[i]);
+	}
+
+	return ret;
+}
+
+int calcelestial_format(struct calcelestial *c, const struct calcelestial_result *r, char *buf, size_t len)
+{
+	struct object_details details = {
+		.object = r->object,
+		.jd = r->jd,
+		.diameter = r->diameter,
+		.distance = r->distance,
+		.obs = { .lat = r->lat, .lng = r->lng },
+		.rst = { .rise = r->rise, .set = r->set, .transit = r->transit },
+		.equ = { .ra = r->ra, .dec = r->dec }
+	};
+	const char *zone;
+	int i, ret;
+
+	for (i = 0; i < TWILIGHTS; i++) {
+		details.twilight[i].dawn = r->dawn[i];
+		details.twilight[i].dusk = r->dusk[i];
+	}
+
+	if (strcmp(c->tzid, "auto") == 0) {
+		if (!c->tzindex)
+			return CALCELESTIAL_EINVAL;
+
+		zone = tzindex_lookup(c->tzindex, r->lat, r->lng);
+	}
+	else
+		zone = c->tzid;
+
+	pthread_mutex_lock(&tz_mutex);
+
+	switch_tz(zone);
+	object_localtime(&details);
+	ret = format_render(c->format, &details, &c->buf) ? (int) c->buf.len : CALCELESTIAL_ENOMEM;
+	switch_tz(""); /* do not leave the process in the timezone of the context */
+
+	pthread_mutex_unlock(&tz_mutex);
+
+	if (ret >= 0 && len > 0)
+		snprintf(buf, len, "%s", c->buf.ptr);
+
+	return ret;
+}
+
+int calcelestial_interpolate(double tolerance)
+{
+	if (tolerance <= 0)
+		return CALCELESTIAL_EINVAL;
+
+	return object_interpolate(tolerance) ? CALCELESTIAL_ENOMEM : CALCELESTIAL_OK;
+}
+
+int calcelestial_precision(const char *precision)
+{
+	enum object_precision p;
+
+	if (object_parse_precision(precision, &p))
+		return CALCELESTIAL_EINVAL;
+
+	object_set_precision(p);
+
+	return CALCELESTIAL_OK;
+}
+
+int calcelestial_map_ephemeris(const char *filename)
+{
+	return object_map_ephemeris(filename) ? CALCELESTIAL_EIO : CALCELESTIAL_OK;
+}
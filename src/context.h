@@ -0,0 +1,61 @@
+/**
+ * Internals of a calculation context, shared with the command line tool
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <stdbool.h>
+#include <libnova/libnova.h>
+
+#include "calcelestial.h"
+#include "objects.h"
+#include "formatter.h"
+#include "tzindex.h"
+
+struct geonames;
+
+struct calcelestial {
+	const struct object *obj;	/**< NULL until set, the first of objs */
+	const struct object *objs[OBJECTS_MAX];
+	int nobjs;
+	enum object_moment moment;
+	bool next;
+	double horizon;
+	unsigned twilights;		/**< Bitmask of enum object_twilight */
+	bool horizon_set;
+
+	struct ln_lnlat_posn obs;	/**< DBL_MAX until set */
+
+	char tzid[64];			/**< Empty for the timezone of the process */
+	char zone[64];			/**< Resolved zone if tzid is auto */
+	struct tzindex *tzindex;
+
+	struct format *format;
+	struct format_buffer buf;
+
+	struct geonames *geonames;	/**< Opened on the first lookup */
+};
+
+#endif /* _CONTEXT_H_ */
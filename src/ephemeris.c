@@ -0,0 +1,453 @@
+/**
+ * Chebyshev interpolation of ephemerides
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libnova/libnova.h>
+
+#include "ephemeris.h"
+
+#define ARCSEC_PER_RAD	206264.806
+#define FIRST_DEGREE	4
+
+struct ephemeris * ephemeris_create(void (*series)(const void *, double, struct ln_equ_posn *, double *, double *),
+	const void *arg, double window, double tolerance)
+{
+	struct ephemeris *e;
+
+	e = calloc(1, sizeof(struct ephemeris));
+	if (!e)
+		return NULL;
+
+	e->series = series;
+	e->arg = arg;
+	e->window = window;
+	e->tolerance = tolerance;
+
+	if (tolerance > 0) {
+		e->nwindows = ceil((EPHEMERIS_LAST_JD - EPHEMERIS_FIRST_JD) / window);
+
+		/* untouched pages of this table do not consume any memory */
+		e->windows = calloc(e->nwindows, sizeof(struct ephemeris_window *));
+		if (!e->windows) {
+			free(e);
+			return NULL;
+		}
+	}
+
+	return e;
+}
+
+void ephemeris_free(struct ephemeris *e)
+{
+	long i;
+
+	for (i = 0; i < e->nwindows; i++)
+		free(e->windows[i]);
+
+	free(e->windows);
+	free(e);
+}
+
+static double clenshaw(const double *c, int n, double x)
+{
+	double bk = 0, bk1 = 0, bk2 = 0;
+	int j;
+
+	for (j = n; j >= 1; j--) {
+		bk = c[j] + 2 * x * bk1 - bk2;
+		bk2 = bk1;
+		bk1 = bk;
+	}
+
+	return c[0] + x * bk1 - bk2;
+}
+
+/** Evaluate components which are stored stride coefficients apart */
+static void eval(const double *coeffs, int degree, int stride, double x, struct ln_equ_posn *equ, double *dist, double *sdiam)
+{
+	if (equ) {
+		equ->ra  = ln_range_degrees(clenshaw(coeffs + EPHEMERIS_RA * stride, degree, x));
+		equ->dec = clenshaw(coeffs + EPHEMERIS_DEC * stride, degree, x);
+	}
+
+	if (dist)
+		*dist = clenshaw(coeffs + EPHEMERIS_DIST * stride, degree, x);
+
+	if (sdiam)
+		*sdiam = clenshaw(coeffs + EPHEMERIS_SDIAM * stride, degree, x);
+}
+
+void ephemeris_window_eval(const struct ephemeris_window *w, double x, struct ln_equ_posn *equ, double *dist, double *sdiam)
+{
+	eval(&w->coeffs[0][0], w->degree, EPHEMERIS_MAX_DEGREE + 1, x, equ, dist, sdiam);
+}
+
+/** Fit coefficients of degree n to samples at the Chebyshev-Lobatto nodes x_k = cos(pi k / n).
+ *
+ * The samples are stored with a stride of EPHEMERIS_MAX_DEGREE / n.
+ */
+static void fit(struct ephemeris_window *w, double samples[][EPHEMERIS_COMPONENTS], int n)
+{
+	int c, j, k, stride = EPHEMERIS_MAX_DEGREE / n;
+
+	for (c = 0; c < EPHEMERIS_COMPONENTS; c++) {
+		for (j = 0; j <= n; j++) {
+			double sum = 0;
+
+			for (k = 0; k <= n; k++) {
+				double f = samples[k * stride][c];
+
+				if (k == 0 || k == n)
+					f /= 2;
+
+				sum += f * cos(M_PI * j * k / n);
+			}
+
+			w->coeffs[c][j] = 2 * sum / n;
+		}
+
+		/* the outermost coefficients count half in the sum */
+		w->coeffs[c][0] /= 2;
+		w->coeffs[c][n] /= 2;
+	}
+
+	w->degree = n;
+}
+
+/** Deviation between a fitted window and a sample in arc seconds */
+static double deviation(const struct ephemeris_window *w, double x, const double *sample)
+{
+	struct ln_equ_posn equ;
+	double dist, sdiam, dra, err, max;
+
+	ephemeris_window_eval(w, x, &equ, &dist, &sdiam);
+
+	dra = fabs(ln_range_degrees(equ.ra - sample[EPHEMERIS_RA] + 180) - 180);
+
+	max = dra * 3600 * cos(ln_deg_to_rad(sample[EPHEMERIS_DEC]));
+
+	err = fabs(equ.dec - sample[EPHEMERIS_DEC]) * 3600;
+	if (err > max)
+		max = err;
+
+	err = fabs(dist - sample[EPHEMERIS_DIST]) / sample[EPHEMERIS_DIST] * ARCSEC_PER_RAD;
+	if (err > max)
+		max = err;
+
+	err = fabs(sdiam - sample[EPHEMERIS_SDIAM]);
+	if (err > max)
+		max = err;
+
+	return max;
+}
+
+static void sample(const struct ephemeris *e, double jd, double *s)
+{
+	struct ln_equ_posn equ;
+
+	e->series(e->arg, jd, &equ, &s[EPHEMERIS_DIST], &s[EPHEMERIS_SDIAM]);
+
+	s[EPHEMERIS_RA] = equ.ra;
+	s[EPHEMERIS_DEC] = equ.dec;
+}
+
+int ephemeris_fit(const struct ephemeris *e, double start, struct ephemeris_window *w)
+{
+	double samples[EPHEMERIS_MAX_DEGREE + 1][EPHEMERIS_COMPONENTS];
+	double half = e->window / 2, mid = start + half;
+	int k, n, stride;
+
+	/* double the degree until the previous fit matches the new nodes */
+	for (n = FIRST_DEGREE; ; n *= 2) {
+		double err = 0;
+
+		stride = EPHEMERIS_MAX_DEGREE / n;
+
+		/* only the nodes which are new for this degree */
+		for (k = 0; k <= n; k++) {
+			if (n == FIRST_DEGREE || k % 2)
+				sample(e, mid + half * cos(M_PI * k / n), samples[k * stride]);
+		}
+
+		/* unwrap right ascension to avoid a jump at 360 degrees */
+		for (k = 1; k <= n; k++) {
+			double *prev = samples[(k - 1) * stride], *cur = samples[k * stride];
+
+			while (cur[EPHEMERIS_RA] - prev[EPHEMERIS_RA] > 180)
+				cur[EPHEMERIS_RA] -= 360;
+			while (cur[EPHEMERIS_RA] - prev[EPHEMERIS_RA] < -180)
+				cur[EPHEMERIS_RA] += 360;
+		}
+
+		/* check the previous fit against the new nodes */
+		if (n > FIRST_DEGREE) {
+			for (k = 1; k <= n; k += 2) {
+				double d = deviation(w, cos(M_PI * k / n), samples[k * stride]);
+				if (d > err)
+					err = d;
+			}
+		}
+
+		fit(w, samples, n);
+
+		if (n > FIRST_DEGREE && err <= e->tolerance)
+			return 0;
+
+		if (n == EPHEMERIS_MAX_DEGREE)
+			return -1;
+	}
+}
+
+static struct ephemeris_window * fit_window(const struct ephemeris *e, double start)
+{
+	struct ephemeris_window *w = calloc(1, sizeof(struct ephemeris_window));
+	if (!w)
+		return NULL;
+
+	if (ephemeris_fit(e, start, w))
+		w->degree = 0; /* fall back to the series */
+
+	return w;
+}
+
+void ephemeris_get(struct ephemeris *e, double jd, struct ln_equ_posn *equ, double *dist, double *sdiam)
+{
+	struct ephemeris_window *w, *expected = NULL;
+	double start;
+	long i;
+
+	if (e->mapped.coeffs) {
+		i = floor((jd - e->mapped.first_jd) / e->mapped.window);
+		if (i >= 0 && i < e->mapped.nwindows) {
+			int stride = e->mapped.degree + 1;
+			const double *coeffs = e->mapped.coeffs + i * EPHEMERIS_COMPONENTS * stride;
+			double x = 2 * (jd - e->mapped.first_jd - i * e->mapped.window) / e->mapped.window - 1;
+
+			/* windows which exceeded the tolerance are flagged with NaN */
+			if (!isnan(coeffs[0])) {
+				eval(coeffs, e->mapped.degree, stride, x, equ, dist, sdiam);
+				return;
+			}
+		}
+	}
+
+	if (!e->windows || jd < EPHEMERIS_FIRST_JD || jd >= EPHEMERIS_LAST_JD)
+		goto series;
+
+	i = (jd - EPHEMERIS_FIRST_JD) / e->window;
+	start = EPHEMERIS_FIRST_JD + i * e->window;
+
+	w = __atomic_load_n(&e->windows[i], __ATOMIC_ACQUIRE);
+	if (!w) {
+		w = fit_window(e, start);
+		if (!w)
+			goto series;
+
+		/* windows are never replaced once published, the loser of a race drops its copy */
+		if (!__atomic_compare_exchange_n(&e->windows[i], &expected, w, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			free(w);
+			w = expected;
+		}
+	}
+
+	if (!w->degree)
+		goto series;
+
+	ephemeris_window_eval(w, 2 * (jd - start) / e->window - 1, equ, dist, sdiam);
+
+	return;
+
+series:
+	e->series(e->arg, jd, equ, dist, sdiam);
+}
+
+int ephemeris_build(const char *filename, struct ephemeris *e[], const char *names[], int n, double first_jd, double last_jd, long *failed)
+{
+	struct ephemeris_file_header hdr = {
+		.magic = EPHEMERIS_FILE_MAGIC,
+		.version = EPHEMERIS_FILE_VERSION,
+		.bom = EPHEMERIS_FILE_BOM,
+		.nobjects = n,
+		.first_jd = first_jd,
+		.last_jd = last_jd
+	};
+	struct ephemeris_file_object *objs;
+	struct ephemeris_window *windows = NULL;
+	uint64_t offset;
+	FILE *f;
+	int i, err, ret = -1;
+
+	*failed = 0;
+
+	objs = calloc(n, sizeof(struct ephemeris_file_object));
+	f = fopen(filename, "w");
+	if (!objs || !f)
+		goto out;
+
+	hdr.tolerance = e[0]->tolerance;
+	offset = sizeof(hdr) + n * sizeof(struct ephemeris_file_object);
+
+	/* reserve space for the directory, it is written once all degrees are known */
+	if (fseek(f, offset, SEEK_SET))
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		struct ephemeris_file_object *obj = &objs[i];
+		long w;
+		int c, degree = 0;
+
+		snprintf(obj->name, sizeof(obj->name), "%s", names[i]);
+		obj->window = e[i]->window;
+		obj->nwindows = ceil((last_jd - first_jd) / e[i]->window);
+		obj->offset = offset;
+
+		windows = calloc(obj->nwindows, sizeof(struct ephemeris_window));
+		if (!windows)
+			goto out;
+
+		for (w = 0; w < obj->nwindows; w++) {
+			if (ephemeris_fit(e[i], first_jd + w * e[i]->window, &windows[w])) {
+				/* flagged for the series, see ephemeris_get() */
+				for (c = 0; c < EPHEMERIS_COMPONENTS; c++)
+					windows[w].coeffs[c][0] = NAN;
+
+				(*failed)++;
+			}
+			else if (windows[w].degree > degree)
+				degree = windows[w].degree;
+		}
+
+		/* lower degree windows are padded with zero coefficients */
+		obj->degree = degree;
+		for (w = 0; w < obj->nwindows; w++) {
+			for (c = 0; c < EPHEMERIS_COMPONENTS; c++) {
+				if (fwrite(windows[w].coeffs[c], sizeof(double), degree + 1, f) != degree + 1)
+					goto out;
+			}
+		}
+
+		offset += (uint64_t) obj->nwindows * EPHEMERIS_COMPONENTS * (degree + 1) * sizeof(double);
+
+		free(windows);
+		windows = NULL;
+	}
+
+	rewind(f);
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(objs, sizeof(struct ephemeris_file_object), n, f) != n)
+		goto out;
+
+	ret = 0;
+
+out:	err = errno; /* of the first failure */
+	if (f && fclose(f) && !ret) {
+		err = errno;
+		ret = -1;
+	}
+
+	free(windows);
+	free(objs);
+
+	errno = err;
+
+	return ret;
+}
+
+int ephemeris_map(const char *filename, struct ephemeris *e[], const char *names[], int n)
+{
+	const struct ephemeris_file_header *hdr;
+	const struct ephemeris_file_object *objs;
+	struct stat st;
+	void *addr;
+	int fd, i, j;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	/* a shared read-only mapping is backed by the page cache only */
+	addr = st.st_size >= sizeof(*hdr) ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+
+	if (addr == MAP_FAILED)
+		goto invalid;
+
+	hdr = addr;
+	objs = (const void *) (hdr + 1);
+
+	if (memcmp(hdr->magic, EPHEMERIS_FILE_MAGIC, sizeof(EPHEMERIS_FILE_MAGIC)) ||
+	    hdr->version != EPHEMERIS_FILE_VERSION ||
+	    hdr->bom != EPHEMERIS_FILE_BOM ||
+	    sizeof(*hdr) + hdr->nobjects * sizeof(*objs) > st.st_size)
+		goto invalid;
+
+	for (i = 0; i < hdr->nobjects; i++) {
+		const struct ephemeris_file_object *obj = &objs[i];
+		uint64_t len = (uint64_t) obj->nwindows * EPHEMERIS_COMPONENTS * (obj->degree + 1) * sizeof(double);
+
+		if (obj->degree > EPHEMERIS_MAX_DEGREE || obj->window <= 0 ||
+		    obj->offset % sizeof(double) || obj->offset + len > st.st_size)
+			goto invalid;
+	}
+
+	for (i = 0; i < hdr->nobjects; i++) {
+		const struct ephemeris_file_object *obj = &objs[i];
+
+		for (j = 0; j < n; j++) {
+			if (strncmp(obj->name, names[j], sizeof(obj->name)))
+				continue;
+
+			e[j]->mapped.coeffs = (const double *) ((const char *) addr + obj->offset);
+			e[j]->mapped.first_jd = hdr->first_jd;
+			e[j]->mapped.window = obj->window;
+			e[j]->mapped.nwindows = obj->nwindows;
+			e[j]->mapped.degree = obj->degree;
+		}
+	}
+
+	return 0;
+
+invalid:
+	if (addr != MAP_FAILED)
+		munmap(addr, st.st_size);
+
+	errno = EINVAL;
+
+	return -1;
+}
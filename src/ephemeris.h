@@ -0,0 +1,158 @@
+/**
+ * Chebyshev interpolation of ephemerides
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _EPHEMERIS_H_
+#define _EPHEMERIS_H_
+
+#include <stdint.h>
+#include <libnova/libnova.h>
+
+#define EPHEMERIS_MAX_DEGREE	32	/**< Highest Chebyshev degree tried for a window */
+#define EPHEMERIS_FIRST_JD	2086308.5 /**< 1000-01-01: Start of the interpolated range */
+#define EPHEMERIS_LAST_JD	2816787.5 /**< 3000-01-01: End of the interpolated range */
+
+/** Components of an interpolated ephemeris */
+enum ephemeris_component {
+	EPHEMERIS_RA,
+	EPHEMERIS_DEC,
+	EPHEMERIS_DIST,
+	EPHEMERIS_SDIAM,
+	EPHEMERIS_COMPONENTS
+};
+
+/** Chebyshev coefficients for a single time window */
+struct ephemeris_window {
+	int degree;			/**< 0 if the series could not be approximated */
+	double coeffs[EPHEMERIS_COMPONENTS][EPHEMERIS_MAX_DEGREE + 1];
+};
+
+struct ephemeris {
+	/** Evaluates the full series, any of the outputs might be NULL */
+	void (*series)(const void *arg, double jd, struct ln_equ_posn *equ, double *dist, double *sdiam);
+	const void *arg;
+
+	double window;			/**< Length of a window in days */
+	double tolerance;		/**< Maximum error in arc seconds, 0 disables fitting */
+
+	struct ephemeris_window **windows; /**< Lazily fitted windows */
+	long nwindows;
+
+	struct {
+		const double *coeffs;	/**< Blocks of EPHEMERIS_COMPONENTS * (degree + 1) coefficients */
+		double first_jd;
+		double window;
+		long nwindows;
+		int degree;
+	} mapped;			/**< Coefficients of a memory mapped ephemeris file */
+};
+
+#define EPHEMERIS_FILE_MAGIC	"CALCEPH"
+#define EPHEMERIS_FILE_VERSION	2
+#define EPHEMERIS_FILE_BOM	0x01020304 /**< Detects files of a different byte order */
+
+/** Header of a precomputed ephemeris file.
+ *
+ * The header is followed by one struct ephemeris_file_object per object
+ * and the coefficient blocks. All offsets are relative to the start of the file.
+ */
+struct ephemeris_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t bom;
+	uint32_t nobjects;
+	uint32_t reserved;
+	double tolerance;		/**< Maximum error in arc seconds */
+	double first_jd;
+	double last_jd;
+};
+
+/** Directory entry of an object in an ephemeris file.
+ *
+ * Windows which do not meet the tolerance have NaN as their first
+ * coefficients and are evaluated from the series instead.
+ */
+struct ephemeris_file_object {
+	char name[16];
+	double window;			/**< Length of a window in days */
+	uint32_t degree;		/**< Common degree of all windows */
+	uint32_t nwindows;
+	uint64_t offset;		/**< Offset of the first coefficient block */
+};
+
+/** Prepare an interpolation cache for the series of an object.
+ *
+ * No series are evaluated until the first call to ephemeris_get().
+ * The series may be called from several threads at once and has to be
+ * thread-safe itself.
+ *
+ * @param arg Passed to every call of series
+ * @param window Length of the fitted time windows in days
+ * @param tolerance Maximum approximation error in arc seconds
+ * @return NULL if out of memory
+ */
+struct ephemeris * ephemeris_create(void (*series)(const void *, double, struct ln_equ_posn *, double *, double *),
+	const void *arg, double window, double tolerance);
+
+void ephemeris_free(struct ephemeris *e);
+
+/** Get the position of an object at jd.
+ *
+ * The Chebyshev polynomials of the surrounding window are fitted on first use.
+ * Falls back to the full series outside of the supported range or if
+ * the tolerance can not be met, which includes flagged windows of a
+ * mapped file. This function is thread-safe as long as the series is.
+ *
+ * @param equ, dist, sdiam Any of them might be NULL
+ */
+void ephemeris_get(struct ephemeris *e, double jd, struct ln_equ_posn *equ, double *dist, double *sdiam);
+
+/** Evaluate a fitted window at normalized time x in [-1, 1] */
+void ephemeris_window_eval(const struct ephemeris_window *w, double x, struct ln_equ_posn *equ, double *dist, double *sdiam);
+
+/** Fit a window starting at the given julian date.
+ *
+ * @retval 0 if the tolerance was met
+ * @retval -1 if the tolerance was not met even for EPHEMERIS_MAX_DEGREE
+ */
+int ephemeris_fit(const struct ephemeris *e, double start, struct ephemeris_window *w);
+
+/** Write the fitted windows of several objects into an ephemeris file.
+ *
+ * @param failed Receives the number of windows which exceed the tolerance and use the series
+ * @retval 0 on success
+ * @retval -1 on error with errno set
+ */
+int ephemeris_build(const char *filename, struct ephemeris *e[], const char *names[], int n, double first_jd, double last_jd, long *failed);
+
+/** Map an ephemeris file into memory and attach it to the objects with matching names.
+ *
+ * The mapping lives until the process exits and may be shared with other processes.
+ *
+ * @retval 0 on success
+ * @retval -1 on error with errno set, EINVAL if it is not a valid ephemeris file
+ */
+int ephemeris_map(const char *filename, struct ephemeris *e[], const char *names[], int n);
+
+#endif /* _EPHEMERIS_H_ */
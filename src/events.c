@@ -0,0 +1,374 @@
+/**
+ * Search for the crossings of an altitude
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <libnova/libnova.h>
+
+#include "events.h"
+#include "objects.h"
+#include "rst.h"
+
+#define EVENTS_MAX_ITERATIONS	50
+
+/** Positions around a sample for the step following it */
+struct span {
+	double jd;			/**< Date of the sample */
+	double step;
+	double theta;			/**< Apparent sidereal time at jd in degrees */
+	double ra[3], dec[3];		/**< Of the previous, this and the next sample */
+	double dist[3], diam[3];
+};
+
+struct site {
+	double lng;
+	double sinlat, coslat;
+	double sinalt;			/**< Sine of the altitude to cross */
+	double f;			/**< Value at the end of the last step */
+};
+
+/** Normalize an angle in degrees to [-180, 180) */
+static double range_half(double a)
+{
+	return a - 360 * floor((a + 180) / 360);
+}
+
+static void span_init(struct span *s, double jd, double step, const struct object_details pos[3])
+{
+	int i;
+
+	s->jd = jd;
+	s->step = step;
+	s->theta = object_sidereal_time(jd);
+
+	for (i = 0; i < 3; i++) {
+		s->dec[i] = pos[i].equ.dec;
+		s->dist[i] = pos[i].distance;
+		s->diam[i] = pos[i].diameter;
+	}
+
+	/* the right ascension must not wrap between the samples */
+	s->ra[0] = pos[0].equ.ra;
+	s->ra[1] = s->ra[0] + range_half(pos[1].equ.ra - s->ra[0]);
+	s->ra[2] = s->ra[1] + range_half(pos[2].equ.ra - s->ra[1]);
+}
+
+/** Interpolate the position for a crossing */
+static void span_pos(const struct span *s, struct event *e)
+{
+	double n = (e->jd - s->jd) / s->step;
+
+	e->equ.ra = ln_range_degrees(ln_interpolate3(n, s->ra[0], s->ra[1], s->ra[2]));
+	e->equ.dec = ln_interpolate3(n, s->dec[0], s->dec[1], s->dec[2]);
+	e->distance = ln_interpolate3(n, s->dist[0], s->dist[1], s->dist[2]);
+	e->diameter = ln_interpolate3(n, s->diam[0], s->diam[1], s->diam[2]);
+}
+
+/** Difference of the sines of the altitude at t and the one to cross
+ *
+ * @param H Receives the hour angle in degrees if not NULL
+ */
+static double evaluate(const struct span *s, const struct site *o, double t, double *H)
+{
+	double n = (t - s->jd) / s->step;
+	double alpha, delta, h;
+
+	alpha = ln_interpolate3(n, s->ra[0], s->ra[1], s->ra[2]);
+	delta = ln_deg_to_rad(ln_interpolate3(n, s->dec[0], s->dec[1], s->dec[2]));
+	h = range_half(s->theta + 360.985647 * (t - s->jd) + o->lng - alpha);
+
+	if (H)
+		*H = h;
+
+	return o->sinlat * sin(delta) + o->coslat * cos(delta) * cos(ln_deg_to_rad(h)) - o->sinalt;
+}
+
+/** Refine a root bracketed by a and b (Brent, Numerical Recipes 9.3) */
+static double brent(const struct span *s, const struct site *o, double a, double fa, double b, double fb, double tolerance)
+{
+	double c = b, fc = fb, d = b - a, e = d;
+	double tol, m, p, q, r, t;
+	int i;
+
+	for (i = 0; i < EVENTS_MAX_ITERATIONS; i++) {
+		if ((fb > 0) == (fc > 0)) {
+			c = a;
+			fc = fa;
+			d = e = b - a;
+		}
+
+		if (fabs(fc) < fabs(fb)) {
+			a = b; b = c; c = a;
+			fa = fb; fb = fc; fc = fa;
+		}
+
+		tol = 2 * DBL_EPSILON * fabs(b) + tolerance / 2;
+		m = (c - b) / 2;
+
+		if (fabs(m) <= tol || fb == 0)
+			break;
+
+		if (fabs(e) >= tol && fabs(fa) > fabs(fb)) {
+			t = fb / fa;
+			if (a == c) { /* secant */
+				p = 2 * m * t;
+				q = 1 - t;
+			}
+			else { /* inverse quadratic interpolation */
+				q = fa / fc;
+				r = fb / fc;
+				p = t * (2 * m * q * (q - r) - (b - a) * (r - 1));
+				q = (q - 1) * (r - 1) * (t - 1);
+			}
+
+			if (p > 0)
+				q = -q;
+			else
+				p = -p;
+
+			if (2 * p < fmin(3 * m * q - fabs(tol * q), fabs(e * q))) {
+				e = d;
+				d = p / q;
+			}
+			else /* bisection */
+				d = e = m;
+		}
+		else
+			d = e = m;
+
+		a = b;
+		fa = fb;
+		b += fabs(d) > tol ? d : copysign(tol, m);
+		fb = evaluate(s, o, b, NULL);
+	}
+
+	return b;
+}
+
+int events_find(const struct object *obj, const struct ln_lnlat_posn *obs, const double *altitude, int n,
+	double first, double last, double step, double tolerance,
+	void (*found)(void *ctx, const struct event *e), void *ctx)
+{
+	struct object_details pos[3];
+	struct site *sites;
+	struct span s;
+	struct event e;
+	double a[3], f[3], H0, H1, dH, c;
+	long k, steps;
+	int i, j, parts, count = 0;
+
+	if (n <= 0 || !(last > first) || !(step > 0) || step > EVENTS_MAX_STEP || !(tolerance > 0))
+		return -1;
+
+	sites = malloc(n * sizeof(sites[0]));
+	if (!sites)
+		return -1;
+
+	for (j = 0; j < n; j++) {
+		sites[j].lng = obs[j].lng;
+		sites[j].sinlat = sin(ln_deg_to_rad(obs[j].lat));
+		sites[j].coslat = cos(ln_deg_to_rad(obs[j].lat));
+		sites[j].sinalt = sin(ln_deg_to_rad(altitude[j]));
+	}
+
+	for (i = 0; i < 3; i++)
+		object_pos(obj, first + (i - 1) * step, &pos[i]);
+
+	steps = ceil((last - first) / step);
+	for (k = 0; k < steps; k++) {
+		/* every step evaluates a single new position for all observers */
+		if (k > 0) {
+			pos[0] = pos[1];
+			pos[1] = pos[2];
+			object_pos(obj, first + (k + 1) * step, &pos[2]);
+		}
+
+		span_init(&s, first + k * step, step, pos);
+
+		for (j = 0; j < n; j++) {
+			struct site *o = &sites[j];
+
+			a[0] = s.jd;
+			f[0] = evaluate(&s, o, a[0], &H0);
+			if (k > 0)
+				f[0] = o->f; /* the same crossing must not be found twice */
+
+			a[2] = s.jd + step;
+			f[2] = evaluate(&s, o, a[2], &H1);
+
+			/* split at the next culmination (hour angle of 0° or 180°) if it is within the step */
+			dH = ln_range_degrees(H1 - H0);
+			c = 180 * floor(H0 / 180) + 180;
+			if (c - H0 < dH) {
+				a[1] = s.jd + (c - H0) / dH * step;
+				f[1] = evaluate(&s, o, a[1], NULL);
+				parts = 2;
+			}
+			else {
+				a[1] = a[2];
+				f[1] = f[2];
+				parts = 1;
+			}
+
+			for (i = 0; i < parts; i++) {
+				if ((f[i] < 0) == (f[i + 1] < 0))
+					continue;
+
+				e.jd = brent(&s, o, a[i], f[i], a[i + 1], f[i + 1], tolerance);
+				e.site = j;
+				e.rising = f[i] < 0;
+				e.deviation = 0;
+
+				if (e.jd >= first && e.jd < last) {
+					span_pos(&s, &e);
+					found(ctx, &e);
+					count++;
+				}
+			}
+
+			o->f = f[2];
+		}
+	}
+
+	free(sites);
+
+	return count;
+}
+
+/** Azimuth from north at jd, interpolated from the samples of a day */
+static double event_azimuth(const struct rst_samples *s, const struct ln_lnlat_posn *obs, double jd)
+{
+	double n = jd - s->jd;
+	double ra[3], alpha, delta, H, lat;
+
+	ra[0] = s->pos[0].ra;
+	ra[1] = ra[0] + range_half(s->pos[1].ra - ra[0]);
+	ra[2] = ra[1] + range_half(s->pos[2].ra - ra[1]);
+
+	alpha = ln_interpolate3(n, ra[0], ra[1], ra[2]);
+	delta = ln_deg_to_rad(ln_interpolate3(n, s->pos[0].dec, s->pos[1].dec, s->pos[2].dec));
+	H = ln_deg_to_rad(s->sidereal + 360.985647 * n + obs->lng - alpha);
+	lat = ln_deg_to_rad(obs->lat);
+
+	/* Meeus (13.5) is measured from the south */
+	return ln_range_degrees(ln_rad_to_deg(atan2(sin(H), cos(H) * sin(lat) - tan(delta) * cos(lat))) + 180);
+}
+
+/** The state of the search of an observer after the previous day */
+struct align {
+	struct ln_rst_time rst;		/**< Transit is NaN after a circumpolar day */
+	double jd, deviation;		/**< Of the last event within the window, NaN if none */
+	int reported;
+};
+
+static void report(const struct object *obj, int site, int rising, double jd, double deviation,
+	void (*found)(void *ctx, const struct event *e), void *ctx)
+{
+	struct object_details details;
+	struct event e = {
+		.jd = jd,
+		.site = site,
+		.rising = rising,
+		.deviation = deviation
+	};
+
+	/* only the few alignments are evaluated exactly */
+	object_pos(obj, jd, &details);
+	e.equ = details.equ;
+	e.distance = details.distance;
+	e.diameter = details.diameter;
+
+	found(ctx, &e);
+}
+
+int events_align(const struct object *obj, const struct ln_lnlat_posn *obs, const double *azimuth, int n,
+	int rising, double horizon, double first, double last, double tolerance,
+	void (*found)(void *ctx, const struct event *e), void *ctx)
+{
+	struct rst_samples samples = { NULL };
+	struct ln_rst_time rst;
+	struct align *prev, *p;
+	double day, jd, deviation;
+	int j, ret, bracket, within, count = 0;
+
+	if (n <= 0 || !(last > first) || !(tolerance >= 0))
+		return -1;
+
+	prev = malloc(n * sizeof(prev[0]));
+	if (!prev)
+		return -1;
+
+	for (j = 0; j < n; j++)
+		prev[j].rst.transit = prev[j].jd = NAN;
+
+	for (day = floor(first - .5) + .5; day < last; day++) {
+		/* a single new position per day for all observers */
+		rst_samples_update(&samples, obj, day);
+
+		for (j = 0; j < n; j++) {
+			p = &prev[j];
+
+			ret = rst_solve(&samples, &obs[j], horizon, isnan(p->rst.transit) ? NULL : &p->rst, &rst);
+			if (ret) {
+				p->rst.transit = p->jd = NAN;
+				continue;
+			}
+
+			p->rst = rst;
+
+			jd = rising ? rst.rise : rst.set;
+			if (jd < first || jd >= last) {
+				p->jd = NAN;
+				continue;
+			}
+
+			deviation = range_half(event_azimuth(&samples, &obs[j], jd) - azimuth[j]);
+			within = fabs(deviation) <= tolerance;
+
+			/* the azimuth passed the target between the previous day and this one */
+			bracket = !isnan(p->jd) && (p->deviation < 0) != (deviation < 0) && fabs(deviation - p->deviation) < 180;
+
+			if (bracket && !p->reported && !within && fabs(p->deviation) < fabs(deviation)) {
+				/* the previous day is the nearer one */
+				report(obj, j, rising, p->jd, p->deviation, found, ctx);
+				count++;
+			}
+			else if (within || (bracket && !p->reported)) {
+				report(obj, j, rising, jd, deviation, found, ctx);
+				count++;
+			}
+
+			p->reported = within || (bracket && !p->reported && fabs(deviation) <= fabs(p->deviation));
+			p->jd = jd;
+			p->deviation = deviation;
+		}
+	}
+
+	free(prev);
+
+	return count;
+}
@@ -0,0 +1,93 @@
+/**
+ * Search for the crossings of an altitude
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include <libnova/libnova.h>
+
+#define EVENTS_STEP		(1.0 / 24)	/**< Default step of the coarse scan in days */
+#define EVENTS_MAX_STEP		0.25		/**< A step must not span both culminations */
+#define EVENTS_TOLERANCE	(1.0 / 86400)	/**< Default accuracy of the crossings in days */
+
+/* Forward declaration */
+struct object;
+
+/** A crossing of the altitude or an alignment found for an observer */
+struct event {
+	double jd;
+	int site;			/**< Index of the observer */
+	int rising;			/**< 1 if the object rises above the altitude, 0 if it sets below it */
+	double deviation;		/**< Of the azimuth of an alignment in degrees, 0 for crossings */
+
+	struct ln_equ_posn equ;		/**< Interpolated position at the crossing */
+	double distance, diameter;
+};
+
+/** Find all crossings of altitudes by an object between first and last.
+ *
+ * The positions are evaluated once per step and shared by all observers,
+ * in between they are interpolated (Meeus, chapter 3), also for the
+ * crossings found. Each step is split
+ * at the culminations, so the altitude is monotonic within the parts and a
+ * change of sign brackets exactly one crossing. It is refined by Brent's method.
+ *
+ * Altitudes are geometric like the §h token, without refraction.
+ *
+ * @param altitude Altitude in degrees for every observer
+ * @param step Step of the coarse scan in days, up to EVENTS_MAX_STEP
+ * @param tolerance Accuracy of the crossings in days
+ * @param found Called step by step for every crossing, so the crossings of
+ *              an observer are in chronological order
+ * @return The number of crossings or -1 on invalid arguments or if out of memory
+ */
+int events_find(const struct object *obj, const struct ln_lnlat_posn *obs, const double *altitude, int n,
+	double first, double last, double step, double tolerance,
+	void (*found)(void *ctx, const struct event *e), void *ctx);
+
+/** Find the days on which an object rises or sets at azimuths.
+ *
+ * The rise or set azimuth is a smooth function of the date. It is scanned
+ * day by day, all observers share the samples of a day (see rst.h) and
+ * the search of every observer starts from its result of the previous day.
+ * A change of sign of the deviation between two days brackets the azimuth,
+ * the nearer day is reported even if the azimuth moves more than the
+ * tolerance per day. Every other day within the tolerance is reported as
+ * well, also around the turning points of the sun where the azimuth is
+ * not reached exactly.
+ *
+ * @param azimuth Azimuth in degrees from north for every observer
+ * @param rising 1 for the rises, 0 for the sets
+ * @param tolerance Maximum deviation of the azimuth in degrees
+ * @param found Called day by day for every alignment, so the alignments of
+ *              an observer are in chronological order
+ * @return The number of alignments or -1 on invalid arguments or if out of memory
+ */
+int events_align(const struct object *obj, const struct ln_lnlat_posn *obs, const double *azimuth, int n,
+	int rising, double horizon, double first, double last, double tolerance,
+	void (*found)(void *ctx, const struct event *e), void *ctx);
+
+#endif /* _EVENTS_H_ */
@@ -27,21 +27,28 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <math.h>
 
 #include "objects.h"
 #include "formatter.h"
+#include "stats.h"
 
 #define PRECISION "3"
 
+#define TOKEN_PREFIX "§"
+#define TOKEN_PREFIX_LEN (sizeof(TOKEN_PREFIX) - 1)
+
 struct specifiers {
 	const char *token;
 	const char *desc;
 	size_t offset; // offset in struct object_details
-	enum { DOUBLE, STRING, INTEGER } format;
+	enum { DOUBLE, STRING, INTEGER, TIME } format;
 };
 
 static struct specifiers specifiers[] = {
 	{ "§J", "Julian date of observation",				offsetof(struct object_details, jd),		DOUBLE },
+	{ "§t", "Unix time of observation with milliseconds",		offsetof(struct object_details, timestamp),	DOUBLE },
 	{ "§d", "Diameter in arc seconds",				offsetof(struct object_details, diameter),	DOUBLE },
 	{ "§e", "Distance to object in astronomical unit",		offsetof(struct object_details, distance),	DOUBLE },
 	{ "§r", "Equatorial Coordinates: Right Ascension in degrees",	offsetof(struct object_details, equ.ra),	DOUBLE },
@@ -51,9 +58,36 @@ static struct specifiers specifiers[] = {
 	{ "§A", "Latitude in degrees",					offsetof(struct object_details, obs.lat),	DOUBLE },
 	{ "§O", "Longitude in degrees",					offsetof(struct object_details, obs.lng),	DOUBLE },
 	{ "§s", "Azimuth direction (N, E, S, W, NE, ...)",		offsetof(struct object_details, azidir),	STRING },
+	{ "§p", "Name of the object",					offsetof(struct object_details, object),	STRING },
+	{ "§E", "Event found by --altitude or --azimuth: rise or set",	offsetof(struct object_details, event),		STRING },
+	{ "§D", "Deviation from the azimuth of --azimuth in degrees",	offsetof(struct object_details, deviation),	DOUBLE },
+	{ "§R", "Time of rise",						offsetof(struct object_details, rst.rise),	TIME },
+	{ "§S", "Time of set",						offsetof(struct object_details, rst.set),	TIME },
+	{ "§T", "Time of transit",					offsetof(struct object_details, rst.transit),	TIME },
+	{ "§c", "Civil dawn (--horizon all or a list with civil)",	offsetof(struct object_details, twilight[TWILIGHT_CIVIL].dawn),		TIME },
+	{ "§C", "Civil dusk",						offsetof(struct object_details, twilight[TWILIGHT_CIVIL].dusk),		TIME },
+	{ "§n", "Nautic dawn",						offsetof(struct object_details, twilight[TWILIGHT_NAUTIC].dawn),	TIME },
+	{ "§N", "Nautic dusk",						offsetof(struct object_details, twilight[TWILIGHT_NAUTIC].dusk),	TIME },
+	{ "§x", "Astronomical dawn",					offsetof(struct object_details, twilight[TWILIGHT_ASTRONOMICAL].dawn),	TIME },
+	{ "§X", "Astronomical dusk",					offsetof(struct object_details, twilight[TWILIGHT_ASTRONOMICAL].dusk),	TIME },
 	{ NULL }
 };
 
+struct format_op {
+	enum { LITERAL, FIELD, STRFTIME } type;
+	size_t offset;	/**< Offset of text in format->text */
+	size_t len;	/**< Length of text */
+	int spec;	/**< Index in specifiers[] */
+};
+
+struct format {
+	char *text;	/**< Literals and strftime fragments, each null-terminated */
+	struct format_op *ops;
+	int nops;
+
+	struct format_buffer buf; /**< Used by format_result() */
+};
+
 /** Replace parts of the string with a possibily long replacement */
 char * strrepl(const char *subject, const char *search, const char *replace)
 {
@@ -66,7 +100,7 @@ char * strrepl(const char *subject, const char *search, const char *replace)
 		new_len += replace_len - search_len;
 
 	const char *old = subject;
-	char *new = malloc(new_len);
+	char *new = malloc(new_len + 1);
 
 	new[0] = '\0'; /* empty string */
 	for (tmp = strstr(subject, search); tmp != NULL; tmp = strstr(tmp + search_len, search)) {
@@ -94,38 +128,256 @@ void print_format_tokens()
 	printf("\n");
 }
 
-void format_result(const char *format, struct object_details *result)
+static int lookup_token(const char *str)
 {
-	char buffer[128];
-	char *local_format = strdup(format);
 	int i;
 
-	struct ln_hms ra;
+	/* the first match wins for duplicate tokens */
+	for (i = 0; specifiers[i].token; i++) {
+		if (!strncmp(str, specifiers[i].token, strlen(specifiers[i].token)))
+			return i;
+	}
+
+	return -1;
+}
+
+/** Append a text span as literal or strftime() fragment */
+static void compile_text(struct format *fmt, size_t *textlen, const char *str, size_t len)
+{
+	struct format_op *op;
+
+	if (len == 0)
+		return;
+
+	op = &fmt->ops[fmt->nops++];
+	op->type = memchr(str, '%', len) ? STRFTIME : LITERAL;
+	op->offset = *textlen;
+	op->len = len;
+
+	memcpy(fmt->text + *textlen, str, len);
+	*textlen += len;
+
+	/* strftime() returns 0 for an empty result as well as for a full buffer.
+	 * A trailing space makes them distinguishable, it is stripped after rendering. */
+	if (op->type == STRFTIME)
+		fmt->text[(*textlen)++] = ' ';
+
+	fmt->text[(*textlen)++] = '\0';
+}
+
+struct format * format_compile(const char *format)
+{
+	struct format *fmt;
+	const char *p, *span;
+	size_t textlen = 0, len = strlen(format);
+	int spec;
+
+	fmt = calloc(1, sizeof(struct format));
+	if (!fmt)
+		return NULL;
+
+	/* every character may start a new op in the worst case */
+	fmt->ops = malloc((len + 1) * sizeof(struct format_op));
+	fmt->text = malloc(3 * len + 2);
+	if (!fmt->ops || !fmt->text) {
+		format_free(fmt);
+		return NULL;
+	}
+
+	for (span = p = format; *p; ) {
+		if (strncmp(p, TOKEN_PREFIX, TOKEN_PREFIX_LEN)) {
+			p++;
+			continue;
+		}
+
+		/* a double prefix is a literal prefix */
+		if (!strncmp(p + TOKEN_PREFIX_LEN, TOKEN_PREFIX, TOKEN_PREFIX_LEN)) {
+			compile_text(fmt, &textlen, span, p - span + TOKEN_PREFIX_LEN);
+			span = p += 2 * TOKEN_PREFIX_LEN;
+			continue;
+		}
+
+		spec = lookup_token(p);
+		if (spec < 0) {
+			p += TOKEN_PREFIX_LEN;
+			continue;
+		}
+
+		compile_text(fmt, &textlen, span, p - span);
+
+		fmt->ops[fmt->nops].type = FIELD;
+		fmt->ops[fmt->nops].spec = spec;
+		fmt->nops++;
+
+		span = p += strlen(specifiers[spec].token);
+	}
+
+	compile_text(fmt, &textlen, span, p - span);
+
+	return fmt;
+}
+
+void format_free(struct format *fmt)
+{
+	if (!fmt)
+		return;
+
+	format_buffer_free(&fmt->buf);
+	free(fmt->ops);
+	free(fmt->text);
+	free(fmt);
+}
+
+void format_buffer_free(struct format_buffer *buf)
+{
+	free(buf->ptr);
+
+	buf->ptr = NULL;
+	buf->len = buf->size = 0;
+}
+
+/** Make sure that at least len bytes are available after the current end */
+static int reserve(struct format_buffer *buf, size_t len)
+{
+	size_t size = buf->size ? buf->size : 128;
+	char *ptr;
+
+	while (size < buf->len + len + 1)
+		size *= 2;
+
+	if (size == buf->size)
+		return 0;
+
+	ptr = realloc(buf->ptr, size);
+	if (!ptr)
+		return -1;
+
+	buf->ptr = ptr;
+	buf->size = size;
+
+	return 0;
+}
+
+/** Local time of an event as HH:MM or --:-- if it does not happen */
+static void render_time(double jd, char *str, size_t len)
+{
+	struct tm tm;
+	time_t t;
+
+	if (isnan(jd)) {
+		snprintf(str, len, "--:--");
+		return;
+	}
+
+	ln_get_timet_from_julian(jd, &t);
+	localtime_r(&t, &tm);
+	strftime(str, len, "%H:%M", &tm);
+}
+
+static int render_field(const struct specifiers *spec, struct object_details *result, struct format_buffer *buf)
+{
+	void *ptr = (char *) result + spec->offset;
+	char time[16];
+	int len;
+
+	if (spec->format == TIME)
+		render_time(* (double *) ptr, time, sizeof(time));
+
+	for (;;) {
+		size_t avail = buf->size - buf->len;
+
+		switch (spec->format) {
+			case DOUBLE:  len = snprintf(buf->ptr + buf->len, avail, "%." PRECISION "f", * (double *) ptr); break;
+			case STRING:  len = snprintf(buf->ptr + buf->len, avail, "%s",             * (const char **) ptr ? * (const char **) ptr : ""); break;
+			case INTEGER: len = snprintf(buf->ptr + buf->len, avail, "%d",             * (int *) ptr); break;
+			case TIME:    len = snprintf(buf->ptr + buf->len, avail, "%s",             time); break;
+			default:      len = 0;
+		}
+
+		if (len < 0)
+			return -1;
+		else if ((size_t) len < avail) {
+			buf->len += len;
+			return 0;
+		}
+		else if (reserve(buf, len))
+			return -1;
+	}
+}
+
+static int render_strftime(const char *fragment, size_t fraglen, const struct tm *tm, struct format_buffer *buf)
+{
+	size_t len, want = 2 * fraglen + 32;
+
+	for (;;) {
+		if (reserve(buf, want))
+			return -1;
+
+		len = strftime(buf->ptr + buf->len, buf->size - buf->len, fragment, tm);
+		if (len > 0) {
+			buf->len += len - 1; /* strip trailing space */
+			return 0;
+		}
+
+		want = 2 * (buf->size - buf->len);
+	}
+}
+
+const char * format_render(const struct format *fmt, struct object_details *result, struct format_buffer *buf)
+{
+	uint64_t start = stats_begin();
+	int i, ret;
 
 	/* convert results */
-	ln_deg_to_hms(result->equ.ra, &ra);
 	ln_get_hrz_from_equ(&result->equ, &result->obs, result->jd, &result->hrz);
 
 	result->azidir = ln_hrz_to_nswe(&result->hrz);
 	result->hrz.az = ln_range_degrees(result->hrz.az + 180);
 	result->hrz.alt = ln_range_degrees(result->hrz.alt);
 
-	for (i = 0; specifiers[i].token; i++) {
-		if (strstr(local_format, specifiers[i].token) != NULL) {
-			void *ptr = (char *) result + specifiers[i].offset;
-			
-			switch (specifiers[i].format) {
-				case DOUBLE: snprintf(buffer, sizeof(buffer), "%." PRECISION "f", * (double *) ptr); break;
-				case STRING: snprintf(buffer, sizeof(buffer), "%s",                 (char *)   ptr); break;
-				case INTEGER: snprintf(buffer, sizeof(buffer), "%d",              * (int *)    ptr); break;
-			}
-
-			local_format = strrepl(local_format, specifiers[i].token, buffer);
+	buf->len = 0;
+	ret = reserve(buf, 0);
+
+	for (i = 0; i < fmt->nops && !ret; i++) {
+		const struct format_op *op = &fmt->ops[i];
+		const char *text = fmt->text + op->offset;
+
+		switch (op->type) {
+			case LITERAL:
+				ret = reserve(buf, op->len);
+				if (!ret) {
+					memcpy(buf->ptr + buf->len, text, op->len);
+					buf->len += op->len;
+				}
+				break;
+
+			case FIELD:
+				ret = render_field(&specifiers[op->spec], result, buf);
+				break;
+
+			case STRFTIME:
+				ret = render_strftime(text, op->len, &result->tm, buf);
+				break;
 		}
 	}
 
-	strftime(buffer, sizeof(buffer), local_format, &result->tm);
-	printf("%s\n", buffer);
+	stats_end(STATS_FORMAT, start);
+
+	if (ret)
+		return NULL;
+
+	buf->ptr[buf->len] = '\0';
+
+	return buf->ptr;
+}
+
+int format_result(struct format *fmt, struct object_details *result)
+{
+	if (!format_render(fmt, result, &fmt->buf))
+		return -1;
+
+	fwrite(fmt->buf.ptr, 1, fmt->buf.len, stdout);
+	putchar('\n');
 
-	free(local_format);
+	return 0;
 }
@@ -28,10 +28,43 @@
 
 #include <libnova/libnova.h>
 
+#include <stddef.h>
+
 /* Forward declaration */
 struct object_details;
+struct format;
+
+/** Growable output buffer which is reused across records */
+struct format_buffer {
+	char *ptr;
+	size_t len;
+	size_t size;
+};
 
-void format_result(const char *format, struct object_details *result);
+/** Parse a format string once into a sequence of literal, § and strftime() operations.
+ *
+ * @return NULL if out of memory
+ */
+struct format * format_compile(const char *format);
+
+void format_free(struct format *fmt);
+
+/** Render a result into buf.
+ *
+ * The buffer is only reallocated if it is too small. So rendering a
+ * series of records with the same buffer does not allocate memory.
+ *
+ * @return A null-terminated string in buf->ptr or NULL if out of memory
+ */
+const char * format_render(const struct format *fmt, struct object_details *result, struct format_buffer *buf);
+
+void format_buffer_free(struct format_buffer *buf);
+
+/** Render a result into the buffer of the compiled format and print it to stdout.
+ *
+ * @retval -1 if out of memory, nothing is printed then
+ */
+int format_result(struct format *fmt, struct object_details *result);
 
 char * strrepl(const char *subject, const char *search, const char *replace);
 
@@ -0,0 +1,466 @@
+/**
+ * Offline gazetteer built from GeoNames dumps
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gazetteer.h"
+
+#define GAZETTEER_FIELDS	19	/**< Columns of the cities and countryInfo dumps */
+#define GAZETTEER_MAX_NAME	256
+
+/** Tables of a gazetteer file while it is being built */
+struct builder {
+	struct gazetteer_place *places;
+	size_t nplaces, places_size;
+
+	struct gazetteer_key *keys;
+	size_t nkeys, keys_size;
+
+	struct gazetteer_country *countries;
+	size_t ncountries, countries_size;
+
+	char *strings;
+	size_t strings_len, strings_size;
+};
+
+/* qsort() does not pass a context */
+static const struct builder *sorting;
+
+static int grow(void **ptr, size_t *size, size_t needed, size_t elmsize)
+{
+	size_t new_size = *size ? *size : 1024;
+	void *p;
+
+	if (needed <= *size)
+		return 0;
+
+	while (new_size < needed)
+		new_size *= 2;
+
+	p = realloc(*ptr, new_size * elmsize);
+	if (!p)
+		return -1;
+
+	*ptr = p;
+	*size = new_size;
+
+	return 0;
+}
+
+static int64_t add_string(struct builder *b, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	int64_t offset = b->strings_len;
+
+	if (grow((void **) &b->strings, &b->strings_size, b->strings_len + len, 1) || offset + len > UINT32_MAX)
+		return -1;
+
+	memcpy(b->strings + offset, str, len);
+	b->strings_len += len;
+
+	return offset;
+}
+
+size_t gazetteer_normalize(const char *in, char *out, size_t len)
+{
+	size_t n = 0;
+	bool space = false;
+
+	for (; *in && n + 1 < len; in++) {
+		unsigned char c = *in;
+
+		/* punctuation separates words like whitespace, UTF-8 sequences are kept */
+		if (isspace(c) || c == '-' || c == '\'' || c == '.' || c == '(' || c == ')' || c == '/') {
+			space = n > 0;
+			continue;
+		}
+
+		if (space && n + 2 < len)
+			out[n++] = ' ';
+		space = false;
+
+		out[n++] = c < 0x80 ? tolower(c) : c;
+	}
+
+	out[n] = '\0';
+
+	return n;
+}
+
+static int add_key(struct builder *b, const char *name, uint32_t place, uint32_t first)
+{
+	char key[GAZETTEER_MAX_NAME];
+	int64_t offset;
+	size_t i;
+
+	if (!gazetteer_normalize(name, key, sizeof(key)))
+		return 0;
+
+	/* only once per place */
+	for (i = first; i < b->nkeys; i++) {
+		if (!strcmp(b->strings + b->keys[i].key, key))
+			return 0;
+	}
+
+	offset = add_string(b, key);
+	if (offset < 0 || grow((void **) &b->keys, &b->keys_size, b->nkeys + 1, sizeof(*b->keys)))
+		return -1;
+
+	b->keys[b->nkeys++] = (struct gazetteer_key) {
+		.key = offset,
+		.place = place
+	};
+
+	return 0;
+}
+
+/** Split a line into tab separated fields, keeping empty ones */
+static int split_tabs(char *line, char *fields[], int max)
+{
+	int n = 0;
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	while (n < max) {
+		fields[n++] = line;
+
+		line = strchr(line, '\t');
+		if (!line)
+			break;
+
+		*line++ = '\0';
+	}
+
+	return n;
+}
+
+static int add_country(struct builder *b, char *fields[])
+{
+	char name[GAZETTEER_MAX_NAME];
+	int64_t offset;
+
+	gazetteer_normalize(fields[4], name, sizeof(name));
+
+	offset = add_string(b, name);
+	if (offset < 0 || grow((void **) &b->countries, &b->countries_size, b->ncountries + 1, sizeof(*b->countries)))
+		return -1;
+
+	b->countries[b->ncountries++] = (struct gazetteer_country) {
+		.iso = { fields[0][0], fields[0][1] },
+		.name = offset
+	};
+
+	return 0;
+}
+
+static int add_place(struct builder *b, char *fields[])
+{
+	struct gazetteer_place *p;
+	int64_t name, tzid;
+	uint32_t first = b->nkeys;
+	char *alt, *saveptr;
+
+	name = add_string(b, fields[1]);
+	tzid = add_string(b, fields[17]);
+	if (name < 0 || tzid < 0 || grow((void **) &b->places, &b->places_size, b->nplaces + 1, sizeof(*b->places)))
+		return -1;
+
+	p = &b->places[b->nplaces];
+	*p = (struct gazetteer_place) {
+		.lat = strtod(fields[4], NULL),
+		.lng = strtod(fields[5], NULL),
+		.population = strtoul(fields[14], NULL, 10),
+		.name = name,
+		.tzid = tzid,
+		.country = { fields[8][0], fields[8][1] },
+		.fclass = fields[6][0]
+	};
+
+	if (add_key(b, fields[1], b->nplaces, first) ||
+	    add_key(b, fields[2], b->nplaces, first))
+		return -1;
+
+	for (alt = strtok_r(fields[3], ",", &saveptr); alt; alt = strtok_r(NULL, ",", &saveptr)) {
+		if (add_key(b, alt, b->nplaces, first))
+			return -1;
+	}
+
+	b->nplaces++;
+
+	return 0;
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+	const struct gazetteer_key *ka = a, *kb = b;
+	uint32_t pa, pb;
+	int ret;
+
+	ret = strcmp(sorting->strings + ka->key, sorting->strings + kb->key);
+	if (ret)
+		return ret;
+
+	/* the most populated place first */
+	pa = sorting->places[ka->place].population;
+	pb = sorting->places[kb->place].population;
+
+	return pa < pb ? 1 : pa > pb ? -1 : 0;
+}
+
+static uint64_t align(uint64_t offset)
+{
+	return (offset + 7) & ~7ULL;
+}
+
+static int write_table(FILE *f, uint64_t offset, const void *data, size_t size)
+{
+	if (fseek(f, offset, SEEK_SET))
+		return -1;
+
+	return size && fwrite(data, size, 1, f) != 1 ? -1 : 0;
+}
+
+int gazetteer_build(const char *filename, FILE *in, size_t *lineno)
+{
+	struct builder b = { 0 };
+	struct gazetteer_header hdr = {
+		.magic = GAZETTEER_MAGIC,
+		.version = GAZETTEER_VERSION,
+		.bom = GAZETTEER_BOM
+	};
+	char *line = NULL, *fields[GAZETTEER_FIELDS];
+	size_t linelen = 0;
+	FILE *f = NULL;
+	int n, ret = -1;
+
+	*lineno = 0;
+
+	while (getline(&line, &linelen, in) >= 0) {
+		(*lineno)++;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		n = split_tabs(line, fields, GAZETTEER_FIELDS);
+		if (n < GAZETTEER_FIELDS) {
+			errno = EINVAL;
+			goto out;
+		}
+
+		/* cities start with a numeric id, countries with their ISO code */
+		if (isdigit(fields[0][0]) ? add_place(&b, fields) : add_country(&b, fields)) {
+			errno = ENOMEM;
+			goto out;
+		}
+	}
+
+	sorting = &b;
+	qsort(b.keys, b.nkeys, sizeof(*b.keys), compare_keys);
+	sorting = NULL;
+
+	hdr.nplaces = b.nplaces;
+	hdr.nkeys = b.nkeys;
+	hdr.ncountries = b.ncountries;
+	hdr.places = align(sizeof(hdr));
+	hdr.keys = align(hdr.places + b.nplaces * sizeof(*b.places));
+	hdr.countries = align(hdr.keys + b.nkeys * sizeof(*b.keys));
+	hdr.strings = align(hdr.countries + b.ncountries * sizeof(*b.countries));
+	hdr.strings_size = b.strings_len;
+
+	f = fopen(filename, "w");
+	if (!f)
+		goto out;
+
+	if (write_table(f, 0, &hdr, sizeof(hdr)) ||
+	    write_table(f, hdr.places, b.places, b.nplaces * sizeof(*b.places)) ||
+	    write_table(f, hdr.keys, b.keys, b.nkeys * sizeof(*b.keys)) ||
+	    write_table(f, hdr.countries, b.countries, b.ncountries * sizeof(*b.countries)) ||
+	    write_table(f, hdr.strings, b.strings, b.strings_len) ||
+	    fclose(f)) {
+		f = NULL;
+		goto out;
+	}
+
+	f = NULL;
+	ret = 0;
+
+out:	if (f)
+		fclose(f);
+	free(line);
+	free(b.places);
+	free(b.keys);
+	free(b.countries);
+	free(b.strings);
+
+	return ret;
+}
+
+struct gazetteer * gazetteer_open(const char *filename)
+{
+	struct gazetteer *g;
+	const struct gazetteer_header *hdr;
+	struct stat st;
+	uint64_t size;
+	void *addr;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	if ((uint64_t) st.st_size < sizeof(*hdr)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size = st.st_size;
+	addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	hdr = addr;
+	if (memcmp(hdr->magic, GAZETTEER_MAGIC, sizeof(GAZETTEER_MAGIC)) ||
+	    hdr->version != GAZETTEER_VERSION ||
+	    hdr->bom != GAZETTEER_BOM ||
+	    hdr->places + (uint64_t) hdr->nplaces * sizeof(struct gazetteer_place) > size ||
+	    hdr->keys + (uint64_t) hdr->nkeys * sizeof(struct gazetteer_key) > size ||
+	    hdr->countries + (uint64_t) hdr->ncountries * sizeof(struct gazetteer_country) > size ||
+	    hdr->strings + hdr->strings_size > size ||
+	    (hdr->strings_size && ((const char *) addr)[hdr->strings + hdr->strings_size - 1] != '\0')) {
+		munmap(addr, size);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	g = malloc(sizeof(struct gazetteer));
+	if (!g) {
+		munmap(addr, size);
+		return NULL;
+	}
+
+	g->addr = addr;
+	g->size = size;
+	g->hdr = hdr;
+	g->places = (const void *) ((const char *) addr + hdr->places);
+	g->keys = (const void *) ((const char *) addr + hdr->keys);
+	g->countries = (const void *) ((const char *) addr + hdr->countries);
+	g->strings = (const char *) addr + hdr->strings;
+
+	return g;
+}
+
+void gazetteer_close(struct gazetteer *g)
+{
+	munmap((void *) g->addr, g->size);
+	free(g);
+}
+
+const char * gazetteer_string(const struct gazetteer *g, uint32_t offset)
+{
+	return offset < g->hdr->strings_size ? g->strings + offset : "";
+}
+
+static bool matches_country(const struct gazetteer *g, const struct gazetteer_place *p, const char *qualifier)
+{
+	uint32_t i;
+
+	/* ISO code */
+	if (strlen(qualifier) == 2 &&
+	    tolower(p->country[0]) == qualifier[0] && tolower(p->country[1]) == qualifier[1])
+		return true;
+
+	for (i = 0; i < g->hdr->ncountries; i++) {
+		const struct gazetteer_country *c = &g->countries[i];
+
+		if (c->iso[0] == p->country[0] && c->iso[1] == p->country[1])
+			return !strcmp(gazetteer_string(g, c->name), qualifier);
+	}
+
+	return false;
+}
+
+const struct gazetteer_place * gazetteer_lookup(const struct gazetteer *g, const char *query)
+{
+	char name[GAZETTEER_MAX_NAME], qualifiers[GAZETTEER_MAX_QUALIFIERS][GAZETTEER_MAX_NAME];
+	char buf[GAZETTEER_MAX_NAME], *part, *saveptr;
+	uint32_t lo, hi, mid;
+	int i, n = 0;
+
+	snprintf(buf, sizeof(buf), "%s", query);
+
+	part = strtok_r(buf, ",", &saveptr);
+	if (!part || !gazetteer_normalize(part, name, sizeof(name)))
+		return NULL;
+
+	while ((part = strtok_r(NULL, ",", &saveptr)) && n < GAZETTEER_MAX_QUALIFIERS) {
+		if (gazetteer_normalize(part, qualifiers[n], sizeof(qualifiers[n])))
+			n++;
+	}
+
+	/* lower bound of the name */
+	for (lo = 0, hi = g->hdr->nkeys; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+
+		if (strcmp(gazetteer_string(g, g->keys[mid].key), name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* places with the same name are ordered by population */
+	for (; lo < g->hdr->nkeys && !strcmp(gazetteer_string(g, g->keys[lo].key), name); lo++) {
+		const struct gazetteer_place *p;
+
+		if (g->keys[lo].place >= g->hdr->nplaces)
+			continue;
+
+		p = &g->places[g->keys[lo].place];
+		for (i = 0; i < n && matches_country(g, p, qualifiers[i]); i++);
+
+		if (i == n)
+			return p;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,124 @@
+/**
+ * Offline gazetteer built from GeoNames dumps
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GAZETTEER_H_
+#define _GAZETTEER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define GAZETTEER_MAGIC		"CALCGAZ"
+#define GAZETTEER_VERSION	1
+#define GAZETTEER_BOM		0x01020304 /**< Detects files of a different byte order */
+#define GAZETTEER_MAX_QUALIFIERS 4	/**< Number of comma separated parts after the name */
+
+/** Header of a gazetteer file.
+ *
+ * The header is followed by the tables of places, keys and countries and
+ * the string table. All offsets are relative to the start of the file.
+ */
+struct gazetteer_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t bom;
+	uint32_t nplaces, nkeys, ncountries;
+	uint32_t reserved;
+	uint64_t places, keys, countries, strings;
+	uint64_t strings_size;
+};
+
+struct gazetteer_place {
+	double lat, lng;
+	uint32_t population;
+	uint32_t name;			/**< Offsets into the string table */
+	uint32_t tzid;
+	char country[2];		/**< ISO 3166 code */
+	char fclass;			/**< GeoNames feature class: P for populated places */
+	char reserved;
+};
+
+/** Normalized names sorted by name and descending population */
+struct gazetteer_key {
+	uint32_t key;
+	uint32_t place;
+};
+
+struct gazetteer_country {
+	char iso[2];
+	char reserved[2];
+	uint32_t name;			/**< Normalized name */
+};
+
+/** A memory mapped gazetteer file */
+struct gazetteer {
+	const void *addr;
+	size_t size;
+
+	const struct gazetteer_header *hdr;
+	const struct gazetteer_place *places;
+	const struct gazetteer_key *keys;
+	const struct gazetteer_country *countries;
+	const char *strings;
+};
+
+/** Convert a name into the form used as key: lowercase with single spaces between words
+ *
+ * @return The length of the normalized name
+ */
+size_t gazetteer_normalize(const char *in, char *out, size_t len);
+
+/** Build a gazetteer file from GeoNames dumps.
+ *
+ * The input may contain lines of countryInfo.txt and of any of the cities or
+ * allCountries files. Lines of both files can be mixed in any order.
+ *
+ * @param lineno Receives the number of the last line read
+ * @retval 0 on success
+ * @retval -1 on error with errno set, EINVAL for an invalid record in line lineno
+ */
+int gazetteer_build(const char *filename, FILE *in, size_t *lineno);
+
+/** Map a gazetteer file into memory.
+ *
+ * @return NULL with errno set, EINVAL if the file is not a valid gazetteer
+ */
+struct gazetteer * gazetteer_open(const char *filename);
+
+void gazetteer_close(struct gazetteer *g);
+
+/** Find the most relevant place for a query like "Baden, Switzerland".
+ *
+ * All parts after the first comma have to match the country code or name of the place.
+ * Among the matching places the one with the largest population wins.
+ *
+ * @return NULL if there is no matching place
+ */
+const struct gazetteer_place * gazetteer_lookup(const struct gazetteer *g, const char *query);
+
+/** Get a string of the string table, e.g. the name or tzid of a place */
+const char * gazetteer_string(const struct gazetteer *g, uint32_t offset);
+
+#endif /* _GAZETTEER_H_ */
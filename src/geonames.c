@@ -32,6 +32,8 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <curl/curl.h>
 #include <json-c/json.h>
@@ -40,9 +42,12 @@
 #include "../config.h"
 #include "geonames.h"
 #include "formatter.h"
+#include "gazetteer.h"
+#include "cache.h"
+#include "stats.h"
 
-static const char* url_tpl = "http://api.geonames.org/search?q=%s&maxRows=1&username=libastro&type=json&orderby=relevance";
-static const char* url_tz_tpl = "http://api.geonames.org/timezoneJSON?lat=%.6f&lng=%.6f&username=libastro";
+static const char* url_tpl = "%s/search?q=%s&maxRows=1&username=libastro&type=json&orderby=relevance";
+static const char* url_tz_tpl = "%s/timezoneJSON?lat=%.6f&lng=%.6f&username=libastro";
 
 struct string {
 	char *ptr;
@@ -61,169 +66,201 @@ struct ctx_tz {
 	size_t tzidlen;
 };
 
-#ifdef GEONAMES_CACHE_SUPPORT
-enum cache_op { STORE, LOOKUP, DELETE };
-
-static int cache(enum cache_op op, const char *url, struct string *s)
-{
-	int ret;
-	DB *dbp;
-	DBT key, data;
-
-	char filename[256];
-	snprintf(filename, sizeof(filename), "%s/%s", getenv("HOME"), GEONAMES_CACHE_FILE);
-	
-	ret = db_create(&dbp, NULL, 0);
-	if (ret) {
-		fprintf(stderr, "Error: db: %s\n", db_strerror(ret));
-		return ret;
-	}
-
-	ret = dbp->open(dbp, NULL, filename, NULL, DB_BTREE, DB_CREATE, 0);
-	if (ret) {
-		fprintf(stderr, "Error: db: %s\n", db_strerror(ret));
-		return ret;
-	}
-	
-	memset(&key, 0, sizeof(key));
-	memset(&data, 0, sizeof(data));
-
-	key.data = (void *) url;
-	key.size = strlen(url) + 1;
-	
-	switch (op) {
-		case LOOKUP:
-			ret = dbp->get(dbp, NULL, &key, &data, 0);
-			if (ret)
-				goto err;
-
-#ifdef DEBUG
-			printf("Debug: cache key retrieved: %s => %s.\n", (char *) key.data, (char *) data.data);
-#endif /* DEBUG */
-			s->ptr = malloc(data.size);
-			s->len = data.size;
-			if (!s->ptr) {
-				fprintf(stderr, "malloc() failed: %s\n", strerror(errno));
-				goto err;
-			}
-			
-			memcpy(s->ptr, data.data, data.size);
-			break;
-		
-		case STORE:
-			data.data = s->ptr;
-			data.size = s->len;
-		
-			ret = dbp->put(dbp, NULL, &key, &data, 0);
-			if (ret) {
-				fprintf(stderr, "Error: db: %s\n", db_strerror(ret));
-				goto err;
-			}
-#ifdef DEBUG
-			printf("Debug: cache key stored: %s => %s\n", (char *) key.data, (char *) data.data);
-#endif /* DEBUG */
-			break;
-
-		case DELETE: {
-			// TODO
-		}
-	}
-	
-err:	
-	dbp->close(dbp, 0);
+struct geonames {
+	CURL *curl;		/**< A single handle for all sequential requests keeps the connection alive */
+	struct cache *cache;	/**< NULL if the cache is not available */
+	const char *error;	/**< See geonames_error() */
+};
 
-	return ret;
-}
-#endif /* GEONAMES_CACHE_SUPPORT */
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static struct gazetteer *gazetteer_handle;
 
 static size_t writefunction(void *contents, size_t size, size_t nmemb, void *userp)
 {
 	struct string *s = userp;
+	char *ptr;
 	
 	size_t new_len = s->len + size*nmemb;
 
-	s->ptr = realloc(s->ptr, new_len + 1);
-	if (s->ptr == NULL) {
-		fprintf(stderr, "realloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
+	/* a short count makes curl abort the transfer with CURLE_WRITE_ERROR */
+	ptr = realloc(s->ptr, new_len + 1);
+	if (ptr == NULL)
+		return 0;
+
+	s->ptr = ptr;
 	
 	memcpy(s->ptr + s->len, contents, size*nmemb);
 	
 	s->ptr[new_len] = '\0';
 	s->len = new_len;
 
+	stats_count(STATS_BYTES_FETCHED, size*nmemb);
+
 	return size * nmemb;
 }
 
-static int request_json(const char *url, int (*parser)(struct json_object *jobj, void *ctx), void *ctx)
+/** The web service, GEONAMES_URL in the environment points to a mirror or a local stand-in */
+static const char * base_url(void)
 {
-	int ret, cached;
+	const char *url = getenv("GEONAMES_URL");
 
-	CURL *ch;
-	CURLcode res;
+	return url ? url : GEONAMES_URL;
+}
 
-	struct json_object *jobj;
-	enum json_tokener_error error;
-	
-	struct string s = { 0 };
-	
 #ifdef GEONAMES_CACHE_SUPPORT
-	cached = cache(LOOKUP, url, &s) == 0;
-	if (cached)
-		goto cached;
+/** A limit of the cache, the variable of the same name in the environment overrides it */
+static long cache_limit(const char *name, long def)
+{
+	const char *env = getenv(name);
+
+	return env ? strtol(env, NULL, 10) : def;
+}
 #endif /* GEONAMES_CACHE_SUPPORT */
 
-	/* Setup curl */
-	ch = curl_easy_init();
-	if (!ch)
-		return -1;
+/** Process wide initialization: curl and the offline gazetteer, if there is one */
+static void init(void)
+{
+	char filename[PATH_MAX];
+	const char *env;
+
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+
+	env = getenv("GEONAMES_GAZETTEER");
+	if (env)
+		snprintf(filename, sizeof(filename), "%s", env);
+	else
+		snprintf(filename, sizeof(filename), "%s/%s", getenv("HOME"), GEONAMES_GAZETTEER_FILE);
 
+	gazetteer_handle = gazetteer_open(filename);
+}
+
+struct geonames * geonames_open(void)
+{
+	struct geonames *g;
+#ifdef GEONAMES_CACHE_SUPPORT
+	char home[PATH_MAX];
+#endif /* GEONAMES_CACHE_SUPPORT */
+
+	pthread_once(&once, init);
+
+	g = calloc(1, sizeof(struct geonames));
+	if (!g)
+		return NULL;
+
+	g->curl = curl_easy_init();
+	if (!g->curl) {
+		free(g);
+		return NULL;
+	}
+
+#ifdef GEONAMES_CACHE_SUPPORT
+	snprintf(home, sizeof(home), "%s/%s", getenv("HOME"), GEONAMES_CACHE_DIR);
+
+	g->cache = cache_open(home, GEONAMES_CACHE_FILE,
+		cache_limit("GEONAMES_CACHE_TTL", GEONAMES_CACHE_TTL),
+		cache_limit("GEONAMES_CACHE_MAX_SIZE", GEONAMES_CACHE_MAX_SIZE));
+#endif /* GEONAMES_CACHE_SUPPORT */
+
+	return g;
+}
+
+const char * geonames_error(const struct geonames *g)
+{
+	return g->error;
+}
+
+void geonames_close(struct geonames *g)
+{
+	if (!g)
+		return;
+
+	if (g->cache)
+		cache_close(g->cache);
+
+	curl_easy_cleanup(g->curl);
+	free(g);
+}
+
+static void setup(CURL *ch, const char *url, struct string *s)
+{
 #ifdef DEBUG
 	printf("Debug: request url: %s\r\n", url);
 #endif /* DEBUG */
 
 	curl_easy_setopt(ch, CURLOPT_URL, url);
 	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, writefunction);
-	curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *) &s);
+	curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *) s);
 	curl_easy_setopt(ch, CURLOPT_USERAGENT, "libastro/1.0");
+	curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(ch, CURLOPT_TIMEOUT, (long) GEONAMES_TIMEOUT);
+}
 
-	/* perform request */
-	res = curl_easy_perform(ch);
-
-	/* always cleanup */ 
-	curl_easy_cleanup(ch);
-
-	if (res != CURLE_OK) {
-		fprintf(stderr, "Error: request failed: %s\n", curl_easy_strerror(res));
-		return -1;
-	}
-	
-#ifdef DEBUG
-	printf("Debug: request completed: %s\r\n", s.ptr);
-#endif /* DEBUG */
+/** Parse a response and keep the cache in sync with the result */
+static int parse(struct geonames *g, const char *url, struct string *s, int cached, int (*parser)(struct json_object *jobj, void *ctx), void *ctx)
+{
+	struct json_object *jobj;
+	enum json_tokener_error error;
+	int ret;
 
-cached:	
-	jobj = json_tokener_parse_verbose(s.ptr, &error);
+	jobj = json_tokener_parse_verbose(s->ptr ? s->ptr : "", &error);
 	if (!jobj) {
 #ifdef DEBUG
 		printf("Debug: failed to parse json: %s\r\n", json_tokener_error_desc(error));
 #endif /* DEBUG */
 	}
-		
-		
+
 	ret = parser(jobj, ctx);
-	if (!ret && !cached) {
+#ifdef DEBUG
+	if (ret)
+		printf("Debug: failed to parse: %d\n", ret);
+#endif /* DEBUG */
+#ifdef GEONAMES_CACHE_SUPPORT
+	if (!ret && !cached && g->cache)
+		cache_store(g->cache, url, s->ptr, s->len);
+	else if (ret && cached) /* do not serve a broken response again */
+		cache_delete(g->cache, url);
+#endif /* GEONAMES_CACHE_SUPPORT */
+
+	json_object_put(jobj);
+
+	return ret;
+}
+
+static int request_json(struct geonames *g, const char *url, int (*parser)(struct json_object *jobj, void *ctx), void *ctx)
+{
+	int ret;
+
+	CURLcode res;
+
+	struct string s = { 0 };
+
+	g->error = NULL;
+
 #ifdef GEONAMES_CACHE_SUPPORT
-		cache(STORE, url, &s);
+	if (g->cache && cache_lookup(g->cache, url, &s.ptr, &s.len) == 0) {
+		ret = parse(g, url, &s, 1, parser, ctx);
+		free(s.ptr);
+
+		return ret;
+	}
 #endif /* GEONAMES_CACHE_SUPPORT */
+
+	setup(g->curl, url, &s);
+
+	/* perform request */
+	res = curl_easy_perform(g->curl);
+	if (res != CURLE_OK) {
+		g->error = curl_easy_strerror(res);
+		free(s.ptr);
+		return -1;
 	}
+
 #ifdef DEBUG
-	else
-		printf("Debug: failed to parse: %d\n", ret);
+	printf("Debug: request completed: %s\r\n", s.ptr);
 #endif /* DEBUG */
 
-	json_object_put(jobj);
+	ret = parse(g, url, &s, 0, parser, ctx);
+	free(s.ptr);
 
 	return ret;
 }
@@ -246,7 +283,7 @@ static int parser_tz(struct json_object *jobj, void *userp)
 	*ctx->gmt_offset = json_object_get_int(jobj_offset);
 	
 	if (ctx->tzid)
-		strncpy(ctx->tzid, json_object_get_string(jobj_tzid), ctx->tzidlen);
+		snprintf(ctx->tzid, ctx->tzidlen, "%s", json_object_get_string(jobj_tzid));
 	
 	return 0;
 }
@@ -291,12 +328,12 @@ static int parser_latlng(struct json_object *jobj, void *userp)
 	ctx->coords->lng = json_object_get_double(jobj_lng);
 
 	if (ctx->name)
-		strncpy(ctx->name, json_object_get_string(jobj_name), ctx->namelen);
+		snprintf(ctx->name, ctx->namelen, "%s", json_object_get_string(jobj_name));
 
 	return 0;
 }
 
-int geonames_lookup_tz(struct ln_lnlat_posn coords, int *gmt_offset, char *tzid, size_t tzidlen)
+int geonames_lookup_tz(struct geonames *g, struct ln_lnlat_posn coords, int *gmt_offset, char *tzid, size_t tzidlen)
 {
 	char url[256];
 	struct ctx_tz ctx = {
@@ -305,15 +342,29 @@ int geonames_lookup_tz(struct ln_lnlat_posn coords, int *gmt_offset, char *tzid,
 		.tzidlen = tzidlen
 	};
 	
-	snprintf(url, sizeof(url), url_tz_tpl, coords.lat, coords.lng);
+	snprintf(url, sizeof(url), url_tz_tpl, base_url(), coords.lat, coords.lng);
 
-	return request_json(url, parser_tz, &ctx);
+	return request_json(g, url, parser_tz, &ctx);
 }
 
-int geonames_lookup_latlng(const char *place, struct ln_lnlat_posn *coords, char *name, size_t namelen)
+int geonames_lookup_latlng(struct geonames *g, const char *place, struct ln_lnlat_posn *coords, char *name, size_t namelen)
 {
 	int ret;
 	char url[256];
+	const struct gazetteer *gz = gazetteer_handle;
+	const struct gazetteer_place *p;
+
+	/* try the local index before asking the web service */
+	if (gz && (p = gazetteer_lookup(gz, place))) {
+		coords->lat = p->lat;
+		coords->lng = p->lng;
+
+		if (name)
+			snprintf(name, namelen, "%s", gazetteer_string(gz, p->name));
+
+		return 0;
+	}
+
 	struct ctx_latlng ctx = {
 		.coords = coords,
 		.name = name,
@@ -323,12 +374,241 @@ int geonames_lookup_latlng(const char *place, struct ln_lnlat_posn *coords, char
 	//char *escaped_place = curl_escape(place, 0);
 	char *escaped_place = strrepl(place, " ", "+");
 	
-	snprintf(url, sizeof(url), url_tpl, escaped_place);
+	snprintf(url, sizeof(url), url_tpl, base_url(), escaped_place);
 
-	ret = request_json(url, parser_latlng, &ctx);
+	ret = request_json(g, url, parser_latlng, &ctx);
 	
 	//curl_free(escaped_place);
 	free(escaped_place);
 	
 	return ret;
-}
\ No newline at end of file
+}
+
+/** A request of geonames_lookup_batch() on its way through the multi handle */
+struct transfer {
+	CURL *ch;
+	struct geonames_request *req;	/**< NULL if the slot is idle */
+	struct string s;
+	char url[256];
+
+	int attempt;
+	long long retry_at;		/**< Monotonic time in ms of the next attempt, 0 while running */
+};
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int finish(struct geonames *g, struct geonames_request *r, const char *url, struct string *s, int cached)
+{
+	struct ctx_latlng ctx_latlng = {
+		.coords = &r->coords,
+		.name = r->name,
+		.namelen = sizeof(r->name)
+	};
+	struct ctx_tz ctx_tz = {
+		.gmt_offset = &r->gmt_offset,
+		.tzid = r->tzid,
+		.tzidlen = sizeof(r->tzid)
+	};
+
+	return r->type == GEONAMES_LATLNG
+		? parse(g, url, s, cached, parser_latlng, &ctx_latlng)
+		: parse(g, url, s, cached, parser_tz, &ctx_tz);
+}
+
+/** Build the url of a request or answer it from the gazetteer or the cache right away
+ *
+ * @retval 1 if the request has been answered already
+ * @retval 0 if it needs a transfer
+ */
+static int prepare(struct geonames *g, struct geonames_request *r, char *url, size_t len)
+{
+	const struct gazetteer *gz = gazetteer_handle;
+	const struct gazetteer_place *p;
+	char *escaped_place;
+#ifdef GEONAMES_CACHE_SUPPORT
+	struct string s = { 0 };
+#endif /* GEONAMES_CACHE_SUPPORT */
+
+	if (r->type == GEONAMES_LATLNG) {
+		if (gz && (p = gazetteer_lookup(gz, r->place))) {
+			r->coords.lat = p->lat;
+			r->coords.lng = p->lng;
+			snprintf(r->name, sizeof(r->name), "%s", gazetteer_string(gz, p->name));
+
+			r->ret = 0;
+			return 1;
+		}
+
+		escaped_place = strrepl(r->place, " ", "+");
+		snprintf(url, len, url_tpl, base_url(), escaped_place);
+		free(escaped_place);
+	}
+	else
+		snprintf(url, len, url_tz_tpl, base_url(), r->coords.lat, r->coords.lng);
+
+#ifdef GEONAMES_CACHE_SUPPORT
+	if (g->cache && cache_lookup(g->cache, url, &s.ptr, &s.len) == 0) {
+		r->ret = finish(g, r, url, &s, 1);
+		free(s.ptr);
+
+		return 1;
+	}
+#endif /* GEONAMES_CACHE_SUPPORT */
+
+	return 0;
+}
+
+static int start(CURLM *multi, struct transfer *t)
+{
+	free(t->s.ptr);
+	t->s = (struct string) { 0 };
+	t->retry_at = 0;
+
+	setup(t->ch, t->url, &t->s);
+	curl_easy_setopt(t->ch, CURLOPT_PRIVATE, t);
+
+	return curl_multi_add_handle(multi, t->ch) == CURLM_OK ? 0 : -1;
+}
+
+int geonames_lookup_batch(struct geonames *g, struct geonames_request *reqs, size_t n, int inflight)
+{
+	struct transfer *slots = NULL, *t;
+	struct geonames_request *r;
+	struct CURLMsg *msg;
+	CURLM *multi = NULL;
+	long status;
+	long long now, wait;
+	size_t next = 0, i;
+	int k, running, msgs, idle, active = 0, failed = 0;
+
+	if (inflight < 1)
+		inflight = GEONAMES_INFLIGHT;
+
+	g->error = NULL;
+
+	multi = curl_multi_init();
+	slots = calloc(inflight, sizeof(struct transfer));
+	if (!multi || !slots)
+		goto nomem;
+
+	for (k = 0; k < inflight; k++) {
+		slots[k].ch = curl_easy_init();
+		if (!slots[k].ch)
+			goto nomem;
+	}
+
+	for (;;) {
+		/* keep all slots busy */
+		for (k = 0; k < inflight; k++) {
+			for (t = &slots[k]; !t->req && next < n; ) {
+				r = &reqs[next++];
+
+				if (prepare(g, r, t->url, sizeof(t->url))) {
+					failed += r->ret != 0;
+					continue;
+				}
+
+				t->req = r;
+				t->attempt = 0;
+
+				if (start(multi, t)) {
+					r->ret = -1;
+					failed++;
+					t->req = NULL;
+				}
+				else
+					active++;
+			}
+		}
+
+		if (!active)
+			break;
+
+		curl_multi_perform(multi, &running);
+
+		while ((msg = curl_multi_info_read(multi, &msgs))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			status = 0;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &t);
+			curl_easy_getinfo(t->ch, CURLINFO_RESPONSE_CODE, &status);
+			curl_multi_remove_handle(multi, t->ch);
+
+			/* transient errors are retried with exponential backoff */
+			if ((msg->data.result != CURLE_OK || status == 429 || status >= 500) && t->attempt < GEONAMES_RETRIES) {
+				t->retry_at = now_ms() + ((long long) GEONAMES_BACKOFF << t->attempt++);
+				continue;
+			}
+
+			if (msg->data.result != CURLE_OK) {
+				g->error = curl_easy_strerror(msg->data.result);
+				t->req->ret = -1;
+			}
+			else
+				t->req->ret = finish(g, t->req, t->url, &t->s, 0);
+
+			failed += t->req->ret != 0;
+			t->req = NULL;
+			active--;
+		}
+
+		/* restart transfers after their backoff and sleep until the next one is due */
+		now = now_ms();
+		wait = 1000;
+		idle = 0;
+
+		for (k = 0; k < inflight; k++) {
+			t = &slots[k];
+
+			if (!t->req)
+				idle++;
+			else if (t->retry_at && t->retry_at <= now) {
+				if (start(multi, t)) {
+					t->req->ret = -1;
+					failed++;
+					t->req = NULL;
+					active--;
+				}
+			}
+			else if (t->retry_at && t->retry_at - now < wait)
+				wait = t->retry_at - now;
+		}
+
+		if (!active || (idle && next < n))
+			continue;
+
+		/* curl_multi_wait() returns immediately without any transfer */
+		if (running)
+			curl_multi_wait(multi, NULL, 0, wait, NULL);
+		else {
+			struct timespec ts = { wait / 1000, (wait % 1000) * 1000000 };
+			nanosleep(&ts, NULL);
+		}
+	}
+
+	goto out;
+
+nomem:	g->error = "failed to setup transfers";
+	for (i = 0; i < n; i++)
+		reqs[i].ret = -1;
+	failed = n;
+
+out:	for (k = 0; slots && k < inflight; k++) {
+		if (slots[k].ch)
+			curl_easy_cleanup(slots[k].ch);
+		free(slots[k].s.ptr);
+	}
+	free(slots);
+	if (multi)
+		curl_multi_cleanup(multi);
+
+	return failed;
+}
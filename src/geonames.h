@@ -27,14 +27,54 @@
 #define _GEONAMES_H_
 
 #include <json-c/json.h>
-
-/* Forward declaration */
-struct ln_lnlat_posn;
+#include <libnova/libnova.h>
 
 #define GEONAMES_CACHE_SUPPORT 1
-#define GEONAMES_CACHE_FILE ".geonames.db" /* in users home dir */
+#define GEONAMES_CACHE_DIR ".geonames" /* in users home dir */
+#define GEONAMES_CACHE_FILE "cache.db"
+#define GEONAMES_CACHE_TTL (90 * 24 * 3600) /* places and timezones rarely change, overridden by $GEONAMES_CACHE_TTL */
+#define GEONAMES_CACHE_MAX_SIZE (16 << 20) /* overridden by $GEONAMES_CACHE_MAX_SIZE */
+#define GEONAMES_GAZETTEER_FILE ".geonames.idx" /* in users home dir, see --build-gazetteer */
+
+#define GEONAMES_URL "http://api.geonames.org" /* overridden by $GEONAMES_URL */
+#define GEONAMES_TIMEOUT 30 /* seconds per request */
+#define GEONAMES_INFLIGHT 8 /* default number of concurrent requests */
+#define GEONAMES_RETRIES 3
+#define GEONAMES_BACKOFF 250 /* ms before the first retry, doubled for every further one */
+
+enum geonames_type {
+	GEONAMES_LATLNG,	/* coordinates of a place */
+	GEONAMES_TZ		/* timezone at coordinates */
+};
+
+struct geonames_request {
+	enum geonames_type type;
+	const char *place;		/* query of GEONAMES_LATLNG */
+	struct ln_lnlat_posn coords;	/* query of GEONAMES_TZ, result of GEONAMES_LATLNG */
+
+	char name[128];			/* results */
+	char tzid[64];
+	int gmt_offset;
+	int ret;			/* 0 on success */
+};
+
+/* A session keeps the connection to the web service alive and holds a handle of the cache.
+ * Sessions are independent of each other but each one may only be used by one thread at a time. */
+struct geonames;
+
+/* Returns NULL if out of memory, a session without cache if the cache can not be opened */
+struct geonames * geonames_open(void);
+void geonames_close(struct geonames *g);
+
+int geonames_lookup_latlng(struct geonames *g, const char *place, struct ln_lnlat_posn *coords, char *name, size_t namelen);
+int geonames_lookup_tz(struct geonames *g, struct ln_lnlat_posn coords, int *gmt_offset, char *tzid, size_t tzidlen);
+
+/* Resolve many requests concurrently with at most inflight transfers at a time.
+ * Requests answered by the gazetteer or the cache need no transfer at all.
+ * Returns the number of failed requests. */
+int geonames_lookup_batch(struct geonames *g, struct geonames_request *reqs, size_t n, int inflight);
 
-int geonames_lookup_latlng(const char *place, struct ln_lnlat_posn *coords, char *name, size_t namelen);
-int geonames_lookup_tz(struct ln_lnlat_posn coords, int *gmt_offset, char *tzid, size_t tzidlen);
+/* Why a transfer of the last lookup failed, NULL if none did, e.g. if a place was not found */
+const char * geonames_error(const struct geonames *g);
 
 #endif /* _GEONAMES_H_ */
@@ -23,33 +23,134 @@
  * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _XOPEN_SOURCE 700
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <libnova/libnova.h>
 
 #include "../config.h"
 #include "geonames.h"
 
+/** Resolve the places of stdin, one per line, and print their coordinates and timezones */
+static int batch(struct geonames *g, int inflight)
+{
+	struct geonames_request *reqs = NULL, *tzs = NULL, *p;
+	char *line = NULL, **places = NULL, **tmp;
+	size_t linelen = 0, n = 0, size = 0, i;
+	int failed, ret = -1;
+
+	while (getline(&line, &linelen, stdin) >= 0) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (n == size) {
+			tmp = realloc(places, (size ? 2 * size : 64) * sizeof(char *));
+			if (!tmp)
+				goto nomem;
+
+			places = tmp;
+			size = size ? 2 * size : 64;
+		}
+
+		places[n] = strdup(line);
+		if (!places[n])
+			goto nomem;
+		n++;
+	}
+
+	reqs = calloc(n, sizeof(struct geonames_request));
+	tzs = calloc(n, sizeof(struct geonames_request));
+	if (n && (!reqs || !tzs))
+		goto nomem;
+
+	for (i = 0; i < n; i++) {
+		reqs[i].type = GEONAMES_LATLNG;
+		reqs[i].place = places[i];
+	}
+
+	failed = geonames_lookup_batch(g, reqs, n, inflight);
+	if (geonames_error(g))
+		fprintf(stderr, "Error: request failed: %s\n", geonames_error(g));
+
+	for (i = 0; i < n; i++) {
+		tzs[i].type = GEONAMES_TZ;
+		tzs[i].coords = reqs[i].coords;
+	}
+
+	/* only for the places which have been found */
+	for (i = 0, p = tzs; i < n; i++) {
+		if (!reqs[i].ret)
+			*p++ = tzs[i];
+	}
+
+	failed += geonames_lookup_batch(g, tzs, p - tzs, inflight);
+	if (geonames_error(g))
+		fprintf(stderr, "Error: request failed: %s\n", geonames_error(g));
+
+	for (i = 0, p = tzs; i < n; i++) {
+		if (reqs[i].ret)
+			printf("%s\terror\n", places[i]);
+		else {
+			printf("%s\t%.4f\t%.4f\t%s\n", reqs[i].name, reqs[i].coords.lat, reqs[i].coords.lng, p->ret ? "" : p->tzid);
+			p++;
+		}
+	}
+
+	ret = failed ? 1 : 0;
+	goto out;
+
+nomem:	fprintf(stderr, "Error: out of memory\n");
+out:	for (i = 0; i < n; i++)
+		free(places[i]);
+	free(places);
+	free(reqs);
+	free(tzs);
+	free(line);
+
+	return ret;
+}
+
 int main(int argc, char *argv[]) {
 	int ret, gmt_offset;
 	struct ln_lnlat_posn res;
-	char name[128], tzid[32];
+	struct geonames *g;
+	char name[128], tzid[64];
 
-	if (argc != 2)
+	if (argc < 2) {
 		fprintf(stderr, "Usage: geonames LOCATION\n");
+		fprintf(stderr, "       geonames - [INFLIGHT] < LOCATIONS\n");
+		return 1;
+	}
 
-	ret = geonames_lookup_latlng(argv[1], &res, name, sizeof(name));
-	if (ret) {
-		fprintf(stderr, "Error: Failed to lookup coordinates of %s\n", argv[1]);
+	g = geonames_open();
+	if (!g) {
+		fprintf(stderr, "Error: failed to open session\n");
 		return 1;
 	}
+
+	if (!strcmp(argv[1], "-")) {
+		ret = batch(g, argc > 2 ? atoi(argv[2]) : GEONAMES_INFLIGHT);
+		goto out;
+	}
+
+	ret = geonames_lookup_latlng(g, argv[1], &res, name, sizeof(name));
+	if (ret) {
+		fprintf(stderr, "Error: Failed to lookup coordinates of %s: %s\n", argv[1],
+			geonames_error(g) ? geonames_error(g) : "not found");
+		ret = 1;
+		goto out;
+	}
 	
-	ret = geonames_lookup_tz(res, &gmt_offset, tzid, sizeof(tzid));
+	ret = geonames_lookup_tz(g, res, &gmt_offset, tzid, sizeof(tzid));
 	if (ret)
-		fprintf(stderr, "Error: Failed to lookup timezone for %.4f %.4f\n", res.lat, res.lng);
+		fprintf(stderr, "Error: Failed to lookup timezone for %.4f %.4f: %s\n", res.lat, res.lng,
+			geonames_error(g) ? geonames_error(g) : "not found");
 	
 	printf("%s is at %.4f, %.4f with timezone %s (GMT%+d)\r\n", name, res.lat, res.lng, tzid, gmt_offset);
 
+out:	geonames_close(g);
+
 	return ret;
 }
@@ -0,0 +1,246 @@
+/**
+ * Raster of rise/set/transit times and positions for a geographic grid
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <libnova/libnova.h>
+
+#include "grid.h"
+#include "objects.h"
+#include "rst.h"
+#include "horizontal.h"
+
+#define GRID_MAX_CELLS	(1 << 28)	/**< Limits the raster to 10 GiB */
+
+struct grid {
+	const struct grid_spec *spec;
+	const struct batch_config *cfg;
+	uint32_t rows, cols;
+
+	struct rst_samples samples;	/**< Shared by all cells */
+	struct ln_equ_posn equ;
+	double jd;
+
+	double *lng;			/**< Longitudes of the columns */
+	struct horizontal_observers lngs; /**< Their terms, shared read-only by all rows */
+
+	double *bands[GRID_BANDS];
+	size_t next_row;		/**< Next row to be claimed by a worker */
+};
+
+static double unix_from_julian(double jd)
+{
+	return (jd - 2440587.5) * 86400;
+}
+
+static uint32_t cells(double from, double to, double step)
+{
+	return floor((to - from) / step + 1e-9) + 1;
+}
+
+int grid_parse(const char *str, struct grid_spec *spec)
+{
+	double rows, cols;
+	int n;
+
+	if (sscanf(str, "%lf:%lf:%lf,%lf:%lf:%lf%n", &spec->lat0, &spec->lat1, &spec->dlat,
+		&spec->lon0, &spec->lon1, &spec->dlon, &n) != 6 || str[n] != '\0')
+		return -1;
+
+	if (spec->dlat <= 0 || spec->dlon <= 0 || spec->lat1 < spec->lat0 || spec->lon1 < spec->lon0)
+		return -1;
+
+	if (fabs(spec->lat0) > 90 || fabs(spec->lat1) > 90 || fabs(spec->lon0) > 180 || fabs(spec->lon1) > 180)
+		return -1;
+
+	/* bound the cell counts before cells() converts them (also rejects NaN) */
+	rows = (spec->lat1 - spec->lat0) / spec->dlat + 1;
+	cols = (spec->lon1 - spec->lon0) / spec->dlon + 1;
+	if (!(rows * cols <= GRID_MAX_CELLS))
+		return -1;
+
+	return 0;
+}
+
+static void calc_row(struct grid *g, uint32_t r, struct horizontal_observers *o)
+{
+	struct ln_lnlat_posn obs;
+	struct ln_rst_time rst, prev;
+	size_t i, offset = (size_t) r * g->cols;
+	uint32_t c;
+	int ret = -1;
+
+	obs.lat = g->spec->lat0 + r * g->spec->dlat;
+
+	for (c = 0; c < g->cols; c++) {
+		obs.lng = g->lng[c];
+
+		/* the neighbouring cell is the best starting estimate */
+		ret = rst_solve(&g->samples, &obs, g->cfg->horizon, ret ? NULL : &prev, &rst);
+		if (ret) {
+			g->bands[GRID_RISE][offset + c] = NAN;
+			g->bands[GRID_SET][offset + c] = NAN;
+			g->bands[GRID_TRANSIT][offset + c] = NAN;
+		}
+		else {
+			g->bands[GRID_RISE][offset + c] = unix_from_julian(rst.rise);
+			g->bands[GRID_SET][offset + c] = unix_from_julian(rst.set);
+			g->bands[GRID_TRANSIT][offset + c] = unix_from_julian(rst.transit);
+			prev = rst;
+		}
+	}
+
+	horizontal_observers_lat(o, obs.lat);
+	horizontal_batch(o, &g->equ, g->jd, g->bands[GRID_AZ] + offset, g->bands[GRID_ALT] + offset, NULL);
+
+	/* same orientation as the §a token */
+	for (i = offset; i < offset + g->cols; i++)
+		g->bands[GRID_AZ][i] = ln_range_degrees(g->bands[GRID_AZ][i] + 180);
+}
+
+static void * worker(void *arg)
+{
+	struct grid *g = arg;
+	struct horizontal_observers o;
+	size_t r;
+
+	/* the rows are left to the other workers */
+	if (horizontal_observers_share(&o, &g->lngs))
+		return NULL;
+
+	while ((r = __atomic_fetch_add(&g->next_row, 1, __ATOMIC_RELAXED)) < g->rows)
+		calc_row(g, r, &o);
+
+	horizontal_observers_free(&o);
+
+	return NULL;
+}
+
+int grid_run(const struct grid_spec *spec, const struct batch_config *cfg, double jd, FILE *out)
+{
+	pthread_t *threads = NULL;
+	size_t n;
+	uint32_t c;
+	int b, i, started = 0, ret = -1;
+
+	struct grid g = {
+		.spec = spec,
+		.cfg = cfg,
+		.rows = cells(spec->lat0, spec->lat1, spec->dlat),
+		.cols = cells(spec->lon0, spec->lon1, spec->dlon),
+		.jd = jd
+	};
+
+	struct grid_header hdr = {
+		.magic = GRID_MAGIC,
+		.version = GRID_VERSION,
+		.bom = GRID_BOM,
+		.rows = g.rows,
+		.cols = g.cols,
+		.bands = GRID_BANDS,
+		.lat0 = spec->lat0,
+		.dlat = spec->dlat,
+		.lon0 = spec->lon0,
+		.dlon = spec->dlon,
+		.jd = jd
+	};
+
+	n = (size_t) g.rows * g.cols;
+	if (n > GRID_MAX_CELLS) {
+		fprintf(stderr, "Error: grid is too large\n");
+		return -1;
+	}
+
+	for (b = 0; b < GRID_BANDS; b++) {
+		g.bands[b] = malloc(n * sizeof(double));
+		if (!g.bands[b])
+			goto nomem;
+	}
+
+	/* the longitude terms are the same for every row */
+	g.lng = malloc(g.cols * sizeof(double));
+	if (!g.lng)
+		goto nomem;
+
+	for (c = 0; c < g.cols; c++)
+		g.lng[c] = spec->lon0 + c * spec->dlon;
+
+	if (horizontal_observers_init(&g.lngs, NULL, g.lng, g.cols))
+		goto nomem;
+
+	/* all cells share the samples of the day and the position at jd */
+	rst_samples_update(&g.samples, cfg->obj, floor(jd - .5) + .5);
+	object_equ(cfg->obj, jd, &g.equ);
+
+	if (cfg->jobs > 1) {
+		threads = malloc(cfg->jobs * sizeof(pthread_t));
+		if (!threads)
+			goto nomem;
+
+		for (started = 0; started < cfg->jobs - 1; started++) {
+			if (pthread_create(&threads[started], NULL, worker, &g))
+				break;
+		}
+	}
+
+	worker(&g); /* the calling thread helps as well */
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	/* rows are only left over if no worker got its memory */
+	if (g.next_row < g.rows)
+		goto nomem;
+
+	/* a single sequential pass */
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+		goto error;
+	for (b = 0; b < GRID_BANDS; b++) {
+		if (fwrite(g.bands[b], sizeof(double), n, out) != n)
+			goto error;
+	}
+	if (fflush(out))
+		goto error;
+
+	ret = 0;
+	goto out;
+
+nomem:	fprintf(stderr, "Error: failed to allocate grid\n");
+	goto out;
+
+error:	perror("Error: failed to write grid");
+out:	for (b = 0; b < GRID_BANDS; b++)
+		free(g.bands[b]);
+	horizontal_observers_free(&g.lngs);
+	free(g.lng);
+	free(threads);
+
+	return ret;
+}
@@ -0,0 +1,87 @@
+/**
+ * Raster of rise/set/transit times and positions for a geographic grid
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GRID_H_
+#define _GRID_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "batch.h"
+
+#define GRID_MAGIC	"CALCGRID"
+#define GRID_VERSION	1
+#define GRID_BOM	0x01020304 /**< Detects files of a different byte order */
+
+/** Bands of the raster in the order they are written */
+enum grid_band {
+	GRID_RISE,			/**< Unix timestamps, NaN if circumpolar */
+	GRID_SET,
+	GRID_TRANSIT,
+	GRID_AZ,			/**< Azimuth in degrees from north at the given time */
+	GRID_ALT,			/**< Altitude in degrees at the given time */
+	GRID_BANDS
+};
+
+struct grid_spec {
+	double lat0, lat1, dlat;
+	double lon0, lon1, dlon;
+};
+
+/** Header of a raster.
+ *
+ * The header is followed by the bands one after another (band sequential),
+ * each of them rows * cols float64 values in row-major order.
+ * Row r has the latitude lat0 + r * dlat and column c the longitude lon0 + c * dlon.
+ */
+struct grid_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t bom;
+	uint32_t rows, cols;
+	uint32_t bands;
+	uint32_t reserved;
+	double lat0, dlat;
+	double lon0, dlon;
+	double jd;			/**< Julian date of the positions */
+};
+
+/** Parse a grid specification: LAT0:LAT1:DLAT,LON0:LON1:DLON
+ *
+ * @retval 0 on success
+ * @retval -1 on a malformed or empty grid or one with more than 2^28 cells
+ */
+int grid_parse(const char *str, struct grid_spec *spec);
+
+/** Calculate all cells of a grid for the day of jd and write the raster to out.
+ *
+ * All cells share the same samples of the object. The rows are split across cfg->jobs threads.
+ *
+ * @retval 0 on success
+ * @retval -1 on error with a message printed to stderr
+ */
+int grid_run(const struct grid_spec *spec, const struct batch_config *cfg, double jd, FILE *out);
+
+#endif /* _GRID_H_ */
@@ -0,0 +1,296 @@
+/**
+ * Horizontal coordinates for many observers at once
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <libnova/libnova.h>
+
+#include "horizontal.h"
+
+/* Dispatch between AVX2 and the baseline at runtime */
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+  #define TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+  #define TARGET_CLONES
+#endif
+
+/** The horizontal coordinates as a unit vector */
+struct vector {
+	double sin_ra, cos_ra;		/**< Of sidereal time minus right ascension */
+	double sin_dec, cos_dec;
+};
+
+static size_t padded(size_t n)
+{
+	return (n + HORIZONTAL_LANES - 1) / HORIZONTAL_LANES * HORIZONTAL_LANES;
+}
+
+#ifdef __GNUC__
+/* the vectors are never passed to functions outside of this file */
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+/* the helpers must not be called across the AVX2 and baseline clones */
+#define VECTOR_INLINE static inline __attribute__((always_inline))
+
+typedef double vdouble __attribute__((vector_size(HORIZONTAL_LANES * sizeof(double))));
+typedef long long vmask __attribute__((vector_size(HORIZONTAL_LANES * sizeof(double))));
+
+/* Coefficients of the rational approximation of atan() in [-0.2, 0.66] from Cephes */
+#define ATAN_P0	-8.750608600031904122785e-1
+#define ATAN_P1	-1.615753718733365076637e1
+#define ATAN_P2	-7.500855792314704667340e1
+#define ATAN_P3	-1.228866684490136173410e2
+#define ATAN_P4	-6.485021904942025371773e1
+#define ATAN_Q0	 2.485846490142306297962e1
+#define ATAN_Q1	 1.650270098316988542046e2
+#define ATAN_Q2	 4.328810604912902668951e2
+#define ATAN_Q3	 4.853903996359136964868e2
+#define ATAN_Q4	 1.945506571482613964425e2
+#define ATAN_MOREBITS 6.123233995736765886130e-17
+
+VECTOR_INLINE vdouble broadcast(double x)
+{
+	vdouble v;
+	int i;
+
+	for (i = 0; i < HORIZONTAL_LANES; i++)
+		v[i] = x;
+
+	return v;
+}
+
+VECTOR_INLINE vdouble vselect(vmask m, vdouble a, vdouble b)
+{
+	return (vdouble) (((vmask) a & m) | ((vmask) b & ~m));
+}
+
+VECTOR_INLINE vdouble load(const double *p)
+{
+	vdouble v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/** atan() for x in [0, 1] */
+VECTOR_INLINE vdouble vatan01(vdouble x)
+{
+	vmask big = x > broadcast(0.66);
+	vdouble t, z, p, q;
+
+	t = vselect(big, (x - 1) / (x + 1), x);
+	z = t * t;
+
+	p = (((ATAN_P0 * z + ATAN_P1) * z + ATAN_P2) * z + ATAN_P3) * z + ATAN_P4;
+	q = ((((z + ATAN_Q0) * z + ATAN_Q1) * z + ATAN_Q2) * z + ATAN_Q3) * z + ATAN_Q4;
+
+	z = t * (z * p / q) + t;
+
+	return z + vselect(big, broadcast(M_PI_4 + 0.5 * ATAN_MOREBITS), broadcast(0));
+}
+
+VECTOR_INLINE vdouble vatan2(vdouble y, vdouble x)
+{
+	vmask sign = (vmask) broadcast(-0.0);
+	vdouble ax = (vdouble) ((vmask) x & ~sign);
+	vdouble ay = (vdouble) ((vmask) y & ~sign);
+	vmask swap = ay > ax;
+	vdouble num, den, r;
+
+	/* reduce to a ratio in [0, 1] */
+	num = vselect(swap, ax, ay);
+	den = vselect(swap, ay, ax);
+	r = vatan01(vselect(den == broadcast(0), broadcast(0), num / den));
+
+	r = vselect(swap, M_PI_2 - r, r);
+	r = vselect(x < broadcast(0), M_PI - r, r);
+
+	return vselect(y < broadcast(0), -r, r);
+}
+
+TARGET_CLONES
+static void transform(const struct horizontal_observers *o, const struct vector *v, double *az, double *alt)
+{
+	vdouble sin_lat, cos_lat, sin_lng, cos_lng;
+	vdouble sin_h, cos_h, x, y, z, r, a, h;
+	double tmp_az[HORIZONTAL_LANES], tmp_alt[HORIZONTAL_LANES];
+	size_t i, j, n;
+
+	for (i = 0; i < o->n; i += HORIZONTAL_LANES) {
+		sin_lat = load(o->sin_lat + i);
+		cos_lat = load(o->cos_lat + i);
+		sin_lng = load(o->sin_lng + i);
+		cos_lng = load(o->cos_lng + i);
+
+		/* hour angle by the addition theorem: no trigonometry per observer */
+		sin_h = v->sin_ra * cos_lng + v->cos_ra * sin_lng;
+		cos_h = v->cos_ra * cos_lng - v->sin_ra * sin_lng;
+
+		x = cos_h * sin_lat * v->cos_dec - v->sin_dec * cos_lat;
+		y = sin_h * v->cos_dec;
+		z = sin_lat * v->sin_dec + cos_lat * v->cos_dec * cos_h;
+
+		r = x * x + y * y;
+		for (j = 0; j < HORIZONTAL_LANES; j++)
+			r[j] = sqrt(r[j]);
+
+		a = vatan2(y, x) * (180 / M_PI);
+		a = vselect(a < broadcast(0), a + 360, a);
+		h = vatan2(z, r) * (180 / M_PI);
+
+		n = o->n - i;
+		if (n >= HORIZONTAL_LANES) {
+			memcpy(az + i, &a, sizeof(a));
+			memcpy(alt + i, &h, sizeof(h));
+		}
+		else {
+			memcpy(tmp_az, &a, sizeof(a));
+			memcpy(tmp_alt, &h, sizeof(h));
+			memcpy(az + i, tmp_az, n * sizeof(double));
+			memcpy(alt + i, tmp_alt, n * sizeof(double));
+		}
+	}
+}
+#else
+typedef double vdouble[HORIZONTAL_LANES];
+
+static void transform(const struct horizontal_observers *o, const struct vector *v, double *az, double *alt)
+{
+	double sin_h, cos_h, x, y, z;
+	size_t i;
+
+	for (i = 0; i < o->n; i++) {
+		sin_h = v->sin_ra * o->cos_lng[i] + v->cos_ra * o->sin_lng[i];
+		cos_h = v->cos_ra * o->cos_lng[i] - v->sin_ra * o->sin_lng[i];
+
+		x = cos_h * o->sin_lat[i] * v->cos_dec - v->sin_dec * o->cos_lat[i];
+		y = sin_h * v->cos_dec;
+		z = o->sin_lat[i] * v->sin_dec + o->cos_lat[i] * v->cos_dec * cos_h;
+
+		az[i] = ln_range_degrees(atan2(y, x) * (180 / M_PI));
+		alt[i] = atan2(z, sqrt(x * x + y * y)) * (180 / M_PI);
+	}
+}
+#endif
+
+int horizontal_observers_init(struct horizontal_observers *o, const double *lat, const double *lng, size_t n)
+{
+	size_t i, size = padded(n) * sizeof(double);
+
+	memset(o, 0, sizeof(*o));
+	o->n = n;
+
+	if (posix_memalign((void **) &o->sin_lat, sizeof(vdouble), size) ||
+	    posix_memalign((void **) &o->cos_lat, sizeof(vdouble), size) ||
+	    posix_memalign((void **) &o->sin_lng, sizeof(vdouble), size) ||
+	    posix_memalign((void **) &o->cos_lng, sizeof(vdouble), size)) {
+		horizontal_observers_free(o);
+		return -1;
+	}
+
+	for (i = 0; i < padded(n); i++) {
+		double phi = i < n && lat ? ln_deg_to_rad(lat[i]) : 0;
+		double lambda = i < n ? ln_deg_to_rad(lng[i]) : 0;
+
+		o->sin_lat[i] = sin(phi);
+		o->cos_lat[i] = cos(phi);
+		o->sin_lng[i] = sin(lambda);
+		o->cos_lng[i] = cos(lambda);
+	}
+
+	return 0;
+}
+
+int horizontal_observers_share(struct horizontal_observers *o, const struct horizontal_observers *lngs)
+{
+	size_t size = padded(lngs->n) * sizeof(double);
+
+	memset(o, 0, sizeof(*o));
+	o->n = lngs->n;
+	o->sin_lng = lngs->sin_lng;
+	o->cos_lng = lngs->cos_lng;
+	o->shared = true;
+
+	if (posix_memalign((void **) &o->sin_lat, sizeof(vdouble), size) ||
+	    posix_memalign((void **) &o->cos_lat, sizeof(vdouble), size)) {
+		horizontal_observers_free(o);
+		return -1;
+	}
+
+	return 0;
+}
+
+void horizontal_observers_lat(struct horizontal_observers *o, double lat)
+{
+	double sin_lat = sin(ln_deg_to_rad(lat));
+	double cos_lat = cos(ln_deg_to_rad(lat));
+	size_t i;
+
+	for (i = 0; i < padded(o->n); i++) {
+		o->sin_lat[i] = sin_lat;
+		o->cos_lat[i] = cos_lat;
+	}
+}
+
+void horizontal_observers_free(struct horizontal_observers *o)
+{
+	free(o->sin_lat);
+	free(o->cos_lat);
+	if (!o->shared) {
+		free(o->sin_lng);
+		free(o->cos_lng);
+	}
+
+	memset(o, 0, sizeof(*o));
+}
+
+void horizontal_batch(const struct horizontal_observers *o, const struct ln_equ_posn *equ, double jd,
+	double *az, double *alt, const char **azidir)
+{
+	struct ln_hrz_posn hrz;
+	struct vector v;
+	double ha;
+	size_t i;
+
+	/* same as ln_get_hrz_from_equ(), but only once for all observers */
+	ha = ln_deg_to_rad(ln_get_mean_sidereal_time(jd) * 15 - equ->ra);
+
+	v.sin_ra = sin(ha);
+	v.cos_ra = cos(ha);
+	v.sin_dec = sin(ln_deg_to_rad(equ->dec));
+	v.cos_dec = cos(ln_deg_to_rad(equ->dec));
+
+	transform(o, &v, az, alt);
+
+	if (azidir) {
+		for (i = 0; i < o->n; i++) {
+			hrz.az = az[i];
+			hrz.alt = alt[i];
+			azidir[i] = ln_hrz_to_nswe(&hrz);
+		}
+	}
+}
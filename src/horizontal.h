@@ -0,0 +1,88 @@
+/**
+ * Horizontal coordinates for many observers at once
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HORIZONTAL_H_
+#define _HORIZONTAL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <libnova/libnova.h>
+
+#define HORIZONTAL_LANES	4	/**< Observers processed per SIMD iteration */
+
+/** Maximum deviation from ln_get_hrz_from_equ() in degrees.
+ *
+ * Holds for the altitude everywhere and for the azimuth unless the object
+ * is within 1e-6 degrees of the zenith or nadir, where the azimuth is undefined.
+ */
+#define HORIZONTAL_TOLERANCE	1e-9
+
+/** Observers in structure-of-arrays layout.
+ *
+ * The trigonometric functions of the coordinates are evaluated once in
+ * horizontal_observers_init(). All arrays are padded to a multiple of HORIZONTAL_LANES.
+ */
+struct horizontal_observers {
+	size_t n;
+	double *sin_lat, *cos_lat;
+	double *sin_lng, *cos_lng;
+	bool shared;			/**< The longitude terms belong to another set */
+};
+
+/** Prepare a set of observers from their latitudes and longitudes in degrees
+ *
+ * @param lat NULL for observers on the equator
+ * @retval 0 on success
+ * @retval -1 if out of memory
+ */
+int horizontal_observers_init(struct horizontal_observers *o, const double *lat, const double *lng, size_t n);
+
+/** Prepare a set of observers on a common latitude, e.g. a row of a grid.
+ *
+ * Only the latitude terms are allocated. The longitude terms of lngs are
+ * used read-only, so several threads may share them. lngs has to outlive o.
+ *
+ * @retval 0 on success
+ * @retval -1 if out of memory
+ */
+int horizontal_observers_share(struct horizontal_observers *o, const struct horizontal_observers *lngs);
+
+/** Move all observers of a set to the same latitude in degrees */
+void horizontal_observers_lat(struct horizontal_observers *o, double lat);
+
+void horizontal_observers_free(struct horizontal_observers *o);
+
+/** Transform a single equatorial position into horizontal coordinates for all observers.
+ *
+ * Uses the same conventions as ln_get_hrz_from_equ(): the mean sidereal time
+ * and an azimuth measured westwards from south in [0, 360).
+ *
+ * @param az, alt Arrays of o->n elements in degrees
+ * @param azidir NULL or an array of o->n elements for ln_hrz_to_nswe()
+ */
+void horizontal_batch(const struct horizontal_observers *o, const struct ln_equ_posn *equ, double jd,
+	double *az, double *alt, const char **azidir);
+
+#endif /* _HORIZONTAL_H_ */
@@ -23,32 +23,193 @@
  * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "objects.h"
+#include "ephemeris.h"
+#include "rst.h"
+#include "solar.h"
+#include "stats.h"
+
+/** Rise/set/transit search state of the current thread */
+static __thread struct {
+	struct rst_samples samples;
+
+	struct ln_lnlat_posn obs;
+	double horizon;
+	int ret;
+	struct ln_rst_time rst;		/**< Starting estimate for the following day */
+} last;
 
 static struct object {
 	const char *name;
 	void (*equ_coords)(double JD, struct ln_equ_posn *position);
 	double (*earth_dist)(double JD);
 	double (*sdiam)(double JD);
+
+	double window;			/**< Interpolation window in days */
+	struct ephemeris *cache;	/**< Only set if interpolation is enabled */
 } objects[] = {
-	{ "sun",     ln_get_solar_equ_coords,   ln_get_earth_solar_dist,   ln_get_solar_sdiam       },
-	{ "moon",    ln_get_lunar_equ_coords,   ln_get_lunar_earth_dist,   ln_get_lunar_sdiam       },
-	{ "mars",    ln_get_mars_equ_coords,    ln_get_mars_earth_dist,    ln_get_mars_sdiam        },
-	{ "neptune", ln_get_neptune_equ_coords, ln_get_neptune_earth_dist, ln_get_neptune_sdiam     },
-	{ "jupiter", ln_get_jupiter_equ_coords, ln_get_jupiter_earth_dist, ln_get_jupiter_equ_sdiam },
-	{ "mercury", ln_get_mercury_equ_coords, ln_get_mercury_earth_dist, ln_get_mercury_sdiam     },
-	{ "uranus",  ln_get_uranus_equ_coords,  ln_get_uranus_earth_dist,  ln_get_uranus_sdiam      },
-	{ "saturn",  ln_get_saturn_equ_coords,  ln_get_saturn_earth_dist,  ln_get_saturn_equ_sdiam  },
-	{ "venus",   ln_get_venus_equ_coords,   ln_get_venus_earth_dist,   ln_get_venus_sdiam       },
-	{ "pluto",   ln_get_pluto_equ_coords,   ln_get_pluto_earth_dist,   ln_get_pluto_sdiam       }
+	{ "sun",     ln_get_solar_equ_coords,   ln_get_earth_solar_dist,   ln_get_solar_sdiam,       32 },
+	{ "moon",    ln_get_lunar_equ_coords,   ln_get_lunar_earth_dist,   ln_get_lunar_sdiam,        4 },
+	{ "mars",    ln_get_mars_equ_coords,    ln_get_mars_earth_dist,    ln_get_mars_sdiam,        16 },
+	{ "neptune", ln_get_neptune_equ_coords, ln_get_neptune_earth_dist, ln_get_neptune_sdiam,     32 },
+	{ "jupiter", ln_get_jupiter_equ_coords, ln_get_jupiter_earth_dist, ln_get_jupiter_equ_sdiam, 32 },
+	{ "mercury", ln_get_mercury_equ_coords, ln_get_mercury_earth_dist, ln_get_mercury_sdiam,      8 },
+	{ "uranus",  ln_get_uranus_equ_coords,  ln_get_uranus_earth_dist,  ln_get_uranus_sdiam,      32 },
+	{ "saturn",  ln_get_saturn_equ_coords,  ln_get_saturn_earth_dist,  ln_get_saturn_equ_sdiam,  32 },
+	{ "venus",   ln_get_venus_equ_coords,   ln_get_venus_earth_dist,   ln_get_venus_sdiam,       16 },
+	{ "pluto",   ln_get_pluto_equ_coords,   ln_get_pluto_earth_dist,   ln_get_pluto_sdiam,       32 }
+};
+
+#define NUM_OBJECTS (sizeof(objects) / sizeof(objects[0]))
+
+/* libnova keeps the nutation and the position of the Earth of the last date
+ * in static variables without any locking. So all threads take turns. */
+static pthread_mutex_t series_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Evaluate the series of an object, any of the outputs might be NULL */
+static void series(const void *arg, double jd, struct ln_equ_posn *equ, double *dist, double *sdiam)
+{
+	const struct object *o = arg;
+
+	stats_object(o - objects, o->name);
+
+	pthread_mutex_lock(&series_lock);
+
+	if (equ)
+		o->equ_coords(jd, equ);
+	if (dist)
+		*dist = o->earth_dist(jd);
+	if (sdiam)
+		*sdiam = o->sdiam(jd);
+
+	pthread_mutex_unlock(&series_lock);
+}
+
+double object_sidereal_time(double jd)
+{
+	double theta;
+
+	pthread_mutex_lock(&series_lock);
+	theta = ln_get_apparent_sidereal_time(jd) * 15;
+	pthread_mutex_unlock(&series_lock);
+
+	return theta;
+}
+
+static const struct {
+	const char *name;
+	double horizon;
+} twilights[] = {
+	[TWILIGHT_CIVIL]	= { "civil",        LN_SOLAR_CIVIL_HORIZON },
+	[TWILIGHT_NAUTIC]	= { "nautic",       LN_SOLAR_NAUTIC_HORIZON },
+	[TWILIGHT_ASTRONOMICAL]	= { "astronomical", LN_SOLAR_ASTRONOMICAL_HORIZON }
 };
 
+int object_parse_precision(const char *str, enum object_precision *precision)
+{
+	if      (strcmp(str, "standard") == 0)
+		*precision = PRECISION_STANDARD;
+	else if (strcmp(str, "fast") == 0)
+		*precision = PRECISION_FAST;
+	else
+		return -1;
+
+	return 0;
+}
+
+void object_set_precision(enum object_precision precision)
+{
+	struct object *sun = &objects[0];
+
+	if (precision == PRECISION_FAST) {
+		sun->equ_coords = solar_equ_coords;
+		sun->earth_dist = solar_earth_dist;
+		sun->sdiam = solar_sdiam;
+	}
+	else {
+		sun->equ_coords = ln_get_solar_equ_coords;
+		sun->earth_dist = ln_get_earth_solar_dist;
+		sun->sdiam = ln_get_solar_sdiam;
+	}
+}
+
+int object_interpolate(double tolerance)
+{
+	int c;
+
+	for (c = 0; c < NUM_OBJECTS; c++) {
+		struct object *o = &objects[c];
+
+		o->cache = ephemeris_create(series, o, o->window, tolerance);
+		if (!o->cache)
+			return -1;
+	}
+
+	return 0;
+}
+
+int object_build_ephemeris(const char *filename, double first_jd, double last_jd, double tolerance, long *failed)
+{
+	struct ephemeris *e[NUM_OBJECTS];
+	const char *names[NUM_OBJECTS];
+	int c, ret = -1;
+
+	for (c = 0; c < NUM_OBJECTS; c++) {
+		struct object *o = &objects[c];
+
+		names[c] = o->name;
+		e[c] = ephemeris_create(series, o, o->window, tolerance);
+		if (!e[c]) {
+			errno = ENOMEM;
+			goto out;
+		}
+	}
+
+	ret = ephemeris_build(filename, e, names, NUM_OBJECTS, first_jd, last_jd, failed);
+
+out:	while (c--)
+		ephemeris_free(e[c]);
+
+	return ret;
+}
+
+int object_map_ephemeris(const char *filename)
+{
+	struct ephemeris *e[NUM_OBJECTS];
+	const char *names[NUM_OBJECTS];
+	int c;
+
+	for (c = 0; c < NUM_OBJECTS; c++) {
+		struct object *o = &objects[c];
+
+		/* without --interpolate, dates outside of the file use the series */
+		if (!o->cache)
+			o->cache = ephemeris_create(series, o, o->window, 0);
+		if (!o->cache) {
+			errno = ENOMEM;
+			return -1;
+		}
+
+		names[c] = o->name;
+		e[c] = o->cache;
+	}
+
+	return ephemeris_map(filename, e, names, NUM_OBJECTS);
+}
+
 const struct object * object_lookup(const char *name)
 {
 	int c;
-	for (c = 0; c <= sizeof(objects) / sizeof(objects[0]); c++) {
+	for (c = 0; c < NUM_OBJECTS; c++) {
 		if (strcmp(objects[c].name, name) == 0)
 			return &objects[c];
 	}
@@ -56,20 +217,295 @@ const struct object * object_lookup(const char *name)
 	return NULL;
 }
 
+int object_parse_list(const char *str, const struct object **objs, int max)
+{
+	char name[32];
+	const char *end;
+	int n = 0, c;
+
+	if (strcmp(str, "all") == 0) {
+		if (NUM_OBJECTS > max)
+			return -1;
+
+		for (c = 0; c < NUM_OBJECTS; c++)
+			objs[c] = &objects[c];
+
+		return NUM_OBJECTS;
+	}
+
+	do {
+		end = str + strcspn(str, ",");
+		if (n == max || (size_t) (end - str) >= sizeof(name))
+			return -1;
+
+		memcpy(name, str, end - str);
+		name[end - str] = '\0';
+
+		objs[n] = object_lookup(name);
+		if (!objs[n++])
+			return -1;
+
+		str = end + 1;
+	} while (*end);
+
+	return n;
+}
+
+int object_parse_moment(const char *str, enum object_moment *moment)
+{
+	if      (strcmp(str, "now") == 0)
+		*moment = MOMENT_NOW;
+	else if (strcmp(str, "rise") == 0)
+		*moment = MOMENT_RISE;
+	else if (strcmp(str, "set") == 0)
+		*moment = MOMENT_SET;
+	else if (strcmp(str, "transit") == 0)
+		*moment = MOMENT_TRANSIT;
+	else
+		return -1;
+
+	return 0;
+}
+
+/** Index of a twilight in twilights[] or -1 */
+static int lookup_twilight(const char *name)
+{
+	int i;
+
+	for (i = 0; i < TWILIGHTS; i++) {
+		if (strcmp(twilights[i].name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+int object_parse_horizon(const char *str, double *horizon)
+{
+	char *endptr;
+	int i = lookup_twilight(str);
+
+	if (i >= 0)
+		*horizon = twilights[i].horizon;
+	else if (strcmp(str, "standard") == 0)
+		*horizon = LN_SOLAR_STANDART_HORIZON;
+	else {
+		*horizon = strtod(str, &endptr);
+		if (endptr == str)
+			return -1;
+	}
+
+	return 0;
+}
+
+int object_parse_horizons(const char *str, double *horizon, unsigned *mask)
+{
+	char name[32];
+	const char *end;
+	int i, n;
+
+	*mask = 0;
+
+	if (strcmp(str, "all") == 0) {
+		*horizon = LN_SOLAR_STANDART_HORIZON;
+		*mask = (1 << TWILIGHTS) - 1;
+		return 0;
+	}
+
+	for (n = 0; ; n++) {
+		end = str + strcspn(str, ",");
+		if ((size_t) (end - str) >= sizeof(name))
+			return -1;
+
+		memcpy(name, str, end - str);
+		name[end - str] = '\0';
+
+		i = lookup_twilight(name);
+		if (i >= 0)
+			*mask |= 1 << i;
+
+		/* only twilights have tokens, further horizons would be in vain */
+		if (n == 0 ? object_parse_horizon(name, horizon) : i < 0)
+			return -1;
+
+		if (!*end)
+			return 0;
+
+		str = end + 1;
+	}
+}
+
 const char * object_name(const struct object *o)
 {
 	return o->name;
 }
 
+void object_equ(const struct object *o, double jd, struct ln_equ_posn *equ)
+{
+	if (o->cache)
+		ephemeris_get(o->cache, jd, equ, NULL, NULL);
+	else
+		series(o, jd, equ, NULL, NULL);
+}
+
 void object_pos(const struct object *o, double jd, struct object_details *details)
 {
-	o->equ_coords(jd, &details->equ);
+	uint64_t start = stats_begin();
+
+	details->object = o->name;
+
+	if (o->cache)
+		ephemeris_get(o->cache, jd, &details->equ, &details->distance, &details->diameter);
+	else
+		series(o, jd, &details->equ, &details->distance, &details->diameter);
 
-	details->distance = o->earth_dist(jd);
-	details->diameter = o->sdiam(jd);
+	stats_end(STATS_POS, start);
 }
 
 int object_rst(const struct object *o, double jd, double horizon, struct ln_lnlat_posn *obs, struct ln_rst_time *rst)
 {
-	return ln_get_body_rst_horizon(jd, obs, o->equ_coords, horizon, rst);
-}
\ No newline at end of file
+	double jd_ut = floor(jd) + 0.5; /* 0h UT */
+	uint64_t start = stats_begin();
+	bool consecutive;
+
+	consecutive = last.samples.obj == o && last.samples.jd + 1 == jd_ut && last.ret == 0 &&
+		last.horizon == horizon && last.obs.lat == obs->lat && last.obs.lng == obs->lng;
+
+	rst_samples_update(&last.samples, o, jd_ut);
+
+	last.ret = rst_solve(&last.samples, obs, horizon, consecutive ? &last.rst : NULL, rst);
+	last.obs = *obs;
+	last.horizon = horizon;
+	last.rst = *rst;
+
+	stats_end(STATS_RST, start);
+
+	return last.ret;
+}
+
+/** Solve the twilights of details from the positions of the rise/set search */
+static void solve_twilights(const struct rst_samples *s, struct object_details *details)
+{
+	struct ln_rst_time rst;
+	uint64_t start;
+	int i;
+
+	for (i = 0; i < TWILIGHTS; i++)
+		details->twilight[i].dawn = details->twilight[i].dusk = NAN;
+
+	if (!details->twilights)
+		return;
+
+	start = stats_begin();
+
+	for (i = 0; i < TWILIGHTS; i++) {
+		if ((details->twilights & (1 << i)) && !rst_solve(s, &details->obs, twilights[i].horizon, NULL, &rst)) {
+			details->twilight[i].dawn = rst.rise;
+			details->twilight[i].dusk = rst.set;
+		}
+	}
+
+	stats_end(STATS_RST, start);
+}
+
+int object_calc(const struct object *o, double jd, enum object_moment moment, bool next, double horizon, struct object_details *details)
+{
+	int ret;
+
+rst:	ret = object_rst(o, jd - .5, horizon, &details->obs, &details->rst);
+	if (ret) {
+		if (moment != MOMENT_NOW)
+			return ret;
+
+		details->rst.rise = details->rst.set = details->rst.transit = NAN;
+
+		details->jd = jd;
+	}
+	else {
+		switch (moment) {
+			case MOMENT_NOW:	details->jd = jd; break;
+			case MOMENT_RISE:	details->jd = details->rst.rise; break;
+			case MOMENT_SET:	details->jd = details->rst.set; break;
+			case MOMENT_TRANSIT:	details->jd = details->rst.transit; break;
+		}
+
+		if (next && details->jd < jd) {
+			jd++;
+			next = false;
+			goto rst;
+		}
+	}
+
+	solve_twilights(&last.samples, details);
+	object_pos(o, details->jd, details);
+
+	return 0;
+}
+
+void object_calc_many(const struct object **objs, int n, double jd, enum object_moment moment, bool next, double horizon, struct object_details *details, int *ret)
+{
+	struct rst_samples samples[OBJECTS_MAX];
+	bool fallback[OBJECTS_MAX] = { false };
+	double jd_ut = floor(jd - .5) + .5, theta; /* 0h UT, like object_calc() */
+	uint64_t start = stats_begin();
+	int i, k;
+
+	/* the samples of rst_samples_update(), but all objects per date */
+	for (i = 0; i < 3; i++) {
+		for (k = 0; k < n; k++)
+			object_equ(objs[k], jd_ut + i - 1, &samples[k].pos[i]);
+	}
+
+	theta = object_sidereal_time(jd_ut);
+
+	for (k = 0; k < n; k++) {
+		samples[k].obj = objs[k];
+		samples[k].jd = jd_ut;
+		samples[k].sidereal = theta;
+
+		ret[k] = rst_solve(&samples[k], &details[k].obs, horizon, NULL, &details[k].rst);
+		if (ret[k])
+			details[k].rst.rise = details[k].rst.set = details[k].rst.transit = NAN;
+
+		solve_twilights(&samples[k], &details[k]);
+
+		if (ret[k] || moment == MOMENT_NOW) {
+			details[k].jd = jd;
+			continue;
+		}
+
+		switch (moment) {
+			case MOMENT_NOW:	break;
+			case MOMENT_RISE:	details[k].jd = details[k].rst.rise; break;
+			case MOMENT_SET:	details[k].jd = details[k].rst.set; break;
+			case MOMENT_TRANSIT:	details[k].jd = details[k].rst.transit; break;
+		}
+
+		/* rare, the following day is searched on its own */
+		fallback[k] = next && details[k].jd < jd;
+	}
+
+	stats_end(STATS_RST, start);
+
+	/* object_calc() records its own rst and position timings */
+	for (k = 0; k < n; k++) {
+		if (fallback[k])
+			ret[k] = object_calc(objs[k], jd + 1, moment, false, horizon, &details[k]);
+	}
+
+	/* objects observed at the same instant share the date again */
+	for (k = 0; k < n; k++) {
+		if (!fallback[k] && (moment == MOMENT_NOW || !ret[k]))
+			object_pos(objs[k], details[k].jd, &details[k]);
+	}
+}
+
+void object_localtime(struct object_details *details)
+{
+	time_t t;
+
+	ln_get_timet_from_julian(details->jd, &t);
+	localtime_r(&t, &details->tm);
+
+	details->timestamp = (details->jd - 2440587.5) * 86400;
+}
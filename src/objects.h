@@ -27,30 +27,177 @@
 #define _OBJECTS_H_
 
 #include <time.h>
+#include <stdbool.h>
 #include <libnova/libnova.h>
 
+#define EXIT_CIRCUMPOLAR 2
+#define OBJECTS_MAX	16	/**< Maximum number of objects in a list */
+
 
 struct object;
 
+enum object_moment {
+	MOMENT_NOW,
+	MOMENT_RISE,
+	MOMENT_SET,
+	MOMENT_TRANSIT
+};
+
+enum object_precision {
+	PRECISION_STANDARD,		/**< Series of libnova */
+	PRECISION_FAST			/**< Closed form for the sun, see solar.h */
+};
+
+enum object_twilight {
+	TWILIGHT_CIVIL,
+	TWILIGHT_NAUTIC,
+	TWILIGHT_ASTRONOMICAL,
+	TWILIGHTS
+};
+
 struct object_details {
 	double jd;			/**< Julian date of observation */
 	struct tm tm;			/**< Broken down representation of observation */
+	double timestamp;		/**< Unix time of observation with fractions of a second */
 	
 	double diameter;		/**< In arc seconds */
 	double distance;		/**< In AU (astronomical unit) */
 
 	struct ln_lnlat_posn obs;	/**< Observer position */
-	struct ln_rst_time rst;		/**< Rise/set/transit time in JD */
+	struct ln_rst_time rst;		/**< Rise/set/transit time in JD, NaN if circumpolar */
+
+	unsigned twilights;		/**< Bitmask of twilights to calculate as well */
+	struct {
+		double dawn, dusk;	/**< In JD, NaN if not calculated or not reached */
+	} twilight[TWILIGHTS];
 
 	struct ln_equ_posn equ;
 	struct ln_hrz_posn hrz;
 	const char *azidir;		/**< Direction of azimuth - like N,S,W,E,NW,.. */
+	const char *object;		/**< Name of the object */
+	const char *event;		/**< Crossing found by a search: rise or set, NULL otherwise */
+	double deviation;		/**< From the azimuth of an alignment search in degrees */
 };
 
 const struct object * object_lookup(const char *name);
+
+/** Parse a comma separated list of objects or all
+ *
+ * @return The number of objects or -1 on an unknown object or too many of them
+ */
+int object_parse_list(const char *str, const struct object **objs, int max);
+
+/** Parse a moment: now, rise, set or transit
+ *
+ * @retval 0 on success
+ * @retval -1 on an unknown moment
+ */
+int object_parse_moment(const char *str, enum object_moment *moment);
+
+/** Parse a horizon in degrees or a twilight: civil, nautic or astronomical
+ *
+ * @retval 0 on success
+ * @retval -1 on an invalid horizon
+ */
+int object_parse_horizon(const char *str, double *horizon);
+
+/** Parse a comma separated list of horizons or all
+ *
+ * The first one is the horizon of the moment. Twilights anywhere in the
+ * list are calculated as well from the same positions.
+ *
+ * @param twilights Receives a bitmask of the twilights in the list
+ * @retval 0 on success
+ * @retval -1 on an invalid horizon
+ */
+int object_parse_horizons(const char *str, double *horizon, unsigned *twilights);
+
+/** Parse a precision: fast or standard
+ *
+ * @retval 0 on success
+ * @retval -1 on an unknown precision
+ */
+int object_parse_precision(const char *str, enum object_precision *precision);
+
+/** Select the algorithm for the position of the sun.
+ *
+ * Has to be called before object_interpolate() and any calculation.
+ */
+void object_set_precision(enum object_precision precision);
+
+/** Replace the series of all objects by Chebyshev interpolation.
+ *
+ * @param tolerance Maximum approximation error in arc seconds
+ * @retval 0 on success
+ * @retval -1 if out of memory
+ */
+int object_interpolate(double tolerance);
+
+/** Write Chebyshev coefficients of all objects between first_jd and last_jd into a file.
+ *
+ * @param tolerance Maximum approximation error in arc seconds
+ * @param failed Receives the number of windows which exceed the tolerance and use the series
+ * @retval -1 on error with errno set
+ */
+int object_build_ephemeris(const char *filename, double first_jd, double last_jd, double tolerance, long *failed);
+
+/** Serve positions from a precomputed ephemeris file instead of the series.
+ *
+ * Can be combined with object_interpolate(), which must be called first.
+ *
+ * @retval -1 on error with errno set, see ephemeris_map()
+ */
+int object_map_ephemeris(const char *filename);
 const char * object_name(const struct object *o);
 
+/** Apparent sidereal time at jd in degrees.
+ *
+ * Like the series, the nutation behind it may be called from several threads.
+ */
+double object_sidereal_time(double jd);
+
+/** Get the equatorial position only (uses the interpolation cache if enabled) */
+void object_equ(const struct object *o, double jd, struct ln_equ_posn *equ);
 void object_pos(const struct object *o, double jd, struct object_details *details);
+
+/** Calculate rise/set/transit times for the day of jd.
+ *
+ * Consecutive days searched by the same thread reuse two of the three
+ * positions and start from the results of the previous day.
+ */
 int object_rst(const struct object *o, double jd, double horizon, struct ln_lnlat_posn *obs, struct ln_rst_time *rst);
 
+/** Calculate rise/set/transit and position of an object at a given moment.
+ *
+ * The observer has to be set in details->obs before calling and the
+ * twilights to calculate from the same positions in details->twilights.
+ * This function does not depend on the timezone and may be called from several
+ * threads. Their evaluations of the series of libnova take turns, as libnova
+ * caches intermediate results in static variables.
+ * Use object_localtime() afterwards to fill details->tm.
+ *
+ * @param jd Julian date of the observation
+ * @param next Use the moment of the following day if it already passed at jd
+ * @retval 0 on success
+ * @retval 1 or -1 if the object is circumpolar (above or below the horizon)
+ */
+int object_calc(const struct object *o, double jd, enum object_moment moment, bool next, double horizon, struct object_details *details);
+
+/** Calculate several objects for the same instant and observer like object_calc().
+ *
+ * The positions are evaluated date by date for all objects instead of object
+ * by object. libnova keeps the position of the Earth and the nutation of the
+ * last date it was asked for, so they are calculated once per date.
+ *
+ * The observer and twilights have to be set in details[i] of every object.
+ *
+ * @param ret Receives the result of the rise/set/transit search of every
+ *            object, see object_rst(). Positions are only calculated for
+ *            circumpolar objects if moment is MOMENT_NOW.
+ */
+void object_calc_many(const struct object **objs, int n, double jd, enum object_moment moment, bool next, double horizon, struct object_details *details, int *ret);
+
+/** Convert the julian date of details into broken down local time and a Unix timestamp */
+void object_localtime(struct object_details *details);
+
 #endif /* _OBJECTS_H_ */
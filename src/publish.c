@@ -0,0 +1,179 @@
+/**
+ * Publish the state of objects in shared memory
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <libnova/libnova.h>
+
+#include "publish.h"
+#include "calcelestial_shm.h"
+
+#define JD_UNIX_EPOCH	2440587.5
+
+static volatile sig_atomic_t stop;
+
+static void quit(int sig)
+{
+	stop = 1;
+}
+
+/** The first of two events which has not passed yet */
+static double next_event(double today, double tomorrow, const int ret[2], double jd)
+{
+	if (!ret[0] && today >= jd)
+		return today;
+	if (!ret[1] && tomorrow >= jd)
+		return tomorrow;
+
+	return NAN;
+}
+
+/** Search the next rise, set and transit, the results are valid until the returned date */
+static double events(const struct object *obj, double jd, double horizon, struct ln_lnlat_posn *obs, struct calcelestial_shm_object *o)
+{
+	struct ln_rst_time rst[2];
+	double until = floor(jd - .5) + 1.5; /* the next day starts at 0h UT */
+	int ret[2];
+
+	/* consecutive days reuse the positions of the search */
+	ret[0] = object_rst(obj, jd - .5, horizon, obs, &rst[0]);
+	ret[1] = object_rst(obj, jd + .5, horizon, obs, &rst[1]);
+
+	o->circumpolar = ret[0];
+	o->rise = next_event(rst[0].rise, rst[1].rise, ret, jd);
+	o->set = next_event(rst[0].set, rst[1].set, ret, jd);
+	o->transit = next_event(rst[0].transit, rst[1].transit, ret, jd);
+
+	/* fmin() ignores NaN */
+	return fmin(until, fmin(o->rise, fmin(o->set, o->transit)));
+}
+
+/** Copy the state into the segment under the seqlock */
+static void publish(struct calcelestial_shm *shm, const struct calcelestial_shm_object *objs, int n)
+{
+	/* odd while writing, also if a previous publisher died while writing */
+	uint32_t seq = (shm->seq + 1) | 1;
+
+	__atomic_store_n(&shm->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(shm->objects, objs, n * sizeof(objs[0]));
+	shm->count = n;
+
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+int publish_run(const char *name, const struct object **objs, int n, struct ln_lnlat_posn obs, double horizon)
+{
+	struct sigaction sa = { .sa_handler = quit };
+	struct calcelestial_shm *shm;
+	struct calcelestial_shm_object state[CALCELESTIAL_SHM_OBJECTS];
+	struct object_details details;
+	struct ln_hrz_posn hrz;
+	double until[CALCELESTIAL_SHM_OBJECTS];
+	struct timespec ts = { 0 };
+	double jd;
+	int i, fd;
+
+	if (n > CALCELESTIAL_SHM_OBJECTS)
+		n = CALCELESTIAL_SHM_OBJECTS;
+
+	fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(*shm))) {
+		fprintf(stderr, "Error: failed to create shared memory: %s\n", name);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		fprintf(stderr, "Error: failed to map shared memory: %s\n", name);
+		return -1;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	memset(state, 0, sizeof(state));
+	for (i = 0; i < n; i++) {
+		snprintf(state[i].name, sizeof(state[i].name), "%s", object_name(objs[i]));
+		until[i] = 0;
+	}
+
+	shm->version = CALCELESTIAL_SHM_VERSION;
+	shm->lat = obs.lat;
+	shm->lng = obs.lng;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec = 0;
+
+	while (!stop) {
+		jd = JD_UNIX_EPOCH + ts.tv_sec / 86400.0;
+
+		for (i = 0; i < n; i++) {
+			if (jd >= until[i])
+				until[i] = events(objs[i], jd, horizon, &obs, &state[i]);
+
+			/* positions at the same date share the terms of the Earth */
+			object_pos(objs[i], jd, &details);
+			ln_get_hrz_from_equ(&details.equ, &obs, jd, &hrz);
+
+			state[i].jd = jd;
+			state[i].ra = details.equ.ra;
+			state[i].dec = details.equ.dec;
+			state[i].az = ln_range_degrees(hrz.az + 180);
+			state[i].alt = hrz.alt;
+			state[i].distance = details.distance;
+			state[i].diameter = details.diameter;
+			snprintf(state[i].azidir, sizeof(state[i].azidir), "%s", ln_hrz_to_nswe(&hrz));
+		}
+
+		publish(shm, state, n);
+
+		/* readers accept the segment once the first state is complete */
+		__atomic_store_n(&shm->magic, CALCELESTIAL_SHM_MAGIC, __ATOMIC_RELEASE);
+
+		/* absolute deadlines on full seconds do not drift */
+		ts.tv_sec++;
+		while (!stop && clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL))
+			; /* interrupted by a signal */
+	}
+
+	shm_unlink(name);
+	munmap(shm, sizeof(*shm));
+
+	return 0;
+}
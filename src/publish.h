@@ -0,0 +1,47 @@
+/**
+ * Publish the state of objects in shared memory
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _PUBLISH_H_
+#define _PUBLISH_H_
+
+#include <libnova/libnova.h>
+
+#include "objects.h"
+
+/** Keep the state of objects in a POSIX shared memory segment up to date until SIGINT or SIGTERM.
+ *
+ * The positions are updated every second, the next rise, set and transit
+ * only after one of them has passed or the day has changed. Updates are
+ * guarded by a seqlock, see calcelestial_shm.h for the reader. The segment
+ * is removed on shutdown.
+ *
+ * @param name Name of the segment like /calcelestial
+ * @retval 0 on a clean shutdown
+ * @retval -1 if the segment could not be created
+ */
+int publish_run(const char *name, const struct object **objs, int n, struct ln_lnlat_posn obs, double horizon);
+
+#endif /* _PUBLISH_H_ */
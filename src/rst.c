@@ -0,0 +1,158 @@
+/**
+ * Incremental rise, set and transit search
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <libnova/libnova.h>
+
+#include "rst.h"
+#include "objects.h"
+
+#define RST_MAX_ITERATIONS	10
+#define RST_EPSILON		1e-7	/**< Convergence limit in days (~ 10 ms) */
+
+/** Normalize an angle in degrees to [-180, 180) */
+static double range_half(double a)
+{
+	return a - 360 * floor((a + 180) / 360);
+}
+
+/** Normalize a fraction of a day to [0, 1) */
+static double range_day(double m)
+{
+	return m - floor(m);
+}
+
+int rst_samples_update(struct rst_samples *s, const struct object *obj, double jd_ut)
+{
+	int i, evals = 0;
+
+	if (s->obj == obj && s->jd == jd_ut)
+		return 0;
+
+	if (s->obj == obj && s->jd + 1 == jd_ut) {
+		s->pos[0] = s->pos[1];
+		s->pos[1] = s->pos[2];
+		object_equ(obj, jd_ut + 1, &s->pos[2]);
+		evals = 1;
+	}
+	else if (s->obj == obj && s->jd - 1 == jd_ut) {
+		s->pos[2] = s->pos[1];
+		s->pos[1] = s->pos[0];
+		object_equ(obj, jd_ut - 1, &s->pos[0]);
+		evals = 1;
+	}
+	else {
+		for (i = 0; i < 3; i++)
+			object_equ(obj, jd_ut + i - 1, &s->pos[i]);
+		evals = 3;
+	}
+
+	s->obj = obj;
+	s->jd = jd_ut;
+	s->sidereal = object_sidereal_time(jd_ut);
+
+	return evals;
+}
+
+/** Refine the time of transit (event == 0) or of the horizon crossing */
+static double solve_event(double m, int event, double O, double dT, const double ra[3], const double dec[3],
+	const struct ln_lnlat_posn *obs, double h0)
+{
+	double theta, n, alpha, delta, H, h, dm, lat;
+	int i;
+
+	lat = ln_deg_to_rad(obs->lat);
+
+	for (i = 0; i < RST_MAX_ITERATIONS; i++) {
+		theta = O + 360.985647 * m;
+		n = m + dT;
+
+		alpha = ln_interpolate3(n, ra[0], ra[1], ra[2]);
+		H = range_half(theta + obs->lng - alpha);
+
+		if (event == 0)
+			dm = -H / 360;
+		else {
+			delta = ln_deg_to_rad(ln_interpolate3(n, dec[0], dec[1], dec[2]));
+			h = ln_rad_to_deg(asin(sin(lat) * sin(delta) + cos(lat) * cos(delta) * cos(ln_deg_to_rad(H))));
+			dm = (h - h0) / (360 * cos(delta) * cos(lat) * sin(ln_deg_to_rad(H)));
+		}
+
+		m = range_day(m + dm);
+
+		if (fabs(dm) < RST_EPSILON)
+			break;
+	}
+
+	return m;
+}
+
+int rst_solve(const struct rst_samples *s, const struct ln_lnlat_posn *obs, double horizon,
+	const struct ln_rst_time *hint, struct ln_rst_time *rst)
+{
+	double ra[3], dec[3];
+	double lat, cosH0, H0, O, dT, mt, mr, ms;
+	int i;
+
+	lat = ln_deg_to_rad(obs->lat);
+
+	for (i = 0; i < 3; i++)
+		dec[i] = s->pos[i].dec;
+
+	/* the right ascension must not wrap between the samples */
+	ra[0] = s->pos[0].ra;
+	ra[1] = ra[0] + range_half(s->pos[1].ra - ra[0]);
+	ra[2] = ra[1] + range_half(s->pos[2].ra - ra[1]);
+
+	/* circumpolar objects do not need any further evaluations */
+	cosH0 = (sin(ln_deg_to_rad(horizon)) - sin(lat) * sin(ln_deg_to_rad(dec[1])))
+		/ (cos(lat) * cos(ln_deg_to_rad(dec[1])));
+	if (cosH0 < -1)
+		return 1;
+	if (cosH0 > 1)
+		return -1;
+
+	H0 = ln_rad_to_deg(acos(cosH0));
+	O = s->sidereal;
+	dT = ln_get_dynamical_time_diff(s->jd) / 86400;
+
+	/* the previous day is a much better estimate than the approximation */
+	if (hint) {
+		mt = range_day(hint->transit - s->jd);
+		mr = range_day(hint->rise - s->jd);
+		ms = range_day(hint->set - s->jd);
+	}
+	else {
+		mt = range_day((ra[1] - obs->lng - O) / 360);
+		mr = range_day(mt - H0 / 360);
+		ms = range_day(mt + H0 / 360);
+	}
+
+	rst->transit = s->jd + solve_event(mt, 0, O, dT, ra, dec, obs, horizon);
+	rst->rise    = s->jd + solve_event(mr, 1, O, dT, ra, dec, obs, horizon);
+	rst->set     = s->jd + solve_event(ms, 1, O, dT, ra, dec, obs, horizon);
+
+	return 0;
+}
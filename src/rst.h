@@ -0,0 +1,60 @@
+/**
+ * Incremental rise, set and transit search
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RST_H_
+#define _RST_H_
+
+#include <libnova/libnova.h>
+
+/* Forward declaration */
+struct object;
+
+/** Positions of an object at 0h UT of the previous, current and next day */
+struct rst_samples {
+	const struct object *obj;	/**< NULL if empty */
+	double jd;			/**< 0h UT of the current day */
+	double sidereal;		/**< Apparent sidereal time at jd in degrees */
+	struct ln_equ_posn pos[3];
+};
+
+/** Update samples for the day starting at jd_ut.
+ *
+ * Samples of adjacent days are shifted instead of being recalculated.
+ *
+ * @return The number of evaluated positions (0 to 3)
+ */
+int rst_samples_update(struct rst_samples *s, const struct object *obj, double jd_ut);
+
+/** Find rise, set and transit times from samples (Meeus, chapter 15).
+ *
+ * @param hint Results of the previous day as starting estimates or NULL
+ * @retval 0 on success
+ * @retval 1 if the object is circumpolar above the horizon
+ * @retval -1 if the object is circumpolar below the horizon
+ */
+int rst_solve(const struct rst_samples *s, const struct ln_lnlat_posn *obs, double horizon,
+	const struct ln_rst_time *hint, struct ln_rst_time *rst);
+
+#endif /* _RST_H_ */
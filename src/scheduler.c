@@ -0,0 +1,309 @@
+/**
+ * Execute commands at rise/set/transit of objects
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <libnova/libnova.h>
+
+#include "scheduler.h"
+#include "objects.h"
+
+static const char *moments[] = { "now", "rise", "set", "transit" };
+
+static volatile sig_atomic_t stop;
+
+static void quit(int sig)
+{
+	stop = 1;
+}
+
+static void sift_down(struct scheduler *s, size_t i)
+{
+	struct scheduler_rule *r = s->heap[i];
+	size_t c;
+
+	for (; (c = 2 * i + 1) < s->len; i = c) {
+		if (c + 1 < s->len && s->heap[c + 1]->when < s->heap[c]->when)
+			c++;
+		if (s->heap[c]->when >= r->when)
+			break;
+
+		s->heap[i] = s->heap[c];
+	}
+
+	s->heap[i] = r;
+}
+
+static void pop(struct scheduler *s)
+{
+	struct scheduler_rule *r = s->heap[0];
+
+	s->heap[0] = s->heap[--s->len];
+	if (s->len)
+		sift_down(s, 0);
+
+	free(r->command);
+	free(r);
+}
+
+/** Find the first execution of a rule after the given time */
+static int schedule(const struct scheduler *s, struct scheduler_rule *r, time_t after)
+{
+	struct object_details details = { .obs = s->obs };
+	double jd;
+	time_t event;
+	int day;
+
+	/* the event itself has to happen after this point */
+	after -= r->offset;
+	jd = ln_get_julian_from_timet(&after);
+
+	for (day = 0; day < SCHEDULER_MAX_DAYS; day++) {
+		if (!object_calc(r->obj, jd, r->moment, true, r->horizon, &details)) {
+			ln_get_timet_from_julian(details.jd, &event);
+			if (event > after) {
+				r->when = event + r->offset;
+				return 0;
+			}
+		}
+
+		/* circumpolar or passed: continue at 0h UT of the following day */
+		jd = floor(jd - .5) + 1.5;
+	}
+
+	return -1;
+}
+
+static void execute(const struct scheduler_rule *r)
+{
+	char when[32];
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		perror("Error: failed to fork");
+	else if (pid == 0) {
+		snprintf(when, sizeof(when), "%ld", (long) (r->when - r->offset));
+
+		setenv("CALCELESTIAL_OBJECT", object_name(r->obj), 1);
+		setenv("CALCELESTIAL_MOMENT", moments[r->moment], 1);
+		setenv("CALCELESTIAL_TIME", when, 1);
+
+		/* an ignored SIGCHLD would survive execl() and break wait() in the command */
+		signal(SIGCHLD, SIG_DFL);
+
+		execl("/bin/sh", "sh", "-c", r->command, (char *) NULL);
+		_exit(127);
+	}
+}
+
+int scheduler_add(struct scheduler *s, const struct object *obj, enum object_moment moment, double horizon, int offset, const char *command)
+{
+	struct scheduler_rule *r;
+
+	if (s->len == s->size) {
+		size_t size = s->size ? 2 * s->size : 16;
+		struct scheduler_rule **heap = realloc(s->heap, size * sizeof(*heap));
+		if (!heap)
+			return -1;
+
+		s->heap = heap;
+		s->size = size;
+	}
+
+	r = malloc(sizeof(struct scheduler_rule));
+	if (!r)
+		return -1;
+
+	*r = (struct scheduler_rule) {
+		.obj = obj,
+		.moment = moment,
+		.horizon = horizon,
+		.offset = offset,
+		.command = strdup(command)
+	};
+
+	if (!r->command) {
+		free(r);
+		return -1;
+	}
+
+	/* not scheduled yet: keep the insertion order until scheduler_run() */
+	s->heap[s->len++] = r;
+
+	return 0;
+}
+
+static int parse_offset(const char *str, int *offset)
+{
+	char *endptr;
+
+	*offset = strtol(str, &endptr, 10);
+
+	switch (*endptr) {
+		case 'h': *offset *= 3600; endptr++; break;
+		case 'm': *offset *= 60; endptr++; break;
+		case 's': endptr++; break;
+	}
+
+	return endptr == str || *endptr ? -1 : 0;
+}
+
+int scheduler_load(struct scheduler *s, const char *filename)
+{
+	FILE *f;
+	char *line = NULL, *fields[4], *command, *saveptr;
+	size_t linelen = 0, lineno = 0;
+	int i, offset, ret = 0;
+
+	const struct object *obj;
+	enum object_moment moment;
+	double horizon;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		perror("Error: failed to open rules");
+		return -1;
+	}
+
+	while (!ret && getline(&line, &linelen, f) >= 0) {
+		lineno++;
+
+		line[strcspn(line, "\r\n")] = '\0';
+
+		fields[0] = strtok_r(line, " \t", &saveptr);
+		if (!fields[0] || fields[0][0] == '#')
+			continue;
+
+		for (i = 1; i < 4; i++)
+			fields[i] = strtok_r(NULL, " \t", &saveptr);
+
+		command = saveptr;
+		if (command)
+			command += strspn(command, " \t");
+
+		horizon = LN_SOLAR_STANDART_HORIZON;
+
+		obj = object_lookup(fields[0]);
+		if (!obj || !fields[3] || !command || !*command ||
+		    object_parse_moment(fields[1], &moment) || moment == MOMENT_NOW ||
+		    (strcmp(fields[2], "-") && object_parse_horizon(fields[2], &horizon)) ||
+		    parse_offset(fields[3], &offset)) {
+			fprintf(stderr, "Error: invalid rule in line %zu of %s\n", lineno, filename);
+			ret = -1;
+		}
+		else if (strcmp(fields[2], "-") && strcmp(object_name(obj), "sun")) {
+			fprintf(stderr, "Error: the horizon in line %zu of %s can only be used for the sun\n", lineno, filename);
+			ret = -1;
+		}
+		else if (scheduler_add(s, obj, moment, horizon, offset, command)) {
+			fprintf(stderr, "Error: out of memory\n");
+			ret = -1;
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return ret;
+}
+
+int scheduler_run(struct scheduler *s)
+{
+	struct sigaction sa = { .sa_handler = quit };
+	struct scheduler_rule *r;
+	struct timespec ts = { 0 };
+	time_t now;
+	size_t i;
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGCHLD, SIG_IGN); /* reap commands automatically */
+
+	time(&now);
+
+	/* schedule all rules and build the heap */
+	for (i = 0; i < s->len; i++) {
+		r = s->heap[i];
+		if (schedule(s, r, now)) {
+			fprintf(stderr, "%s never %ss within %d days\n", object_name(r->obj), moments[r->moment], SCHEDULER_MAX_DAYS);
+			s->heap[i--] = s->heap[--s->len];
+			free(r->command);
+			free(r);
+		}
+#ifdef DEBUG
+		else
+			printf("Debug: next %s of %s at %s", moments[r->moment], object_name(r->obj), ctime(&r->when));
+#endif
+	}
+
+	for (i = s->len / 2; i-- > 0; )
+		sift_down(s, i);
+
+	while (!stop && s->len) {
+		r = s->heap[0];
+
+		/* absolute deadlines are not affected by suspend or clock adjustments */
+		ts.tv_sec = r->when;
+		if (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL))
+			continue; /* interrupted by a signal */
+
+		time(&now);
+		if (now < r->when)
+			continue;
+
+		if (now - r->when <= SCHEDULER_GRACE) {
+			execute(r);
+			now = r->when;
+		}
+		else
+			fprintf(stderr, "skipping missed %s of %s\n", moments[r->moment], object_name(r->obj));
+
+		if (schedule(s, r, now)) {
+			fprintf(stderr, "%s never %ss within %d days\n", object_name(r->obj), moments[r->moment], SCHEDULER_MAX_DAYS);
+			pop(s);
+		}
+		else
+			sift_down(s, 0);
+	}
+
+	return 0;
+}
+
+void scheduler_free(struct scheduler *s)
+{
+	while (s->len)
+		pop(s);
+
+	free(s->heap);
+}
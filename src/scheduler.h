@@ -0,0 +1,84 @@
+/**
+ * Execute commands at rise/set/transit of objects
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <time.h>
+#include <libnova/libnova.h>
+
+#include "objects.h"
+
+#define SCHEDULER_MAX_DAYS	400	/**< Give up if an event does not occur within this number of days */
+#define SCHEDULER_GRACE		300	/**< Events missed by more seconds are skipped (e.g. after suspend) */
+
+struct scheduler_rule {
+	const struct object *obj;
+	enum object_moment moment;
+	double horizon;
+	int offset;			/**< Seconds relative to the event */
+	char *command;
+
+	time_t when;			/**< Next execution */
+};
+
+struct scheduler {
+	struct ln_lnlat_posn obs;
+
+	struct scheduler_rule **heap;	/**< Min-heap ordered by the next execution */
+	size_t len, size;
+};
+
+/** Add a rule which runs command with /bin/sh at every occurrence of an event.
+ *
+ * @param offset Seconds relative to the event, negative values run the command ahead
+ * @retval 0 on success
+ * @retval -1 if out of memory
+ */
+int scheduler_add(struct scheduler *s, const struct object *obj, enum object_moment moment, double horizon, int offset, const char *command);
+
+/** Add the rules of a file.
+ *
+ * Each line has the fields: OBJECT MOMENT HORIZON OFFSET COMMAND
+ * HORIZON may be "-" for the default and is only accepted for the sun,
+ * OFFSET is NUM[s|m|h] with an optional sign.
+ * Empty lines and lines starting with # are ignored.
+ *
+ * @retval 0 on success
+ * @retval -1 on error with a message printed to stderr
+ */
+int scheduler_load(struct scheduler *s, const char *filename);
+
+/** Sleep until the next event and execute its command until SIGINT or SIGTERM.
+ *
+ * The following occurrence of an event is only calculated after its command has been started.
+ *
+ * @retval 0 on a clean shutdown or if no rule is left
+ */
+int scheduler_run(struct scheduler *s);
+
+void scheduler_free(struct scheduler *s);
+
+#endif /* _SCHEDULER_H_ */
@@ -0,0 +1,197 @@
+/**
+ * Searches for events of an object at many sites
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <libnova/libnova.h>
+
+#include "search.h"
+#include "events.h"
+#include "objects.h"
+#include "formatter.h"
+
+struct found {
+	struct event *events;
+	size_t len, size;
+	int error;
+};
+
+static void collect(void *ctx, const struct event *e)
+{
+	struct found *f = ctx;
+	struct event *tmp;
+	size_t size;
+
+	if (f->error)
+		return;
+
+	if (f->len == f->size) {
+		size = f->size ? 2 * f->size : 256;
+		tmp = realloc(f->events, size * sizeof(*tmp));
+		if (!tmp) {
+			f->error = 1;
+			return;
+		}
+		f->events = tmp;
+		f->size = size;
+	}
+
+	f->events[f->len++] = *e;
+}
+
+static int compare(const void *a, const void *b)
+{
+	const struct event *ea = a, *eb = b;
+
+	if (ea->site != eb->site)
+		return ea->site - eb->site;
+
+	return (ea->jd > eb->jd) - (ea->jd < eb->jd);
+}
+
+static void print_event(const struct batch_config *cfg, const struct batch_site *site, const struct event *e, char *tzid, size_t len)
+{
+	struct object_details details = { .obs = site->obs };
+	int i;
+
+	/* a search has no rise, set and transit of the day */
+	details.rst.rise = details.rst.set = details.rst.transit = NAN;
+	for (i = 0; i < TWILIGHTS; i++)
+		details.twilight[i].dawn = details.twilight[i].dusk = NAN;
+
+	details.jd = e->jd;
+	details.event = e->rising ? "rise" : "set";
+	details.deviation = e->deviation;
+	details.object = object_name(cfg->obj);
+	details.equ = e->equ;
+	details.distance = e->distance;
+	details.diameter = e->diameter;
+
+	batch_switch_tz(site->tzid, tzid, len);
+	object_localtime(&details);
+	if (format_result(cfg->format, &details))
+		fprintf(stderr, "Error: failed to format result\n");
+}
+
+/** Split the sites into observers and values, sites without a value use the default
+ *
+ * @retval 0 on success
+ * @retval -1 if out of memory or a value is not within [min, max]
+ */
+static int split_sites(const struct batch_site *sites, int n, double value, double min, double max,
+	struct ln_lnlat_posn **obs, double **values)
+{
+	int j;
+
+	*obs = malloc(n * sizeof(**obs));
+	*values = malloc(n * sizeof(**values));
+	if (!*obs || !*values) {
+		fprintf(stderr, "Error: out of memory\n");
+		return -1;
+	}
+
+	for (j = 0; j < n; j++) {
+		(*obs)[j] = sites[j].obs;
+		(*values)[j] = isnan(sites[j].value) ? value : sites[j].value;
+
+		if ((*values)[j] < min || (*values)[j] > max) {
+			fprintf(stderr, "Error: invalid value for site %d\n", j + 1);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Print the events ordered by site and time */
+static void print_events(const struct batch_config *cfg, const struct batch_site *sites, struct found *f)
+{
+	char tzid[64];
+	size_t i;
+
+	/* the events are found step by step for all sites */
+	qsort(f->events, f->len, sizeof(f->events[0]), compare);
+
+	snprintf(tzid, sizeof(tzid), "%s", getenv("TZ") ? getenv("TZ") : "");
+	for (i = 0; i < f->len; i++)
+		print_event(cfg, &sites[f->events[i].site], &f->events[i], tzid, sizeof(tzid));
+}
+
+int search_altitude(const struct batch_config *cfg, const struct batch_site *sites, int n,
+	double altitude, double first, double last)
+{
+	struct ln_lnlat_posn *obs = NULL;
+	struct found f = { NULL };
+	double *alt = NULL;
+	int ret = -1;
+
+	if (split_sites(sites, n, altitude, -90, 90, &obs, &alt))
+		goto out;
+
+	if (events_find(cfg->obj, obs, alt, n, first, last, EVENTS_STEP, EVENTS_TOLERANCE, collect, &f) < 0 || f.error) {
+		fprintf(stderr, "Error: failed to search crossings\n");
+		goto out;
+	}
+
+	print_events(cfg, sites, &f);
+	ret = 0;
+
+out:	free(f.events);
+	free(obs);
+	free(alt);
+
+	return ret;
+}
+
+int search_azimuth(const struct batch_config *cfg, const struct batch_site *sites, int n,
+	double azimuth, double tolerance, double first, double last)
+{
+	struct ln_lnlat_posn *obs = NULL;
+	struct found f = { NULL };
+	double *az = NULL;
+	int ret = -1;
+
+	if (split_sites(sites, n, azimuth, 0, 360, &obs, &az))
+		goto out;
+
+	if (events_align(cfg->obj, obs, az, n, cfg->moment == MOMENT_RISE, cfg->horizon,
+		first, last, tolerance, collect, &f) < 0 || f.error) {
+		fprintf(stderr, "Error: failed to search alignments\n");
+		goto out;
+	}
+
+	print_events(cfg, sites, &f);
+	ret = 0;
+
+out:	free(f.events);
+	free(obs);
+	free(az);
+
+	return ret;
+}
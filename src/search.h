@@ -0,0 +1,63 @@
+/**
+ * Searches for events of an object at many sites
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+#include "batch.h"
+
+/** Print every crossing of an altitude by the object between first and last.
+ *
+ * The positions of the object are shared by all sites, see events_find().
+ * One line is written per crossing, ordered by site and time, with the
+ * §E token set to rise or set.
+ *
+ * @param sites The value of a site overrides the altitude
+ * @param altitude Altitude in degrees for sites without a value
+ * @retval 0 on success
+ * @retval -1 on error with a message printed to stderr
+ */
+int search_altitude(const struct batch_config *cfg, const struct batch_site *sites, int n,
+	double altitude, double first, double last);
+
+/** Print the days on which the object rises or sets at an azimuth.
+ *
+ * The moment and horizon of cfg select rise or set. All sites share the
+ * positions of a day, see events_align(). One line is written per day
+ * with a deviation up to the tolerance and for the nearer day of every
+ * passage of the azimuth, ordered by site and time, with
+ * the §E token set to rise or set and §D to the deviation.
+ *
+ * @param sites The value of a site overrides the azimuth
+ * @param azimuth Azimuth in degrees from north for sites without a value
+ * @param tolerance Maximum deviation in degrees
+ * @retval 0 on success
+ * @retval -1 on error with a message printed to stderr
+ */
+int search_azimuth(const struct batch_config *cfg, const struct batch_site *sites, int n,
+	double azimuth, double tolerance, double first, double last);
+
+#endif /* _SEARCH_H_ */
@@ -0,0 +1,859 @@
+/**
+ * Daemon answering queries over a Unix socket
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "../config.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <libnova/libnova.h>
+
+#ifdef HAVE_JSON_C_JSON_H
+  #include <json-c/json.h>
+#endif
+
+#include "server.h"
+#include "objects.h"
+#include "formatter.h"
+#include "batch.h"
+#ifdef GEONAMES_SUPPORT
+  #include <pthread.h>
+  #include <sys/eventfd.h>
+  #include "geonames.h"
+#endif
+
+struct client {
+	int fd;
+
+	char in[SERVER_MAX_LINE];
+	size_t inlen;
+
+	char *out;
+	size_t outlen, outpos, outsize;
+	uint32_t events;		/**< Currently watched epoll events */
+
+	struct lookup *lookup;		/**< Pending location lookup, the input is paused meanwhile */
+};
+
+/** A request waiting for the resolver thread */
+struct lookup {
+	struct client *client;		/**< NULL if the client has been dropped meanwhile */
+	char line[SERVER_MAX_LINE];	/**< The request as received */
+	char *query;
+
+	struct ln_lnlat_posn obs;	/**< Result of the lookup */
+	int ret;
+
+	struct lookup *next;
+};
+
+#ifdef GEONAMES_SUPPORT
+/** Looks up locations in its own thread and session, so the event loop never waits for the web service */
+struct resolver {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+
+	struct lookup *todo, **todo_tail;
+	struct lookup *done;
+	int efd;			/**< Signals finished lookups to the event loop */
+};
+#endif
+
+struct request {
+	const struct object *obj;
+	enum object_moment moment;
+	bool next;
+	double horizon;
+	unsigned twilights;
+	bool horizon_set;
+
+	struct ln_lnlat_posn obs;
+	const char *query;
+	const struct lookup *lookup;	/**< The finished lookup of the query */
+	const char *tzid;
+	const char *format;		/**< NULL for the default format */
+
+	const char *time;		/**< NULL for now */
+};
+
+struct server {
+	const struct batch_config *cfg;
+	int epfd;
+
+	char tzid[64];			/**< Currently active timezone */
+	char line[SERVER_MAX_LINE];	/**< Copy of the request being parsed */
+#ifdef GEONAMES_SUPPORT
+	struct resolver resolver;
+#endif
+
+	struct {
+		char *str;
+		struct format *fmt;
+	} formats[SERVER_FORMATS];
+	int next_format;
+
+	struct format_buffer buf;
+};
+
+static volatile sig_atomic_t stop;
+
+/** Returned by handle() for requests passed to the resolver */
+static const char deferred[] = "deferred";
+
+static void quit(int sig)
+{
+	stop = 1;
+}
+
+/** Get a compiled format, compiling it only on first use */
+static struct format * lookup_format(struct server *s, const char *str)
+{
+	struct format *fmt;
+	int i;
+
+	for (i = 0; i < SERVER_FORMATS; i++) {
+		if (s->formats[i].str && !strcmp(s->formats[i].str, str))
+			return s->formats[i].fmt;
+	}
+
+	fmt = format_compile(str);
+	if (!fmt)
+		return NULL;
+
+	/* replace the oldest entry */
+	i = s->next_format++ % SERVER_FORMATS;
+	if (s->formats[i].str) {
+		free(s->formats[i].str);
+		format_free(s->formats[i].fmt);
+	}
+
+	s->formats[i].str = strdup(str);
+	s->formats[i].fmt = fmt;
+
+	return fmt;
+}
+
+/** Apply a single request field, returns an error message or NULL */
+static const char * set_field(struct request *r, const char *key, const char *value)
+{
+	char *endptr;
+
+	if (!strcmp(key, "object")) {
+		r->obj = object_lookup(value);
+		if (!r->obj)
+			return "invalid object";
+	}
+	else if (!strcmp(key, "moment")) {
+		if (object_parse_moment(value, &r->moment))
+			return "invalid moment";
+	}
+	else if (!strcmp(key, "next"))
+		r->next = !strcmp(value, "1") || !strcmp(value, "true") || !strcmp(value, "yes");
+	else if (!strcmp(key, "horizon")) {
+		if (object_parse_horizons(value, &r->horizon, &r->twilights))
+			return "invalid horizon";
+
+		r->horizon_set = true;
+	}
+	else if (!strcmp(key, "lat")) {
+		r->obs.lat = strtod(value, &endptr);
+		if (endptr == value || fabs(r->obs.lat) > 90)
+			return "invalid latitude";
+	}
+	else if (!strcmp(key, "lon")) {
+		r->obs.lng = strtod(value, &endptr);
+		if (endptr == value || fabs(r->obs.lng) > 180)
+			return "invalid longitude";
+	}
+	else if (!strcmp(key, "query"))
+		r->query = value;
+	else if (!strcmp(key, "time"))
+		r->time = strcmp(value, "now") ? value : NULL;
+	else if (!strcmp(key, "timezone"))
+		r->tzid = value;
+	else if (!strcmp(key, "format"))
+		r->format = value;
+	else
+		return "unknown key";
+
+	return NULL;
+}
+
+/** Parse KEY=VALUE pairs, the value of format= extends to the end of the line */
+static const char * parse_line(struct request *r, char *line)
+{
+	const char *err;
+	char *key, *value, *end;
+
+	for (key = line; *key; key = end) {
+		while (isspace(*key))
+			key++;
+		if (!*key)
+			break;
+
+		value = strchr(key, '=');
+		if (!value)
+			return "expected KEY=VALUE";
+		*value++ = '\0';
+
+		if (!strcmp(key, "format"))
+			end = value + strlen(value);
+		else {
+			for (end = value; *end && !isspace(*end); end++);
+			if (*end)
+				*end++ = '\0';
+		}
+
+		err = set_field(r, key, value);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+#ifdef GEONAMES_SUPPORT
+static void * resolve(void *arg)
+{
+	struct resolver *rs = arg;
+	struct geonames *g = NULL;
+	struct lookup *l;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&rs->lock);
+	while (!rs->stop) {
+		l = rs->todo;
+		if (!l) {
+			pthread_cond_wait(&rs->cond, &rs->lock);
+			continue;
+		}
+
+		rs->todo = l->next;
+		if (!rs->todo)
+			rs->todo_tail = &rs->todo;
+		pthread_mutex_unlock(&rs->lock);
+
+		if (!g)
+			g = geonames_open();
+		l->ret = !g || geonames_lookup_latlng(g, l->query, &l->obs, NULL, 0);
+
+		pthread_mutex_lock(&rs->lock);
+		l->next = rs->done;
+		rs->done = l;
+		if (write(rs->efd, &one, sizeof(one)) < 0)
+			perror("Error: failed to signal lookup");
+	}
+	pthread_mutex_unlock(&rs->lock);
+
+	geonames_close(g);
+
+	return NULL;
+}
+
+static int resolver_start(struct resolver *rs, int epfd)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = rs };
+	sigset_t all, old;
+	int ret;
+
+	rs->todo_tail = &rs->todo;
+	rs->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (rs->efd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, rs->efd, &ev)) {
+		perror("Error: failed to create eventfd");
+		goto err;
+	}
+
+	pthread_mutex_init(&rs->lock, NULL);
+	pthread_cond_init(&rs->cond, NULL);
+
+	/* signals have to interrupt epoll_wait() of the event loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	ret = pthread_create(&rs->thread, NULL, resolve, rs);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret) {
+		fprintf(stderr, "Error: failed to start resolver thread: %s\n", strerror(ret));
+		goto err;
+	}
+
+	return 0;
+
+err:	if (rs->efd >= 0)
+		close(rs->efd);
+	rs->efd = -1;
+
+	return -1;
+}
+
+static void lookup_free(struct lookup *l)
+{
+	struct lookup *next;
+
+	for (; l; l = next) {
+		next = l->next;
+		free(l->query);
+		free(l);
+	}
+}
+
+/** Wait for the current lookup and free the pending ones */
+static void resolver_stop(struct resolver *rs)
+{
+	if (rs->efd < 0)
+		return;
+
+	pthread_mutex_lock(&rs->lock);
+	rs->stop = true;
+	pthread_cond_signal(&rs->cond);
+	pthread_mutex_unlock(&rs->lock);
+
+	pthread_join(rs->thread, NULL);
+
+	lookup_free(rs->todo);
+	lookup_free(rs->done);
+	close(rs->efd);
+}
+
+/** Pass a request to the resolver and pause the input of the client until it is answered */
+static const char * defer(struct server *s, struct client *c, const char *line, const char *query)
+{
+	struct resolver *rs = &s->resolver;
+	struct lookup *l;
+
+	l = calloc(1, sizeof(struct lookup));
+	if (!l)
+		return "out of memory";
+
+	l->query = strdup(query);
+	if (!l->query) {
+		free(l);
+		return "out of memory";
+	}
+
+	l->client = c;
+	strcpy(l->line, line);
+
+	pthread_mutex_lock(&rs->lock);
+	*rs->todo_tail = l;
+	rs->todo_tail = &l->next;
+	pthread_cond_signal(&rs->cond);
+	pthread_mutex_unlock(&rs->lock);
+
+	c->lookup = l;
+
+	return deferred;
+}
+#endif
+
+/** Calculate a request and render the answer into s->buf
+ *
+ * Requests with a query are deferred to the resolver first and
+ * calculated once again with the finished lookup.
+ */
+static const char * handle(struct server *s, struct client *c, struct request *r, const char *line)
+{
+	struct object_details result;
+	struct format *fmt;
+	struct tm tm;
+	time_t t;
+
+	if (!r->obj)
+		return "missing object";
+	if (r->horizon_set && strcmp(object_name(r->obj), "sun"))
+		return "the twilight parameter can only be used for the sun";
+
+#ifdef GEONAMES_SUPPORT
+	if (r->query && !r->lookup)
+		return defer(s, c, line, r->query);
+	if (r->query && r->lookup->ret)
+		return "failed to lookup location";
+	if (r->query)
+		r->obs = r->lookup->obs;
+#endif
+
+	if (fabs(r->obs.lat) > 90 || fabs(r->obs.lng) > 180)
+		return "missing lat & lon or query";
+
+	r->tzid = batch_resolve_tz(s->cfg, r->tzid, r->obs);
+
+	fmt = r->format ? lookup_format(s, r->format) : s->cfg->format;
+	if (!fmt)
+		return "failed to parse format";
+
+	/* the time is given in the timezone of the request */
+	batch_switch_tz(r->tzid, s->tzid, sizeof(s->tzid));
+
+	time(&t);
+	if (r->time && r->time[0] == '@')
+		t = strtol(r->time + 1, NULL, 10);
+	else if (r->time) {
+		/* like --time: a date without time keeps the current time of day */
+		localtime_r(&t, &tm);
+		if (batch_parse_date(r->time, &tm))
+			return "invalid time";
+
+		t = mktime(&tm);
+	}
+
+	result.obs = r->obs;
+	result.twilights = r->twilights;
+	if (object_calc(r->obj, ln_get_julian_from_timet(&t), r->moment, r->next, r->horizon, &result))
+		return "object is circumpolar";
+
+	object_localtime(&result);
+	if (!format_render(fmt, &result, &s->buf))
+		return "failed to format result";
+
+	return NULL;
+}
+
+static int reply(struct client *c, const char *str, size_t len)
+{
+	if (c->outlen + len + 1 > c->outsize) {
+		size_t size = c->outsize ? c->outsize : 256;
+		char *out;
+
+		while (c->outlen + len + 1 > size)
+			size *= 2;
+
+		out = realloc(c->out, size);
+		if (!out)
+			return -1;
+
+		c->out = out;
+		c->outsize = size;
+	}
+
+	memcpy(c->out + c->outlen, str, len);
+	c->outlen += len;
+	c->out[c->outlen++] = '\n';
+
+	return 0;
+}
+
+/** Answer a single request, lookup is the finished lookup of a deferred one */
+static int process(struct server *s, struct client *c, const char *line, const struct lookup *lookup)
+{
+	const struct batch_config *cfg = s->cfg;
+	const char *err;
+	char msg[128];
+	int ret;
+
+	struct request r = {
+		.obj = cfg->obj,
+		.moment = cfg->moment,
+		.next = cfg->next,
+		.horizon = cfg->horizon,
+		.twilights = cfg->twilights,
+		.horizon_set = cfg->horizon_set,
+		.obs = { DBL_MAX, DBL_MAX },
+		.lookup = lookup,
+		.tzid = cfg->tzid
+	};
+
+	/* parsing modifies the line, the original is kept for the resolver */
+	strcpy(s->line, line);
+
+#ifdef HAVE_JSON_C_JSON_H
+	if (line[0] == '{') {
+		struct json_object *jobj = json_tokener_parse(s->line);
+		if (!jobj || !json_object_is_type(jobj, json_type_object))
+			err = "invalid json";
+		else {
+			err = NULL;
+			json_object_object_foreach(jobj, key, val) {
+				err = set_field(&r, key, json_object_get_string(val));
+				if (err)
+					break;
+			}
+		}
+
+		if (!err)
+			err = handle(s, c, &r, line);
+
+		json_object_put(jobj); /* owns the strings of r */
+	}
+	else
+#endif
+	{
+		err = parse_line(&r, s->line);
+		if (!err)
+			err = handle(s, c, &r, line);
+	}
+
+	if (err == deferred)
+		return 0;
+	else if (err) {
+		ret = snprintf(msg, sizeof(msg), "error: %s", err);
+		return reply(c, msg, ret);
+	}
+
+	return reply(c, s->buf.ptr, s->buf.len);
+}
+
+static void drop(struct server *s, struct client *c)
+{
+	if (c->lookup)
+		c->lookup->client = NULL; /* freed once the lookup has finished */
+
+	epoll_ctl(s->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->out);
+	free(c);
+}
+
+/** Write as much pending output as possible and wait for EPOLLOUT if needed */
+static int flush(struct server *s, struct client *c)
+{
+	struct epoll_event ev = { .data.ptr = c };
+	ssize_t ret;
+	uint32_t events;
+
+	while (c->outpos < c->outlen) {
+		ret = send(c->fd, c->out + c->outpos, c->outlen - c->outpos, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		c->outpos += ret;
+	}
+
+	if (c->outpos == c->outlen)
+		c->outpos = c->outlen = 0;
+	else if (c->outlen - c->outpos > SERVER_MAX_PENDING)
+		return -1; /* client does not read its answers */
+
+	events = (c->lookup ? 0 : EPOLLIN) | (c->outlen > 0 ? EPOLLOUT : 0);
+	if (c->events != events) {
+		c->events = ev.events = events;
+		epoll_ctl(s->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	}
+
+	return 0;
+}
+
+/** Answer all complete lines received so far, stops at a request waiting for its lookup */
+static int answer(struct server *s, struct client *c)
+{
+	char *line, *eol;
+
+	for (line = c->in; !c->lookup && (eol = strchr(line, '\n')); line = eol + 1) {
+		*eol = '\0';
+		if (eol > line && eol[-1] == '\r')
+			eol[-1] = '\0';
+
+		if (*line && process(s, c, line, NULL))
+			return -1;
+	}
+
+	c->inlen -= line - c->in;
+	memmove(c->in, line, c->inlen + 1);
+
+	return flush(s, c);
+}
+
+static int receive(struct server *s, struct client *c)
+{
+	ssize_t ret;
+
+	while (!c->lookup) {
+		ret = recv(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen - 1, 0);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+		else if (ret == 0)
+			return -1; /* closed by peer */
+
+		c->inlen += ret;
+		c->in[c->inlen] = '\0';
+
+		if (answer(s, c))
+			return -1;
+
+		if (c->inlen == sizeof(c->in) - 1) {
+			reply(c, "error: request too long", 23);
+			flush(s, c);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+#ifdef GEONAMES_SUPPORT
+/** Answer the requests whose lookups have finished and resume their clients */
+static void resume(struct server *s)
+{
+	struct resolver *rs = &s->resolver;
+	struct lookup *l, *next;
+	struct client *c;
+	uint64_t count;
+
+	if (read(rs->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		perror("Error: failed to read eventfd");
+
+	pthread_mutex_lock(&rs->lock);
+	l = rs->done;
+	rs->done = NULL;
+	pthread_mutex_unlock(&rs->lock);
+
+	for (; l; l = next) {
+		next = l->next;
+		c = l->client;
+
+		if (c) {
+			c->lookup = NULL;
+			if (process(s, c, l->line, l) || answer(s, c))
+				drop(s, c);
+		}
+
+		free(l->query);
+		free(l);
+	}
+}
+#endif
+
+static int accept_clients(struct server *s, int lfd)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct client *c;
+	int fd;
+
+	while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		c = calloc(1, sizeof(struct client));
+		if (!c) {
+			close(fd);
+			continue;
+		}
+
+		c->fd = fd;
+		c->events = ev.events;
+		ev.data.ptr = c;
+		if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+			close(fd);
+			free(c);
+		}
+	}
+
+	return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+}
+
+/** Remove the socket of a previous run which is not in use anymore
+ *
+ * @retval 0 if the path is free
+ * @retval -1 if it is not a socket or another server answers on it
+ */
+static int remove_stale(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd, live;
+
+	if (lstat(addr->sun_path, &st)) {
+		if (errno == ENOENT)
+			return 0;
+
+		perror("Error: failed to check socket path");
+		return -1;
+	}
+
+	if (!S_ISSOCK(st.st_mode)) {
+		fprintf(stderr, "Error: %s exists and is not a socket\n", addr->sun_path);
+		return -1;
+	}
+
+	/* only a socket without a listener is stale */
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Error: failed to create socket");
+		return -1;
+	}
+
+	live = !connect(fd, (const struct sockaddr *) addr, sizeof(*addr));
+	close(fd);
+
+	if (live) {
+		fprintf(stderr, "Error: another server is listening on %s\n", addr->sun_path);
+		return -1;
+	}
+
+	if (unlink(addr->sun_path)) {
+		perror("Error: failed to remove stale socket");
+		return -1;
+	}
+
+	return 0;
+}
+
+int server_run(const char *path, const struct batch_config *cfg)
+{
+	struct epoll_event ev, events[SERVER_MAX_EVENTS];
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct sigaction sa = { .sa_handler = quit };
+	struct server s = { .cfg = cfg };
+#ifdef GEONAMES_SUPPORT
+	bool resumable;
+#endif
+	int lfd, n, i, ret = -1;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: socket path too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (lfd < 0) {
+		perror("Error: failed to create socket");
+		return -1;
+	}
+
+	if (remove_stale(&addr))
+		goto out;
+
+	if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) || listen(lfd, SOMAXCONN)) {
+		perror("Error: failed to bind socket");
+		goto out;
+	}
+
+	s.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (s.epfd < 0) {
+		perror("Error: failed to create epoll instance");
+		goto unlink;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; /* the listening socket */
+	epoll_ctl(s.epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+	/* no SA_RESTART: epoll_wait() returns on signals */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* requests without a timezone use the one we started with */
+	if (!cfg->tzid || strlen(cfg->tzid) == 0) {
+		const char *tz = getenv("TZ");
+		snprintf(s.tzid, sizeof(s.tzid), "%s", tz ? tz : "");
+	}
+	else
+		snprintf(s.tzid, sizeof(s.tzid), "%s", cfg->tzid);
+
+#ifdef GEONAMES_SUPPORT
+	if (resolver_start(&s.resolver, s.epfd))
+		goto close;
+#endif
+
+	while (!stop) {
+		n = epoll_wait(s.epfd, events, SERVER_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("Error: epoll_wait failed");
+			goto close;
+		}
+
+#ifdef GEONAMES_SUPPORT
+		resumable = false;
+#endif
+		for (i = 0; i < n; i++) {
+			struct client *c = events[i].data.ptr;
+
+#ifdef GEONAMES_SUPPORT
+			if (c == (void *) &s.resolver)
+				resumable = true;
+			else
+#endif
+			if (!c) {
+				if (accept_clients(&s, lfd))
+					perror("Error: failed to accept client");
+			}
+			else if (events[i].events & (EPOLLERR | EPOLLHUP))
+				drop(&s, c);
+			else if (events[i].events & EPOLLIN) {
+				if (receive(&s, c))
+					drop(&s, c);
+			}
+			else if (flush(&s, c))
+				drop(&s, c);
+		}
+
+#ifdef GEONAMES_SUPPORT
+		/* clients might be dropped, so not before all of their events are handled */
+		if (resumable)
+			resume(&s);
+#endif
+	}
+
+	ret = 0;
+
+close:	close(s.epfd);
+	for (i = 0; i < SERVER_FORMATS; i++) {
+		if (s.formats[i].str) {
+			free(s.formats[i].str);
+			format_free(s.formats[i].fmt);
+		}
+	}
+	format_buffer_free(&s.buf);
+#ifdef GEONAMES_SUPPORT
+	resolver_stop(&s.resolver);
+#endif
+unlink:	unlink(path);
+out:	close(lfd);
+
+	return ret;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
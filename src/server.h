@@ -0,0 +1,55 @@
+/**
+ * Daemon answering queries over a Unix socket
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include "batch.h"
+
+#define SERVER_MAX_EVENTS	64
+#define SERVER_MAX_LINE		4096	/**< Longest accepted request */
+#define SERVER_MAX_PENDING	(1 << 20) /**< Clients with more unread output are dropped */
+#define SERVER_FORMATS		8	/**< Number of cached compiled formats */
+
+/** Answer requests on a Unix socket until SIGINT or SIGTERM.
+ *
+ * Every request is a single line of whitespace separated KEY=VALUE pairs
+ * or a JSON object with the same keys:
+ *
+ *   object, moment, next, horizon, lat, lon, query, time, timezone, format
+ *
+ * A format= pair takes the rest of the line. Missing keys default to the
+ * command line options in cfg. Exactly one line is written for every request,
+ * failed requests are answered with "error: <reason>".
+ *
+ * Queries are looked up by a separate thread. The input of a client is
+ * paused until its lookup has finished, so answers keep their order.
+ *
+ * @retval 0 on a clean shutdown
+ * @retval -1 if the socket could not be set up
+ */
+int server_run(const char *path, const struct batch_config *cfg);
+
+#endif /* _SERVER_H_ */
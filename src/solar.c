@@ -0,0 +1,261 @@
+/**
+ * Low precision position of the sun in closed form
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _XOPEN_SOURCE 700
+
+#include <math.h>
+#include <libnova/libnova.h>
+
+#include "solar.h"
+#include "objects.h"
+#include "rst.h"
+
+/* Dispatch to FMA at runtime, the series are chains of multiply-adds */
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+  #define TARGET_CLONES __attribute__((target_clones("fma", "default")))
+#else
+  #define TARGET_CLONES
+#endif
+
+#define J2000		2451545.0
+#define DEG		(M_PI / 180)
+
+#define EPSILON_J2000	23.4392911	/**< Mean obliquity of the ecliptic at J2000 in degrees */
+
+/** Distance of the last position of this thread for object_pos() */
+static __thread struct {
+	double jd, dist;
+} last;
+
+/* The functions of the C library are accurate to the last bit and take most of the time.
+ * The approximations below are accurate to 1e-10, far below SOLAR_MAX_ERROR. */
+
+/** sin() and cos() by Taylor series after reduction to [-pi/4, pi/4] */
+static inline void fast_sincos(double x, double *s, double *c)
+{
+	double q = floor(x * M_2_PI + 0.5);
+	double r = x - q * M_PI_2, z = r * r;
+	double sr, cr;
+
+	sr = r * (1 + z * (-1 / 6.0 + z * (1 / 120.0 + z * (-1 / 5040.0 + z * (1 / 362880.0 - z / 39916800.0)))));
+	cr = 1 + z * (-1 / 2.0 + z * (1 / 24.0 + z * (-1 / 720.0 + z * (1 / 40320.0 - z / 3628800.0))));
+
+	switch ((long) q & 3) {
+		case 0: *s =  sr; *c =  cr; break;
+		case 1: *s =  cr; *c = -sr; break;
+		case 2: *s = -sr; *c = -cr; break;
+		case 3: *s = -cr; *c =  sr; break;
+	}
+}
+
+/** atan() for t in [0, 1] by Taylor series after reduction to [-tan(pi/8), tan(pi/8)] */
+static inline double fast_atan01(double t)
+{
+	double base = 0, z, p;
+
+	if (t > 0.41421356237309504880) {
+		t = (t - 1) / (t + 1);
+		base = M_PI_4;
+	}
+
+	z = t * t;
+	p = 1 / 17.0 - z * (1 / 19.0 - z * (1 / 21.0 - z / 23.0));
+	p = 1 / 9.0 - z * (1 / 11.0 - z * (1 / 13.0 - z * (1 / 15.0 - z * p)));
+	p = 1 - z * (1 / 3.0 - z * (1 / 5.0 - z * (1 / 7.0 - z * p)));
+
+	return base + t * p;
+}
+
+static inline double fast_atan2(double y, double x)
+{
+	double ax = fabs(x), ay = fabs(y), r;
+
+	/* reduce to a ratio in [0, 1] */
+	r = ay > ax ? M_PI_2 - fast_atan01(ax / ay) : fast_atan01(ax > 0 ? ay / ax : 0);
+	if (x < 0)
+		r = M_PI - r;
+
+	return y < 0 ? -r : r;
+}
+
+/** Longitude of the sun in degrees and distance in AU, Meeus (25.2) - (25.8) */
+static inline void solar_ecliptic(double jd, double *lambda, double *omega, double *dist, double *T)
+{
+	double L0, M, e, C, sM, cM, cv;
+
+	*T = (jd - J2000) / 36525;
+
+	L0 = 280.46646 + *T * (36000.76983 + *T * 0.0003032);
+	M  = 357.52911 + *T * (35999.05029 - *T * 0.0001537);
+	e  = 0.016708634 - *T * (0.000042037 + *T * 0.0000001267);
+
+	fast_sincos(M * DEG, &sM, &cM);
+
+	/* equation of center with sin(2M) and sin(3M) from sin(M) and cos(M) */
+	C = sM * ((1.914602 - *T * (0.004817 + *T * 0.000014))
+		+ 2 * cM * (0.019993 - *T * 0.000101)
+		+ (3 - 4 * sM * sM) * 0.000289);
+
+	/* cos(M + C) with C < 2° */
+	cv = cM * (1 - C * C * DEG * DEG / 2) - sM * C * DEG;
+
+	*omega = 125.04 - 1934.136 * *T;
+	*lambda = L0 + C;
+	*dist = 1.000001018 * (1 - e * e) / (1 + e * cv);
+}
+
+TARGET_CLONES
+void solar_equ_coords(double jd, struct ln_equ_posn *equ)
+{
+	double lambda, omega, dist, T, so, co, sl, cl, eps, se, ce;
+
+	solar_ecliptic(jd, &lambda, &omega, &dist, &T);
+	fast_sincos(omega * DEG, &so, &co);
+
+	last.jd = jd;
+	last.dist = dist;
+
+	/* apparent longitude, corrected for nutation and aberration */
+	lambda -= 0.00569 + 0.00478 * so;
+	fast_sincos(lambda * DEG, &sl, &cl);
+
+	/* the obliquity differs from its value at J2000 by less than 0.02°,
+	 * so its sine and cosine need no trigonometric functions (25.8) */
+	eps = (-0.0130042 * T + 0.00256 * co) * DEG;
+	se = sin(EPSILON_J2000 * DEG) + cos(EPSILON_J2000 * DEG) * eps;
+	ce = cos(EPSILON_J2000 * DEG) - sin(EPSILON_J2000 * DEG) * eps;
+
+	equ->ra = fast_atan2(ce * sl, cl) / DEG;
+	if (equ->ra < 0)
+		equ->ra += 360;
+	equ->dec = fast_atan2(se * sl, sqrt(1 - se * sl * se * sl)) / DEG; /* asin() */
+}
+
+double solar_earth_dist(double jd)
+{
+	double lambda, omega, dist, T;
+
+	if (jd == last.jd)
+		return last.dist;
+
+	solar_ecliptic(jd, &lambda, &omega, &dist, &T);
+
+	last.jd = jd;
+	last.dist = dist;
+
+	return dist;
+}
+
+double solar_sdiam(double jd)
+{
+	return 959.63 / solar_earth_dist(jd); /* like ln_get_solar_sdiam() */
+}
+
+/** Angular distance of two positions in arc seconds */
+static double separation(const struct ln_equ_posn *a, const struct ln_equ_posn *b)
+{
+	double dra = (a->ra - b->ra) * DEG, ddec = (a->dec - b->dec) * DEG;
+	double h = sin(ddec / 2) * sin(ddec / 2) + cos(a->dec * DEG) * cos(b->dec * DEG) * sin(dra / 2) * sin(dra / 2);
+
+	return 2 * asin(sqrt(h)) / DEG * 3600;
+}
+
+/** Samples of the rise/set search from a position function */
+static void samples(struct rst_samples *s, double jd_ut, void (*equ_coords)(double, struct ln_equ_posn *))
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		equ_coords(jd_ut + i - 1, &s->pos[i]);
+
+	s->obj = NULL;
+	s->jd = jd_ut;
+	s->sidereal = object_sidereal_time(jd_ut);
+}
+
+void solar_compare(double first_jd, double last_jd, double step, const struct ln_lnlat_posn *obs, FILE *out)
+{
+	struct ln_equ_posn ref, fast;
+	struct rst_samples sref, sfast;
+	struct ln_rst_time rref, rfast;
+	double jd, d, dist = 0, diam = 0, pos = 0, pos_jd = first_jd;
+	double events[3] = { 0 }, events_jd[3] = { first_jd, first_jd, first_jd };
+	long n = 0, days = 0;
+	int i;
+
+	for (jd = first_jd; jd < last_jd; jd += step, n++) {
+		ln_get_solar_equ_coords(jd, &ref);
+		solar_equ_coords(jd, &fast);
+
+		d = separation(&ref, &fast);
+		if (d > pos) {
+			pos = d;
+			pos_jd = jd;
+		}
+
+		d = fabs(ln_get_earth_solar_dist(jd) - solar_earth_dist(jd));
+		if (d > dist)
+			dist = d;
+
+		d = fabs(ln_get_solar_sdiam(jd) - solar_sdiam(jd));
+		if (d > diam)
+			diam = d;
+	}
+
+	fprintf(out, "positions:   %ld\n", n);
+	fprintf(out, "position:    %.3f arcsec max. at JD %.5f\n", pos, pos_jd);
+	fprintf(out, "distance:    %.3e AU max.\n", dist);
+	fprintf(out, "diameter:    %.3f arcsec max.\n", diam);
+
+	if (!obs)
+		return;
+
+	for (jd = floor(first_jd - .5) + .5; jd < last_jd; jd++) {
+		samples(&sref, jd, ln_get_solar_equ_coords);
+		samples(&sfast, jd, solar_equ_coords);
+
+		if (rst_solve(&sref, obs, LN_SOLAR_STANDART_HORIZON, NULL, &rref) ||
+		    rst_solve(&sfast, obs, LN_SOLAR_STANDART_HORIZON, NULL, &rfast))
+			continue; /* circumpolar with either */
+
+		double diff[3] = { rref.rise - rfast.rise, rref.set - rfast.set, rref.transit - rfast.transit };
+
+		for (i = 0; i < 3; i++) {
+			d = fabs(diff[i]) * 86400;
+			if (d > events[i]) {
+				events[i] = d;
+				events_jd[i] = jd;
+			}
+		}
+
+		days++;
+	}
+
+	fprintf(out, "days:        %ld\n", days);
+	fprintf(out, "rise:        %.3f s max. at JD %.1f\n", events[0], events_jd[0]);
+	fprintf(out, "set:         %.3f s max. at JD %.1f\n", events[1], events_jd[1]);
+	fprintf(out, "transit:     %.3f s max. at JD %.1f\n", events[2], events_jd[2]);
+}
@@ -0,0 +1,57 @@
+/**
+ * Low precision position of the sun in closed form
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _SOLAR_H_
+#define _SOLAR_H_
+
+#include <stdio.h>
+#include <libnova/libnova.h>
+
+/** Maximum error of solar_equ_coords() in degrees (Meeus, chapter 25) */
+#define SOLAR_MAX_ERROR		0.01
+
+/** Apparent equatorial position of the sun with the low accuracy method of
+ * Meeus, chapter 25, which is also used by the NOAA solar calculator.
+ *
+ * The error stays below SOLAR_MAX_ERROR between 1900 and 2100. This moves
+ * rise and set by a few seconds at mid latitudes.
+ */
+void solar_equ_coords(double jd, struct ln_equ_posn *equ);
+
+/** Distance of the sun in AU */
+double solar_earth_dist(double jd);
+
+/** Apparent semidiameter of the sun in arc seconds */
+double solar_sdiam(double jd);
+
+/** Report the maximum deviation from the libnova series in [first_jd, last_jd).
+ *
+ * Positions are compared every step days. If obs is not NULL, the times of
+ * rise, set and transit are compared for every day as well.
+ */
+void solar_compare(double first_jd, double last_jd, double step, const struct ln_lnlat_posn *obs, FILE *out);
+
+#endif /* _SOLAR_H_ */
@@ -0,0 +1,121 @@
+/**
+ * Phase timers and counters for --stats
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "stats.h"
+
+struct stats stats;
+
+static const char *phases[] = { "parse", "geocode", "tz", "rst", "pos", "format" };
+static const char *counters[] = { "cache_hits", "cache_misses", "bytes_fetched" };
+
+static const char *report_file;
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report_text(FILE *f)
+{
+	int i;
+
+	fprintf(f, "Stats:\n");
+	for (i = 0; i < STATS_PHASES; i++)
+		fprintf(f, "  %-14s %10" PRIu64 " calls %14.3f ms\n", phases[i], stats.calls[i], stats.ns[i] / 1e6);
+
+	for (i = 0; i < STATS_COUNTERS; i++)
+		fprintf(f, "  %-14s %10" PRIu64 "\n", counters[i], stats.counters[i]);
+
+	for (i = 0; i < STATS_MAX_OBJECTS; i++) {
+		if (stats.names[i])
+			fprintf(f, "  %-14s %10" PRIu64 " evaluations\n", stats.names[i], stats.objects[i]);
+	}
+}
+
+static void report_json(FILE *f)
+{
+	int i, first = 1;
+
+	fprintf(f, "{\n\t\"phases\": {");
+	for (i = 0; i < STATS_PHASES; i++)
+		fprintf(f, "%s\n\t\t\"%s\": { \"calls\": %" PRIu64 ", \"ns\": %" PRIu64 " }",
+			i ? "," : "", phases[i], stats.calls[i], stats.ns[i]);
+
+	fprintf(f, "\n\t},\n\t\"counters\": {");
+	for (i = 0; i < STATS_COUNTERS; i++)
+		fprintf(f, "%s\n\t\t\"%s\": %" PRIu64, i ? "," : "", counters[i], stats.counters[i]);
+
+	fprintf(f, "\n\t},\n\t\"evaluations\": {");
+	for (i = 0; i < STATS_MAX_OBJECTS; i++) {
+		if (stats.names[i]) {
+			fprintf(f, "%s\n\t\t\"%s\": %" PRIu64, first ? "" : ",", stats.names[i], stats.objects[i]);
+			first = 0;
+		}
+	}
+
+	fprintf(f, "\n\t}\n}\n");
+}
+
+static void report(void)
+{
+	FILE *f;
+
+	fflush(stdout); /* keep the summary after the results on a terminal */
+
+	if (!report_file) {
+		report_text(stderr);
+		return;
+	}
+
+	f = fopen(report_file, "w");
+	if (!f) {
+		fprintf(stderr, "Error: failed to open stats file: %s\n", report_file);
+		return;
+	}
+
+	report_json(f);
+	fclose(f);
+}
+
+void stats_enable(const char *filename)
+{
+	report_file = filename;
+
+	if (!stats.enabled)
+		atexit(report);
+
+	stats.enabled = true;
+}
@@ -0,0 +1,103 @@
+/**
+ * Phase timers and counters for --stats
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define STATS_MAX_OBJECTS	16
+
+enum stats_phase {
+	STATS_PARSE,			/**< Command line and setup */
+	STATS_GEOCODE,			/**< Places and timezones from geonames.org */
+	STATS_TZ,			/**< Timezone index and tzset() */
+	STATS_RST,			/**< object_rst() */
+	STATS_POS,			/**< object_pos() */
+	STATS_FORMAT,			/**< format_render() */
+	STATS_PHASES
+};
+
+enum stats_counter {
+	STATS_CACHE_HITS,
+	STATS_CACHE_MISSES,
+	STATS_BYTES_FETCHED,		/**< Response bodies from the web service */
+	STATS_COUNTERS
+};
+
+/** Totals of all threads, updated atomically */
+struct stats {
+	bool enabled;
+
+	uint64_t ns[STATS_PHASES];
+	uint64_t calls[STATS_PHASES];
+	uint64_t counters[STATS_COUNTERS];
+
+	uint64_t objects[STATS_MAX_OBJECTS];	/**< Evaluations of the series per object */
+	const char *names[STATS_MAX_OBJECTS];
+};
+
+extern struct stats stats;
+
+/** Read the monotonic clock in nanoseconds */
+uint64_t stats_now(void);
+
+/** Start collecting and report the totals at exit.
+ *
+ * @param filename Write JSON to this file or NULL for a summary on stderr
+ */
+void stats_enable(const char *filename);
+
+/* The helpers below only cost a branch while stats are disabled */
+
+static inline uint64_t stats_begin(void)
+{
+	return stats.enabled ? stats_now() : 0;
+}
+
+static inline void stats_end(enum stats_phase p, uint64_t start)
+{
+	if (stats.enabled) {
+		__atomic_fetch_add(&stats.ns[p], stats_now() - start, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats.calls[p], 1, __ATOMIC_RELAXED);
+	}
+}
+
+static inline void stats_count(enum stats_counter c, uint64_t n)
+{
+	if (stats.enabled)
+		__atomic_fetch_add(&stats.counters[c], n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_object(unsigned idx, const char *name)
+{
+	if (stats.enabled && idx < STATS_MAX_OBJECTS) {
+		__atomic_store_n(&stats.names[idx], name, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats.objects[idx], 1, __ATOMIC_RELAXED);
+	}
+}
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,157 @@
+/**
+ * Stream positions at a fixed rate
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <libnova/libnova.h>
+
+#include "track.h"
+
+#define JD_UNIX_EPOCH	2440587.5
+
+/** Two full evaluations which are interpolated linearly */
+struct span {
+	double jd[2];
+	struct object_details pos[2];
+};
+
+static volatile sig_atomic_t stop;
+
+static void quit(int sig)
+{
+	stop = 1;
+}
+
+/** Make sure that the span covers jd, shifting it forward if possible */
+static void update(struct span *s, const struct object *obj, double jd)
+{
+	double interval = TRACK_INTERVAL / 86400.0;
+
+	if (jd >= s->jd[0] && jd <= s->jd[1])
+		return;
+
+	if (jd > s->jd[1] && jd <= s->jd[1] + interval) {
+		s->jd[0] = s->jd[1];
+		s->pos[0] = s->pos[1];
+	}
+	else { /* first tick or the clock jumped */
+		s->jd[0] = jd;
+		object_pos(obj, s->jd[0], &s->pos[0]);
+	}
+
+	s->jd[1] = s->jd[0] + interval;
+	object_pos(obj, s->jd[1], &s->pos[1]);
+}
+
+static void interpolate(const struct span *s, double jd, struct object_details *details)
+{
+	const struct object_details *a = &s->pos[0], *b = &s->pos[1];
+	double f = (jd - s->jd[0]) / (s->jd[1] - s->jd[0]);
+	double dra = b->equ.ra - a->equ.ra;
+
+	/* the right ascension wraps at 360° */
+	dra -= 360 * floor((dra + 180) / 360);
+
+	details->jd = jd;
+	details->equ.ra = ln_range_degrees(a->equ.ra + f * dra);
+	details->equ.dec = a->equ.dec + f * (b->equ.dec - a->equ.dec);
+	details->distance = a->distance + f * (b->distance - a->distance);
+	details->diameter = a->diameter + f * (b->diameter - a->diameter);
+	details->object = a->object;
+}
+
+int track_run(const struct object *obj, struct ln_lnlat_posn obs, double hz, struct format *fmt, FILE *out)
+{
+	struct sigaction sa = { .sa_handler = quit };
+	struct object_details details = { .obs = obs };
+	struct format_buffer buf = { 0 };
+	struct span span = { .jd = { 0, 0 } };
+	struct timespec now, ts;
+	time_t base;
+	int64_t when, period = llround(1e9 / hz);
+	uint64_t tick = 0;
+	int i, ret = 0;
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN); /* a closed pipe is reported by fflush() */
+
+	/* the position is only interpolated, there are no events */
+	details.rst.rise = details.rst.set = details.rst.transit = NAN;
+	for (i = 0; i < TWILIGHTS; i++)
+		details.twilight[i].dawn = details.twilight[i].dusk = NAN;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	base = now.tv_sec + 1;
+
+	while (!stop) {
+		/* nanoseconds since base, exact for any number of ticks */
+		when = (int64_t) (tick * 1e9 / hz + 0.5);
+
+		ts.tv_sec = base + when / 1000000000;
+		ts.tv_nsec = when % 1000000000;
+
+		/* render ahead of the deadline */
+		details.jd = JD_UNIX_EPOCH + (ts.tv_sec + ts.tv_nsec / 1e9) / 86400;
+		update(&span, obj, details.jd);
+		interpolate(&span, details.jd, &details);
+		object_localtime(&details);
+
+		if (!format_render(fmt, &details, &buf)) {
+			ret = -1;
+			break;
+		}
+
+		if (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL))
+			continue; /* interrupted by a signal */
+
+		fputs(buf.ptr, out);
+		putc('\n', out);
+		if (fflush(out)) {
+			ret = -1;
+			break;
+		}
+
+		/* skip ticks which have already passed instead of catching up */
+		clock_gettime(CLOCK_REALTIME, &now);
+		when = (int64_t) (now.tv_sec - base) * 1000000000 + now.tv_nsec;
+		if (when - (int64_t) (tick * 1e9 / hz) > period)
+			tick = (uint64_t) (when / (1e9 / hz));
+
+		tick++;
+	}
+
+	format_buffer_free(&buf);
+
+	return ret;
+}
@@ -0,0 +1,55 @@
+/**
+ * Stream positions at a fixed rate
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _TRACK_H_
+#define _TRACK_H_
+
+#include <stdio.h>
+#include <libnova/libnova.h>
+
+#include "objects.h"
+#include "formatter.h"
+
+#define TRACK_MAX_HZ	1000
+#define TRACK_INTERVAL	600	/**< Seconds between full evaluations of the position */
+
+/** Write the position of an object at a fixed rate until SIGINT or SIGTERM.
+ *
+ * The ticks are aligned to full seconds of the real time clock and slept
+ * for with absolute deadlines, so the rate does not drift. Each line is
+ * rendered ahead of its deadline and written when it is reached.
+ * Ticks missed by more than a period (e.g. after suspend) are skipped.
+ *
+ * The equatorial position is calculated by object_pos() every
+ * TRACK_INTERVAL seconds and interpolated in between, so a tick only
+ * converts it to horizontal coordinates and renders the format.
+ *
+ * @retval 0 on a clean shutdown
+ * @retval -1 if the output failed
+ */
+int track_run(const struct object *obj, struct ln_lnlat_posn obs, double hz, struct format *fmt, FILE *out);
+
+#endif /* _TRACK_H_ */
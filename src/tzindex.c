@@ -0,0 +1,755 @@
+/**
+ * Offline timezone lookup from a grid index of the timezone boundaries
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../config.h"
+#include "tzindex.h"
+
+#ifdef HAVE_JSON_C_JSON_H
+  #include <json-c/json.h>
+#endif
+
+#define TZINDEX_OCEAN_ZONES	25	/**< Etc/GMT+12 to Etc/GMT-12 */
+
+static uint32_t index_of(double x, double origin, double step, uint32_t n)
+{
+	double i = floor((x - origin) / step);
+
+	return i < 0 ? 0 : i >= n ? n - 1 : i;
+}
+
+/** The reference point of a cell.
+ *
+ * It is slightly off the center, as real boundaries often follow round
+ * coordinates which would hit the center exactly.
+ */
+static void reference(uint32_t r, uint32_t c, double step, double *x, double *y)
+{
+	*x = -180 + (c + 0.5 + 1.2345e-4) * step;
+	*y = -90 + (r + 0.5 + 2.3456e-4) * step;
+}
+
+static double orientation(double px, double py, double qx, double qy, double rx, double ry)
+{
+	return (qx - px) * (ry - py) - (qy - py) * (rx - px);
+}
+
+/** Does the segment from p to q cross the edge?
+ *
+ * Vertices on the line through p and q count as being on its left side.
+ * So a boundary passing exactly through a vertex is counted once.
+ */
+static int crosses(double px, double py, double qx, double qy, const struct tzindex_edge *e)
+{
+	int a = orientation(px, py, qx, qy, e->x0, e->y0) > 0;
+	int b = orientation(px, py, qx, qy, e->x1, e->y1) > 0;
+
+	if (a == b)
+		return 0;
+
+	return (orientation(e->x0, e->y0, e->x1, e->y1, px, py) > 0) !=
+	       (orientation(e->x0, e->y0, e->x1, e->y1, qx, qy) > 0);
+}
+
+#ifdef HAVE_JSON_C_JSON_H
+struct build_edge {
+	uint32_t zone;
+	struct tzindex_edge e;
+};
+
+/** An edge crossing a cell */
+struct build_pair {
+	uint32_t cell, zone, edge;
+};
+
+/** An edge crossing the horizontal line through the reference points of a row */
+struct build_crossing {
+	uint32_t row, zone;
+	double x;
+};
+
+struct builder {
+	uint32_t rows, cols;
+
+	char **zones;
+	size_t nzones, zones_size;
+
+	struct build_edge *edges;
+	size_t nedges, edges_size;
+
+	struct build_pair *pairs;
+	size_t npairs, pairs_size;
+
+	struct build_crossing *crossings;
+	size_t ncrossings, crossings_size;
+};
+
+static int grow(void **ptr, size_t *size, size_t needed, size_t elmsize)
+{
+	size_t new_size = *size ? *size : 1024;
+	void *p;
+
+	if (needed <= *size)
+		return 0;
+
+	while (new_size < needed)
+		new_size *= 2;
+
+	p = realloc(*ptr, new_size * elmsize);
+	if (!p)
+		return -1;
+
+	*ptr = p;
+	*size = new_size;
+
+	return 0;
+}
+
+static int64_t add_zone(struct builder *b, const char *tzid)
+{
+	size_t i;
+
+	/* a zone might be split across several features */
+	for (i = 0; i < b->nzones; i++) {
+		if (!strcmp(b->zones[i], tzid))
+			return i;
+	}
+
+	if (grow((void **) &b->zones, &b->zones_size, b->nzones + 1, sizeof(char *)))
+		return -1;
+
+	b->zones[b->nzones] = strdup(tzid);
+	if (!b->zones[b->nzones])
+		return -1;
+
+	return b->nzones++;
+}
+
+static int add_pair(struct builder *b, uint32_t cell, uint32_t edge)
+{
+	if (grow((void **) &b->pairs, &b->pairs_size, b->npairs + 1, sizeof(*b->pairs)))
+		return -1;
+
+	b->pairs[b->npairs++] = (struct build_pair) {
+		.cell = cell,
+		.zone = b->edges[edge].zone,
+		.edge = edge
+	};
+
+	return 0;
+}
+
+/** Register the edge in all cells it touches and all rows it crosses */
+static int rasterize(struct builder *b, uint32_t edge)
+{
+	const struct tzindex_edge *e = &b->edges[edge].e;
+	double ymin = fmin(e->y0, e->y1), ymax = fmax(e->y0, e->y1);
+	double lo, hi, xa, xb, xr, yr;
+	uint32_t r, c, r0, r1, c0, c1;
+
+	r0 = index_of(ymin, -90, TZINDEX_STEP, b->rows);
+	r1 = index_of(ymax, -90, TZINDEX_STEP, b->rows);
+
+	for (r = r0; r <= r1; r++) {
+		/* the part of the edge inside the band of the row */
+		lo = fmax(ymin, -90 + r * TZINDEX_STEP);
+		hi = fmin(ymax, -90 + (r + 1) * TZINDEX_STEP);
+
+		if (e->y0 == e->y1) {
+			xa = e->x0;
+			xb = e->x1;
+		}
+		else {
+			xa = e->x0 + (lo - e->y0) * (e->x1 - e->x0) / (e->y1 - e->y0);
+			xb = e->x0 + (hi - e->y0) * (e->x1 - e->x0) / (e->y1 - e->y0);
+		}
+
+		c0 = index_of(fmin(xa, xb), -180, TZINDEX_STEP, b->cols);
+		c1 = index_of(fmax(xa, xb), -180, TZINDEX_STEP, b->cols);
+
+		for (c = c0; c <= c1; c++) {
+			if (add_pair(b, r * b->cols + c, edge))
+				return -1;
+		}
+
+		/* same rule as crosses() for a horizontal segment */
+		reference(r, 0, TZINDEX_STEP, &xr, &yr);
+		if ((e->y0 > yr) != (e->y1 > yr)) {
+			if (grow((void **) &b->crossings, &b->crossings_size, b->ncrossings + 1, sizeof(*b->crossings)))
+				return -1;
+
+			b->crossings[b->ncrossings++] = (struct build_crossing) {
+				.row = r,
+				.zone = b->edges[edge].zone,
+				.x = e->x0 + (yr - e->y0) * (e->x1 - e->x0) / (e->y1 - e->y0)
+			};
+		}
+	}
+
+	return 0;
+}
+
+static int add_edge(struct builder *b, uint32_t zone, float x0, float y0, float x1, float y1)
+{
+	if (grow((void **) &b->edges, &b->edges_size, b->nedges + 1, sizeof(*b->edges)))
+		return -1;
+
+	b->edges[b->nedges] = (struct build_edge) {
+		.zone = zone,
+		.e = { x0, y0, x1, y1 }
+	};
+
+	return rasterize(b, b->nedges++);
+}
+
+/** Add a closed linear ring, dropping vertices which are closer than TZINDEX_SIMPLIFY */
+static int add_ring(struct builder *b, uint32_t zone, struct json_object *jring)
+{
+	struct json_object *jpoint;
+	float x, y, x0 = 0, y0 = 0, px = 0, py = 0;
+	size_t i, n, kept = 0;
+
+	n = json_object_array_length(jring);
+	for (i = 0; i < n; i++) {
+		jpoint = json_object_array_get_idx(jring, i);
+		if (json_object_array_length(jpoint) < 2)
+			return -1;
+
+		x = json_object_get_double(json_object_array_get_idx(jpoint, 0));
+		y = json_object_get_double(json_object_array_get_idx(jpoint, 1));
+
+		if (kept == 0) {
+			x0 = px = x;
+			y0 = py = y;
+			kept++;
+			continue;
+		}
+
+		if (fabsf(x - px) < TZINDEX_SIMPLIFY && fabsf(y - py) < TZINDEX_SIMPLIFY && i + 1 < n)
+			continue;
+
+		if (add_edge(b, zone, px, py, x, y))
+			return -1;
+
+		px = x;
+		py = y;
+		kept++;
+	}
+
+	/* GeoJSON rings are closed already, but be tolerant */
+	if (kept > 1 && (px != x0 || py != y0))
+		return add_edge(b, zone, px, py, x0, y0);
+
+	return 0;
+}
+
+static int add_polygon(struct builder *b, uint32_t zone, struct json_object *jpolygon)
+{
+	size_t i;
+
+	for (i = 0; i < json_object_array_length(jpolygon); i++) {
+		if (add_ring(b, zone, json_object_array_get_idx(jpolygon, i)))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int add_feature(struct builder *b, struct json_object *jfeature)
+{
+	struct json_object *jprops, *jtzid, *jgeometry, *jtype, *jcoords;
+	const char *type;
+	int64_t zone;
+	size_t i;
+
+	if (!json_object_object_get_ex(jfeature, "properties", &jprops) ||
+	    !json_object_object_get_ex(jprops, "tzid", &jtzid) ||
+	    !json_object_object_get_ex(jfeature, "geometry", &jgeometry) ||
+	    !json_object_object_get_ex(jgeometry, "type", &jtype) ||
+	    !json_object_object_get_ex(jgeometry, "coordinates", &jcoords))
+		return -1;
+
+	zone = add_zone(b, json_object_get_string(jtzid));
+	if (zone < 0)
+		return -1;
+
+	type = json_object_get_string(jtype);
+	if (!strcmp(type, "Polygon"))
+		return add_polygon(b, zone, jcoords);
+	else if (!strcmp(type, "MultiPolygon")) {
+		for (i = 0; i < json_object_array_length(jcoords); i++) {
+			if (add_polygon(b, zone, json_object_array_get_idx(jcoords, i)))
+				return -1;
+		}
+
+		return 0;
+	}
+
+	return -1;
+}
+
+static int compare_pairs(const void *a, const void *b)
+{
+	const struct build_pair *pa = a, *pb = b;
+
+	if (pa->cell != pb->cell)
+		return pa->cell < pb->cell ? -1 : 1;
+	if (pa->zone != pb->zone)
+		return pa->zone < pb->zone ? -1 : 1;
+
+	return pa->edge < pb->edge ? -1 : pa->edge > pb->edge;
+}
+
+static int compare_crossings(const void *a, const void *b)
+{
+	const struct build_crossing *ca = a, *cb = b;
+
+	if (ca->row != cb->row)
+		return ca->row < cb->row ? -1 : 1;
+	if (ca->zone != cb->zone)
+		return ca->zone < cb->zone ? -1 : 1;
+
+	return ca->x < cb->x ? -1 : ca->x > cb->x;
+}
+
+/** Find the zone containing the reference point of every cell by scanning the rows */
+static void fill_references(struct builder *b, uint32_t *cells)
+{
+	const struct build_crossing *first, *last, *end = b->crossings + b->ncrossings;
+	double x, y;
+	uint32_t c, c1;
+
+	for (first = b->crossings; first < end; first = last) {
+		for (last = first; last < end && last->row == first->row && last->zone == first->zone; last++);
+
+		/* even-odd rule: the points between pairs of crossings are inside */
+		for (; first + 1 < last; first += 2) {
+			c = index_of(first[0].x, -180, TZINDEX_STEP, b->cols);
+			c1 = index_of(first[1].x, -180, TZINDEX_STEP, b->cols);
+
+			for (; c <= c1; c++) {
+				reference(first->row, c, TZINDEX_STEP, &x, &y);
+
+				if (first[0].x < x && x <= first[1].x && cells[first->row * b->cols + c] == TZINDEX_NONE)
+					cells[first->row * b->cols + c] = first->zone;
+			}
+		}
+	}
+}
+
+static uint64_t align(uint64_t offset)
+{
+	return (offset + 7) & ~7ULL;
+}
+
+static int write_table(FILE *f, uint64_t offset, const void *data, size_t size)
+{
+	if (fseek(f, offset, SEEK_SET))
+		return -1;
+
+	return size && fwrite(data, size, 1, f) != 1 ? -1 : 0;
+}
+
+static int write_index(struct builder *b, const char *filename)
+{
+	struct tzindex_header hdr = {
+		.magic = TZINDEX_MAGIC,
+		.version = TZINDEX_VERSION,
+		.bom = TZINDEX_BOM,
+		.rows = b->rows,
+		.cols = b->cols,
+		.nzones = b->nzones + TZINDEX_OCEAN_ZONES,
+		.ocean = b->nzones,
+		.step = TZINDEX_STEP
+	};
+	struct tzindex_border *borders = NULL;
+	struct tzindex_entry *entries = NULL;
+	struct tzindex_edge *edges = NULL;
+	uint32_t *cells = NULL, *zones = NULL;
+	char *strings = NULL, etc[32];
+	size_t ncells = (size_t) b->rows * b->cols, i, j, k, len, strings_len = 0, nentries = 0;
+	size_t borders_size = 0, entries_size = 0, strings_size = 0;
+	uint32_t inside;
+	bool has_inside;
+	FILE *f = NULL;
+	int ret = -1;
+
+	cells = malloc(ncells * sizeof(uint32_t));
+	zones = malloc(hdr.nzones * sizeof(uint32_t));
+	edges = malloc(b->npairs * sizeof(struct tzindex_edge));
+	if (!cells || !zones || (b->npairs && !edges))
+		goto nomem;
+
+	for (i = 0; i < ncells; i++)
+		cells[i] = TZINDEX_NONE;
+
+	fill_references(b, cells);
+
+	/* cells crossed by edges are resolved by point in polygon tests against the reference point */
+	for (i = 0; i < b->npairs; i = j) {
+		for (j = i; j < b->npairs && b->pairs[j].cell == b->pairs[i].cell; j++);
+
+		if (grow((void **) &borders, &borders_size, hdr.nborders + 1, sizeof(*borders)))
+			goto nomem;
+
+		inside = cells[b->pairs[i].cell];
+		has_inside = false;
+
+		borders[hdr.nborders].first = nentries;
+
+		for (k = i; k < j; ) {
+			if (grow((void **) &entries, &entries_size, nentries + 2, sizeof(*entries)))
+				goto nomem;
+
+			entries[nentries] = (struct tzindex_entry) {
+				.zone = b->pairs[k].zone,
+				.inside = b->pairs[k].zone == inside,
+				.first = hdr.nedges
+			};
+
+			has_inside |= entries[nentries].inside;
+
+			for (; k < j && b->pairs[k].zone == entries[nentries].zone; k++)
+				edges[hdr.nedges++] = b->edges[b->pairs[k].edge].e;
+
+			entries[nentries].count = hdr.nedges - entries[nentries].first;
+			nentries++;
+		}
+
+		/* a zone covering the whole cell is checked last */
+		if (inside != TZINDEX_NONE && !has_inside) {
+			entries[nentries++] = (struct tzindex_entry) {
+				.zone = inside,
+				.inside = 1,
+				.first = hdr.nedges
+			};
+		}
+
+		borders[hdr.nborders].count = nentries - borders[hdr.nborders].first;
+		cells[b->pairs[i].cell] = TZINDEX_BORDER | hdr.nborders++;
+	}
+
+	hdr.nentries = nentries;
+
+	for (i = 0; i < hdr.nzones; i++) {
+		const char *name;
+		int offset = (int) (i - b->nzones) - 12;
+
+		if (i < b->nzones)
+			name = b->zones[i];
+		else {
+			/* POSIX style: the sign is inverted */
+			if (offset)
+				snprintf(etc, sizeof(etc), "Etc/GMT%+d", -offset);
+			else
+				snprintf(etc, sizeof(etc), "Etc/GMT");
+			name = etc;
+		}
+
+		len = strlen(name) + 1;
+		if (grow((void **) &strings, &strings_size, strings_len + len, 1))
+			goto nomem;
+
+		memcpy(strings + strings_len, name, len);
+		zones[i] = strings_len;
+		strings_len += len;
+	}
+
+	hdr.cells = align(sizeof(hdr));
+	hdr.borders = align(hdr.cells + ncells * sizeof(*cells));
+	hdr.entries = align(hdr.borders + hdr.nborders * sizeof(*borders));
+	hdr.edges = align(hdr.entries + hdr.nentries * sizeof(*entries));
+	hdr.zones = align(hdr.edges + hdr.nedges * sizeof(*edges));
+	hdr.strings = align(hdr.zones + hdr.nzones * sizeof(*zones));
+	hdr.strings_size = strings_len;
+
+	f = fopen(filename, "w");
+	if (!f)
+		goto out;
+
+	if (write_table(f, 0, &hdr, sizeof(hdr)) ||
+	    write_table(f, hdr.cells, cells, ncells * sizeof(*cells)) ||
+	    write_table(f, hdr.borders, borders, hdr.nborders * sizeof(*borders)) ||
+	    write_table(f, hdr.entries, entries, hdr.nentries * sizeof(*entries)) ||
+	    write_table(f, hdr.edges, edges, hdr.nedges * sizeof(*edges)) ||
+	    write_table(f, hdr.zones, zones, hdr.nzones * sizeof(*zones)) ||
+	    write_table(f, hdr.strings, strings, strings_len) ||
+	    fclose(f)) {
+		f = NULL;
+		goto out;
+	}
+
+	f = NULL;
+	ret = 0;
+	goto out;
+
+nomem:	errno = ENOMEM;
+out:	if (f)
+		fclose(f);
+	free(cells);
+	free(zones);
+	free(borders);
+	free(entries);
+	free(edges);
+	free(strings);
+
+	return ret;
+}
+
+int tzindex_build(const char *filename, FILE *in)
+{
+	struct builder b = {
+		.rows = round(180 / TZINDEX_STEP),
+		.cols = round(360 / TZINDEX_STEP)
+	};
+	struct json_object *jobj = NULL, *jfeatures;
+	char *buf = NULL;
+	size_t len = 0, size = 0, n, i;
+	int ret = -1;
+
+	/* the whole collection is parsed at once */
+	do {
+		if (grow((void **) &buf, &size, len + 65536, 1))
+			goto out;
+
+		n = fread(buf + len, 1, size - len - 1, in);
+		len += n;
+	} while (n > 0);
+
+	if (!buf)
+		goto out;
+	buf[len] = '\0';
+
+	jobj = json_tokener_parse(buf);
+	if (!jobj) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	free(buf);
+	buf = NULL;
+
+	if (!json_object_object_get_ex(jobj, "features", &jfeatures)) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < json_object_array_length(jfeatures); i++) {
+		errno = 0;
+		if (add_feature(&b, json_object_array_get_idx(jfeatures, i))) {
+			if (errno != ENOMEM) /* an invalid feature */
+				errno = EINVAL;
+			goto out;
+		}
+	}
+
+	qsort(b.pairs, b.npairs, sizeof(*b.pairs), compare_pairs);
+	qsort(b.crossings, b.ncrossings, sizeof(*b.crossings), compare_crossings);
+
+	ret = write_index(&b, filename);
+
+out:	if (jobj)
+		json_object_put(jobj);
+	for (i = 0; i < b.nzones; i++)
+		free(b.zones[i]);
+	free(b.zones);
+	free(b.edges);
+	free(b.pairs);
+	free(b.crossings);
+	free(buf);
+
+	return ret;
+}
+#else
+int tzindex_build(const char *filename, FILE *in)
+{
+	errno = ENOTSUP;
+
+	return -1;
+}
+#endif /* HAVE_JSON_C_JSON_H */
+
+/** Check that all references of the index stay inside the file */
+static int validate(const struct tzindex *t)
+{
+	const struct tzindex_header *hdr = t->hdr;
+	uint64_t i;
+
+	for (i = 0; i < (uint64_t) hdr->rows * hdr->cols; i++) {
+		if (t->cells[i] & TZINDEX_BORDER) {
+			if ((t->cells[i] & ~TZINDEX_BORDER) >= hdr->nborders)
+				return -1;
+		}
+		else if (t->cells[i] != TZINDEX_NONE && t->cells[i] >= hdr->nzones)
+			return -1;
+	}
+
+	for (i = 0; i < hdr->nborders; i++) {
+		if ((uint64_t) t->borders[i].first + t->borders[i].count > hdr->nentries)
+			return -1;
+	}
+
+	for (i = 0; i < hdr->nentries; i++) {
+		if (t->entries[i].zone >= hdr->nzones ||
+		    (uint64_t) t->entries[i].first + t->entries[i].count > hdr->nedges)
+			return -1;
+	}
+
+	for (i = 0; i < hdr->nzones; i++) {
+		if (t->zones[i] >= hdr->strings_size)
+			return -1;
+	}
+
+	return 0;
+}
+
+struct tzindex * tzindex_open(const char *filename)
+{
+	struct tzindex *t;
+	const struct tzindex_header *hdr;
+	struct stat st;
+	uint64_t size;
+	void *addr;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	if ((uint64_t) st.st_size < sizeof(*hdr)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size = st.st_size;
+	addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	t = malloc(sizeof(struct tzindex));
+	if (!t) {
+		munmap(addr, size);
+		return NULL;
+	}
+
+	hdr = addr;
+	t->addr = addr;
+	t->size = size;
+	t->hdr = hdr;
+	t->cells = (const void *) ((const char *) addr + hdr->cells);
+	t->borders = (const void *) ((const char *) addr + hdr->borders);
+	t->entries = (const void *) ((const char *) addr + hdr->entries);
+	t->edges = (const void *) ((const char *) addr + hdr->edges);
+	t->zones = (const void *) ((const char *) addr + hdr->zones);
+	t->strings = (const char *) addr + hdr->strings;
+
+	if (memcmp(hdr->magic, TZINDEX_MAGIC, sizeof(TZINDEX_MAGIC)) ||
+	    hdr->version != TZINDEX_VERSION ||
+	    hdr->bom != TZINDEX_BOM ||
+	    hdr->rows == 0 || hdr->cols == 0 || hdr->step <= 0 ||
+	    hdr->ocean + TZINDEX_OCEAN_ZONES > hdr->nzones ||
+	    hdr->cells + (uint64_t) hdr->rows * hdr->cols * sizeof(uint32_t) > size ||
+	    hdr->borders + (uint64_t) hdr->nborders * sizeof(struct tzindex_border) > size ||
+	    hdr->entries + (uint64_t) hdr->nentries * sizeof(struct tzindex_entry) > size ||
+	    hdr->edges + (uint64_t) hdr->nedges * sizeof(struct tzindex_edge) > size ||
+	    hdr->zones + (uint64_t) hdr->nzones * sizeof(uint32_t) > size ||
+	    hdr->strings + hdr->strings_size > size ||
+	    hdr->strings_size == 0 || t->strings[hdr->strings_size - 1] != '\0' ||
+	    validate(t)) {
+		tzindex_close(t);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return t;
+}
+
+void tzindex_close(struct tzindex *t)
+{
+	munmap((void *) t->addr, t->size);
+	free(t);
+}
+
+const char * tzindex_lookup(const struct tzindex *t, double lat, double lng)
+{
+	const struct tzindex_header *hdr = t->hdr;
+	const struct tzindex_border *b;
+	const struct tzindex_entry *e;
+	double xr, yr;
+	uint32_t r, c, v, i, j;
+	int inside, offset;
+
+	r = index_of(lat, -90, hdr->step, hdr->rows);
+	c = index_of(lng, -180, hdr->step, hdr->cols);
+	v = t->cells[r * hdr->cols + c];
+
+	if (v == TZINDEX_NONE)
+		goto ocean;
+	else if (!(v & TZINDEX_BORDER))
+		return t->strings + t->zones[v];
+
+	/* count the boundaries between the reference point of the cell and the position */
+	reference(r, c, hdr->step, &xr, &yr);
+
+	b = &t->borders[v & ~TZINDEX_BORDER];
+	for (i = 0; i < b->count; i++) {
+		e = &t->entries[b->first + i];
+		inside = e->inside;
+
+		for (j = 0; j < e->count; j++)
+			inside ^= crosses(xr, yr, lng, lat, &t->edges[e->first + j]);
+
+		if (inside)
+			return t->strings + t->zones[e->zone];
+	}
+
+ocean:	offset = lround(lng / 15);
+	if (offset < -12)
+		offset = -12;
+	else if (offset > 12)
+		offset = 12;
+
+	return t->strings + t->zones[hdr->ocean + offset + 12];
+}
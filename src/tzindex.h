@@ -0,0 +1,121 @@
+/**
+ * Offline timezone lookup from a grid index of the timezone boundaries
+ *
+ * @copyright	2012 Steffen Vogel
+ * @license	http://www.gnu.org/licenses/gpl.txt GNU Public License
+ * @author	Steffen Vogel <post@steffenvogel.de>
+ * @link	https://www.noteblok.net/2012/03/14/cron-jobs-fur-sonnenauf-untergang/
+ */
+/*
+ * This file is part of calcelestial
+ *
+ * calcelestial is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * calcelestial is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with calcelestial. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TZINDEX_H_
+#define _TZINDEX_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define TZINDEX_MAGIC		"CALCTZI"
+#define TZINDEX_VERSION		1
+#define TZINDEX_BOM		0x01020304 /**< Detects files of a different byte order */
+#define TZINDEX_STEP		0.25	/**< Size of a cell in degrees */
+#define TZINDEX_SIMPLIFY	1e-4	/**< Vertices closer than this in degrees are dropped */
+
+#define TZINDEX_BORDER		0x80000000 /**< Flag for cells which are crossed by a boundary */
+#define TZINDEX_NONE		0x7fffffff /**< Cells outside of all zones, e.g. oceans */
+
+/** Header of a timezone index.
+ *
+ * The world is divided into rows * cols cells starting at 90° south and 180° west.
+ * Each cell holds either the index of the zone which covers it completely or
+ * TZINDEX_BORDER and the index of a struct tzindex_border.
+ *
+ * The zones from the boundaries are followed by the 25 nautical zones
+ * Etc/GMT+12 to Etc/GMT-12 starting at index ocean.
+ */
+struct tzindex_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t bom;
+	uint32_t rows, cols;
+	uint32_t nzones, ocean;
+	uint32_t nborders, nentries, nedges;
+	uint32_t reserved;
+	double step;
+	uint64_t cells, borders, entries, edges, zones, strings;
+	uint64_t strings_size;
+};
+
+/** Zones with boundaries in a cell */
+struct tzindex_border {
+	uint32_t first, count;		/**< Range of struct tzindex_entry */
+};
+
+struct tzindex_entry {
+	uint32_t zone;
+	uint32_t inside;		/**< Zone contains the reference point of the cell */
+	uint32_t first, count;		/**< Range of struct tzindex_edge inside the cell */
+};
+
+struct tzindex_edge {
+	float x0, y0, x1, y1;		/**< Longitude and latitude of both vertices */
+};
+
+/** A memory mapped timezone index */
+struct tzindex {
+	const void *addr;
+	size_t size;
+
+	const struct tzindex_header *hdr;
+	const uint32_t *cells;
+	const struct tzindex_border *borders;
+	const struct tzindex_entry *entries;
+	const struct tzindex_edge *edges;
+	const uint32_t *zones;		/**< Offsets into the string table */
+	const char *strings;
+};
+
+/** Build a timezone index from a GeoJSON FeatureCollection.
+ *
+ * Every feature needs a tzid property and a Polygon or MultiPolygon geometry,
+ * as published by the timezone-boundary-builder project.
+ *
+ * @retval 0 on success
+ * @retval -1 on error with errno set, EINVAL for invalid boundaries and
+ *         ENOTSUP without json-c support
+ */
+int tzindex_build(const char *filename, FILE *in);
+
+/** Map a timezone index into memory.
+ *
+ * @return NULL with errno set, EINVAL if the file is not a valid index
+ */
+struct tzindex * tzindex_open(const char *filename);
+
+void tzindex_close(struct tzindex *t);
+
+/** Find the IANA timezone of a position.
+ *
+ * Positions outside of all zones get the nautical zone of their longitude.
+ * Only cells crossed by a boundary need point in polygon tests.
+ *
+ * @return The tzid, never NULL
+ */
+const char * tzindex_lookup(const struct tzindex *t, double lat, double lng);
+
+#endif /* _TZINDEX_H_ */